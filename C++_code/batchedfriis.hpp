@@ -0,0 +1,199 @@
+#ifndef BATCHEDFRIIS_HPP
+#define BATCHEDFRIIS_HPP
+
+#include "ns3/abort.h"
+#include "ns3/boolean.h"
+#include "ns3/mobility-model.h"
+#include "ns3/node-container.h"
+#include "ns3/simulator.h"
+
+#include "weatheredfriis.hpp"
+#include "profiler.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+using namespace ns3;
+
+// Weathered Friis model for a shared YansWifiChannel that answers a whole transmission at once.
+//
+// YansWifiChannel::Send is not virtual, so the channel itself cannot be replaced; instead the
+// first CalcRxPower of a transmission (the channel asks for every receiver in turn, at the same
+// instant, with the same sender and tx power) computes the rx power of every registered receiver
+// in one CalcRxPowerBatch pass, and the following calls are lookups. Receiver positions are kept as
+// structure of arrays, extrapolated from the position and velocity recorded at each receiver's last
+// course change, so the batch does not go through the receivers' mobility models at all. That holds
+// for every mobility model whose velocity only changes at course changes, which is all of those in
+// these scenarios. The sender is left out of its own batch. Receivers that were never registered take
+// the scalar path, and so does every receiver when FastPath is off, as the batch kernel is the fast path.
+class BatchedWeatheredFriisPropagationLossModel: public WeatheredFriisPropagationLossModel{
+  public:
+    static TypeId GetTypeId(void);
+    BatchedWeatheredFriisPropagationLossModel() = default;
+
+    void AddReceiver(Ptr<MobilityModel> mobility);
+    void AddReceivers(NodeContainer nodes);
+
+  protected:
+    void DoDispose() override;
+
+  private:
+    double DoCalcRxPower(double txPowerDbm,
+                         Ptr<MobilityModel> a,
+                         Ptr<MobilityModel> b) const override;
+
+    void CourseChanged(Ptr<const MobilityModel> mobility);
+    void RunBatch(double txPowerDbm, Ptr<MobilityModel> sender) const;
+
+    std::vector<Ptr<MobilityModel>> m_receivers;
+    std::unordered_map<const MobilityModel*, uint32_t> m_index;
+    // position and velocity of every receiver at its last course change
+    std::vector<double> m_x0, m_y0, m_z0;
+    std::vector<double> m_vx, m_vy, m_vz;
+    std::vector<double> m_t0;
+
+    mutable std::vector<double> m_x, m_y, m_z;
+    mutable std::vector<double> m_rxPowerDbm;
+    // the transmission the current batch belongs to
+    mutable const MobilityModel* m_batchSender{nullptr};
+    mutable int64_t m_batchTime{-1};
+    mutable double m_batchTxPowerDbm{0};
+    mutable double m_batchWeatherLoss{-1};
+
+    bool m_verify;
+};
+
+// ===================================================================== //
+
+NS_OBJECT_ENSURE_REGISTERED(BatchedWeatheredFriisPropagationLossModel);
+
+TypeId
+BatchedWeatheredFriisPropagationLossModel::GetTypeId(void)
+{
+    static TypeId tid =
+        TypeId("ns3::BatchedWeatheredFriisPropagationLossModel")
+            .SetParent<WeatheredFriisPropagationLossModel>()
+            .SetGroupName("Propagation")
+            .AddConstructor<BatchedWeatheredFriisPropagationLossModel>()
+            .AddAttribute("VerifyBatch",
+                          "Check every batched answer against the scalar fast path and abort when they differ by "
+                          "more than 1e-9 dB. The check is not counted in Evaluations. Slow, for validation runs only.",
+                          BooleanValue(false),
+                          MakeBooleanAccessor(&BatchedWeatheredFriisPropagationLossModel::m_verify),
+                          MakeBooleanChecker());
+    return tid;
+}
+
+void
+BatchedWeatheredFriisPropagationLossModel::AddReceiver(Ptr<MobilityModel> mobility)
+{
+    NS_ABORT_MSG_IF(m_index.count(PeekPointer(mobility)), "receiver registered twice");
+    m_index[PeekPointer(mobility)] = m_receivers.size();
+    m_receivers.push_back(mobility);
+    for (std::vector<double>* column: {&m_x0, &m_y0, &m_z0, &m_vx, &m_vy, &m_vz, &m_t0, &m_x, &m_y, &m_z,
+                                       &m_rxPowerDbm})
+    {
+        column->push_back(0);
+    }
+    CourseChanged(mobility);
+    mobility->TraceConnectWithoutContext(
+        "CourseChange",
+        MakeCallback(&BatchedWeatheredFriisPropagationLossModel::CourseChanged, this));
+}
+
+void
+BatchedWeatheredFriisPropagationLossModel::AddReceivers(NodeContainer nodes)
+{
+    for (uint32_t i = 0; i < nodes.GetN(); i++)
+    {
+        Ptr<MobilityModel> mobility = nodes.Get(i)->GetObject<MobilityModel>();
+        NS_ABORT_MSG_IF(!mobility, "install the mobility before registering the receivers");
+        AddReceiver(mobility);
+    }
+}
+
+void
+BatchedWeatheredFriisPropagationLossModel::DoDispose()
+{
+    m_receivers.clear();
+    m_index.clear();
+    WeatheredFriisPropagationLossModel::DoDispose();
+}
+
+void
+BatchedWeatheredFriisPropagationLossModel::CourseChanged(Ptr<const MobilityModel> mobility)
+{
+    PROFILE_SCOPE("BatchedWeatheredFriisPropagationLossModel::CourseChanged");
+    uint32_t i = m_index.at(PeekPointer(mobility));
+    Vector position = mobility->GetPosition();
+    Vector velocity = mobility->GetVelocity();
+    m_x0[i] = position.x;
+    m_y0[i] = position.y;
+    m_z0[i] = position.z;
+    m_vx[i] = velocity.x;
+    m_vy[i] = velocity.y;
+    m_vz[i] = velocity.z;
+    m_t0[i] = Simulator::Now().GetSeconds();
+    // a batch computed earlier at this same instant used the old position
+    m_batchTime = -1;
+}
+
+void
+BatchedWeatheredFriisPropagationLossModel::RunBatch(double txPowerDbm, Ptr<MobilityModel> sender) const
+{
+    double now = Simulator::Now().GetSeconds();
+    std::size_t n = m_receivers.size();
+    for (std::size_t i = 0; i < n; i++)
+    {
+        double dt = now - m_t0[i];
+        m_x[i] = m_x0[i] + m_vx[i] * dt;
+        m_y[i] = m_y0[i] + m_vy[i] * dt;
+        m_z[i] = m_z0[i] + m_vz[i] * dt;
+    }
+    // the receivers before and after the sender, so it is not evaluated (nor counted) at distance zero
+    auto it = m_index.find(PeekPointer(sender));
+    std::size_t skip = it == m_index.end() ? n : it->second;
+    Vector tx = sender->GetPosition();
+    CalcRxPowerBatch(txPowerDbm, tx, m_x.data(), m_y.data(), m_z.data(), m_rxPowerDbm.data(), skip);
+    if (skip < n)
+    {
+        std::size_t next = skip + 1;
+        CalcRxPowerBatch(txPowerDbm, tx, m_x.data() + next, m_y.data() + next, m_z.data() + next,
+                         m_rxPowerDbm.data() + next, n - next);
+    }
+
+    m_batchSender = PeekPointer(sender);
+    m_batchTime = Simulator::Now().GetTimeStep();
+    m_batchTxPowerDbm = txPowerDbm;
+    m_batchWeatherLoss = GetWeatherLossDbPerM();
+}
+
+double
+BatchedWeatheredFriisPropagationLossModel::DoCalcRxPower(double txPowerDbm,
+                                                         Ptr<MobilityModel> a,
+                                                         Ptr<MobilityModel> b) const
+{
+    PROFILE_SCOPE("BatchedWeatheredFriisPropagationLossModel::DoCalcRxPower");
+    auto it = m_index.find(PeekPointer(b));
+    if (it == m_index.end() || !GetFastPath() || b == a)
+    {
+        return WeatheredFriisPropagationLossModel::DoCalcRxPower(txPowerDbm, a, b);
+    }
+    if (m_batchSender != PeekPointer(a) || m_batchTime != Simulator::Now().GetTimeStep() ||
+        m_batchTxPowerDbm != txPowerDbm || m_batchWeatherLoss != GetWeatherLossDbPerM())
+    {
+        RunBatch(txPowerDbm, a);
+    }
+    double rxPowerDbm = m_rxPowerDbm[it->second];
+    if (m_verify)
+    {
+        double scalar = PeekRxPower(txPowerDbm, a, b);
+        NS_ABORT_MSG_IF(std::abs(scalar - rxPowerDbm) > 1e-9,
+                        "batched rx power " << rxPowerDbm << " dBm, scalar " << scalar << " dBm");
+    }
+    return rxPowerDbm;
+}
+
+#endif
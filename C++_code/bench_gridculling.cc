@@ -0,0 +1,170 @@
+/*
+ *  Loss model shortcut benchmark: every node of a static 802.11b network broadcasts a frame once per
+ *  interval, with and without GridCullingPropagationLossModel in front of the loss model. The nodes
+ *  are spread uniformly over a square that grows with the node count, so the number of nodes in range
+ *  of a sender stays the same while the total grows. The channel still visits every node either way;
+ *  what the grid saves is the inner model, so the gain is in the wall time of the runs, which is what
+ *  the speedup column compares.
+ *
+ *  To run, write:
+ *
+ *  "./ns3 run "scratch/bench_gridculling --nodes=100,200,400,800,1600""
+ *
+ *  With --inner=hybrid the culled model is the CorrelatedHybridBuildingsPropagationLossModel of final_vanet
+ *  instead of the weathered Friis model, and --cullRange sets the range, as it cannot be solved from
+ *  that model. That is the case the grid is meant for; in front of the cheap Friis model expect a
+ *  speedup near or below 1.
+ *
+ *  Prints one csv line per node count and mode (nodes, culling, seconds, events, events per second,
+ *  receivers evaluated, receivers culled, speedup over the run without culling).
+ */
+
+#include "ns3/buildings-module.h"
+#include "ns3/core-module.h"
+#include "ns3/mobility-module.h"
+#include "ns3/network-module.h"
+#include "ns3/wifi-module.h"
+#include "ns3/yans-wifi-helper.h"
+
+#include "./kaka/gridculling.hpp"
+#include "./kaka/shadowingmap.hpp"
+#include "./kaka/weatheredfriis.hpp"
+
+#include <chrono>
+#include <iostream>
+#include <sstream>
+
+using namespace ns3;
+
+static void
+Broadcast(Ptr<NetDevice> device, uint32_t size, Time interval)
+{
+    device->Send(Create<Packet>(size), device->GetBroadcast(), 0x0800);
+    Simulator::Schedule(interval, &Broadcast, device, size, interval);
+}
+
+// returns the wall time of the run, and prints its csv line with the speedup over baselineSeconds
+static double
+RunOnce(uint32_t nNodes, bool culling, const std::string& inner, double spacing, double cullRange, double txp,
+        double duration, double baselineSeconds)
+{
+    NodeContainer nodes;
+    nodes.Create(nNodes);
+
+    double side = spacing * std::sqrt(static_cast<double>(nNodes));
+    MobilityHelper mobility;
+    std::ostringstream coordinate;
+    coordinate << "ns3::UniformRandomVariable[Min=0.0|Max=" << side << "]";
+    mobility.SetPositionAllocator("ns3::RandomRectanglePositionAllocator",
+                                  "X", StringValue(coordinate.str()),
+                                  "Y", StringValue(coordinate.str()));
+    mobility.SetMobilityModel("ns3::ConstantPositionMobilityModel");
+    mobility.Install(nodes);
+
+    YansWifiChannelHelper channelHelper;
+    channelHelper.SetPropagationDelay("ns3::ConstantSpeedPropagationDelayModel");
+    if (inner == "hybrid")
+    {
+        channelHelper.AddPropagationLoss("ns3::CorrelatedHybridBuildingsPropagationLossModel",
+                                         "CitySize", StringValue("Small"),
+                                         "Environment", StringValue("Urban"));
+        BuildingsHelper::Install(nodes);
+    }
+    else
+    {
+        channelHelper.AddPropagationLoss("ns3::WeatheredFriisPropagationLossModel");
+    }
+    Ptr<YansWifiChannel> channel = channelHelper.Create();
+
+    PointerValue innerModel;
+    channel->GetAttribute("PropagationLossModel", innerModel);
+    Ptr<GridCullingPropagationLossModel> grid;
+    if (culling)
+    {
+        // static nodes never leave their cell
+        grid = CreateObject<GridCullingPropagationLossModel>();
+        grid->SetAttribute("MaxRange", DoubleValue(cullRange));
+        grid->SetAttribute("MaxSpeed", DoubleValue(0.0));
+        grid->InstallOn(channel);
+        grid->AddNodes(nodes);
+    }
+
+    YansWifiPhyHelper phy;
+    phy.SetChannel(channel);
+    phy.Set("TxPowerStart", DoubleValue(txp));
+    phy.Set("TxPowerEnd", DoubleValue(txp));
+    WifiHelper wifi;
+    wifi.SetStandard(WIFI_STANDARD_80211b);
+    wifi.SetRemoteStationManager("ns3::ConstantRateWifiManager",
+                                 "DataMode", StringValue("DsssRate11Mbps"),
+                                 "ControlMode", StringValue("DsssRate11Mbps"));
+    WifiMacHelper mac;
+    mac.SetType("ns3::AdhocWifiMac");
+    NetDeviceContainer devices = wifi.Install(phy, mac, nodes);
+
+    Time interval = Seconds(1.0);
+    Ptr<UniformRandomVariable> offset = CreateObject<UniformRandomVariable>();
+    for (uint32_t i = 0; i < devices.GetN(); i++)
+    {
+        Simulator::Schedule(Seconds(offset->GetValue(0.0, interval.GetSeconds())), &Broadcast, devices.Get(i),
+                            100, interval);
+    }
+
+    Simulator::Stop(Seconds(duration));
+    auto start = std::chrono::steady_clock::now();
+    Simulator::Run();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    uint64_t events = Simulator::GetEventCount();
+
+    uint64_t evaluated = 0;
+    uint64_t culled = 0;
+    if (grid)
+    {
+        evaluated = grid->GetPassed();
+        culled = grid->GetCulled();
+    }
+    else if (Ptr<WeatheredFriisPropagationLossModel> friis =
+                 DynamicCast<WeatheredFriisPropagationLossModel>(innerModel.Get<PropagationLossModel>()))
+    {
+        evaluated = friis->GetEvaluations();
+    }
+    double speedup = baselineSeconds > 0 ? baselineSeconds / elapsed.count() : 1.0;
+    std::cout << nNodes << "," << (culling ? "grid" : "none") << "," << elapsed.count() << "," << events << ","
+              << events / elapsed.count() << "," << evaluated << "," << culled << "," << speedup << "\n";
+    Simulator::Destroy();
+    return elapsed.count();
+}
+
+int
+main(int argc, char* argv[])
+{
+    std::string nodeCounts{"100,200,400,800,1600"};
+    std::string inner{"friis"};
+    double spacing = 200;
+    double cullRange = 0;
+    double txp = 7.5;
+    double duration = 10;
+
+    CommandLine cmd(__FILE__);
+    cmd.AddValue("nodes", "Comma separated node counts", nodeCounts);
+    cmd.AddValue("inner", "Loss model behind the grid, friis or hybrid", inner);
+    cmd.AddValue("spacing", "Mean distance between neighbouring nodes (m)", spacing);
+    cmd.AddValue("cullRange", "Culling range (m), 0 to solve it from the friis model", cullRange);
+    cmd.AddValue("txp", "Tx power (dBm)", txp);
+    cmd.AddValue("duration", "Simulated seconds per run", duration);
+    cmd.Parse(argc, argv);
+
+    NS_ABORT_MSG_IF(inner != "friis" && inner != "hybrid", "unknown inner model " << inner);
+    NS_ABORT_MSG_IF(inner == "hybrid" && cullRange <= 0, "--inner=hybrid needs a --cullRange");
+
+    std::cout << "nodes,culling,seconds,events,events_per_second,evaluated,culled,speedup\n";
+    std::istringstream counts(nodeCounts);
+    std::string count;
+    while (std::getline(counts, count, ','))
+    {
+        uint32_t nNodes = std::stoul(count);
+        double baselineSeconds = RunOnce(nNodes, false, inner, spacing, cullRange, txp, duration, 0.0);
+        RunOnce(nNodes, true, inner, spacing, cullRange, txp, duration, baselineSeconds);
+    }
+    return 0;
+}
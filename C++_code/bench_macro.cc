@@ -0,0 +1,165 @@
+/*
+ *  Macrobenchmarks: runs the final_* scenarios as they are, with fixed seeds, and reports for each run the
+ *  wall time, cpu time, peak resident memory, simulated events and events per second.
+ *
+ *  The scenarios must have been built (e.g. by running them once). To run, write:
+ *
+ *  "./ns3 run "scratch/bench_macro --runs=3 --format=json --output=macro.json""
+ *
+ *  --programs picks the scenarios (final_rain, final_tunnel, final_mobility, final_sanet and final_vanet by
+ *  default). Each scenario runs from the current directory, as ./ns3 run would run it, with --RngSeed=1
+ *  --RngRun=1 and its output silenced; final_sanet and final_vanet also skip their packet trace. The event
+ *  count comes from Profiler::WriteRunStats in the scenario.
+ */
+
+#include "ns3/core-module.h"
+
+#include "./kaka/benchreport.hpp"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace ns3;
+
+struct MacroRun
+{
+    int status{-1};
+    double wallSeconds{0};
+    double userSeconds{0};
+    double systemSeconds{0};
+    long maxRssKb{0};
+    uint64_t events{0};
+    double simulatedSeconds{0};
+};
+
+static MacroRun
+RunScenario(const std::string& binary, const std::vector<std::string>& args, const std::string& statsFile)
+{
+    std::remove(statsFile.c_str());
+    MacroRun run;
+    auto start = std::chrono::steady_clock::now();
+    pid_t pid = fork();
+    NS_ABORT_MSG_IF(pid < 0, "fork failed");
+    if (pid == 0)
+    {
+        setenv("KAKA_RUN_STATS", statsFile.c_str(), 1);
+        int null = ::open("/dev/null", O_WRONLY);
+        if (null >= 0)
+        {
+            dup2(null, STDOUT_FILENO);
+            dup2(null, STDERR_FILENO);
+            ::close(null);
+        }
+        std::vector<char*> argv;
+        argv.push_back(const_cast<char*>(binary.c_str()));
+        for (const std::string& arg: args)
+        {
+            argv.push_back(const_cast<char*>(arg.c_str()));
+        }
+        argv.push_back(nullptr);
+        execv(binary.c_str(), argv.data());
+        _exit(127);
+    }
+    // wait4 gives the rusage of this child alone
+    int status;
+    struct rusage usage;
+    NS_ABORT_MSG_IF(wait4(pid, &status, 0, &usage) != pid, "wait4 failed: " << std::strerror(errno));
+    run.wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    run.status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    run.userSeconds = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec * 1e-6;
+    run.systemSeconds = usage.ru_stime.tv_sec + usage.ru_stime.tv_usec * 1e-6;
+    run.maxRssKb = usage.ru_maxrss;
+
+    // one line per simulation the scenario ran
+    std::ifstream stats(statsFile);
+    uint64_t events;
+    double simulated;
+    while (stats >> events >> simulated)
+    {
+        run.events += events;
+        run.simulatedSeconds += simulated;
+    }
+    std::remove(statsFile.c_str());
+    return run;
+}
+
+int
+main(int argc, char* argv[])
+{
+    std::string programs{"final_rain,final_tunnel,final_mobility,final_sanet,final_vanet"};
+    std::string buildDir{"./build/scratch"};
+    std::string binaryPrefix{"ns3.39-"};
+    std::string binarySuffix{"-default"};
+    std::string format{"csv"};
+    std::string output;
+    uint32_t runs = 3;
+
+    CommandLine cmd(__FILE__);
+    cmd.AddValue("programs", "Comma separated scenarios to run", programs);
+    cmd.AddValue("buildDir", "Directory of the built scenarios", buildDir);
+    cmd.AddValue("binaryPrefix", "Prefix of the built scenario binaries", binaryPrefix);
+    cmd.AddValue("binarySuffix", "Suffix of the built scenario binaries (the build profile)", binarySuffix);
+    cmd.AddValue("runs", "Runs of each scenario", runs);
+    cmd.AddValue("format", "Report format, csv or json", format);
+    cmd.AddValue("output", "Report file; stdout when empty", output);
+    cmd.Parse(argc, argv);
+
+    BenchReport report({"program",
+                        "run",
+                        "exit_status",
+                        "wall_seconds",
+                        "user_seconds",
+                        "system_seconds",
+                        "max_rss_kb",
+                        "events",
+                        "simulated_seconds",
+                        "events_per_second"});
+    std::string statsFile = "bench_macro." + std::to_string(getpid()) + ".stats";
+    std::istringstream list(programs);
+    for (std::string program; std::getline(list, program, ',');)
+    {
+        std::string binary = buildDir + "/" + binaryPrefix + program + binarySuffix;
+        if (access(binary.c_str(), X_OK) != 0)
+        {
+            std::cerr << "skipping " << program << ": " << binary << " is not built\n";
+            continue;
+        }
+        std::vector<std::string> args{"--RngSeed=1", "--RngRun=1"};
+        if (program == "final_sanet" || program == "final_vanet")
+        {
+            args.push_back("--packetTrace=");
+        }
+        for (uint32_t k = 0; k < runs; k++)
+        {
+            MacroRun run = RunScenario(binary, args, statsFile);
+            if (run.status != 0)
+            {
+                std::cerr << program << " run " << k << " exited with " << run.status << "\n";
+            }
+            report.AddRow({program,
+                           BenchReport::Field(k),
+                           BenchReport::Field(run.status),
+                           BenchReport::Field(run.wallSeconds),
+                           BenchReport::Field(run.userSeconds),
+                           BenchReport::Field(run.systemSeconds),
+                           BenchReport::Field(run.maxRssKb),
+                           BenchReport::Field(run.events),
+                           BenchReport::Field(run.simulatedSeconds),
+                           BenchReport::Field(run.events / run.wallSeconds)});
+        }
+    }
+    NS_ABORT_MSG_IF(!report.Write(output, format), "could not write " << output);
+    return 0;
+}
@@ -0,0 +1,235 @@
+/*
+ *  Microbenchmarks of the hot paths under the scenarios:
+ *
+ *  - friis: WeatheredFriisPropagationLossModel::CalcRxPower per weather value, exact and fast path
+ *  - traceload: cardiff.tcl through Ns2MobilityHelper, its compilation with Ns2BinaryTraceCompiler and
+ *    the lazy install of the compiled trace
+ *  - metrics: what RoutingExperiment does per received packet (the window accumulator and histogram)
+ *    and per window (CheckThroughput: percentiles, the per flow rows and the background writer)
+ *
+ *  To run, write:
+ *
+ *  "./ns3 run "scratch/bench_micro --format=json --output=micro.json""
+ *
+ *  --only=friis,metrics picks benchmarks. Each row gives the benchmark, its case, the operations timed and
+ *  the best ns per operation over --repeats repetitions, so two builds can be compared row by row.
+ */
+
+#include "ns3/core-module.h"
+#include "ns3/mobility-module.h"
+#include "ns3/network-module.h"
+#include "ns3/ns2-mobility-helper.h"
+
+#include "./kaka/benchreport.hpp"
+#include "./kaka/metrics.hpp"
+#include "./kaka/ns2binarytrace.hpp"
+#include "./kaka/weatheredfriis.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <sstream>
+#include <vector>
+
+using namespace ns3;
+
+static volatile double g_sink;
+
+// best of repeats, in ns per operation; run(operations) does the operations
+template <typename Run>
+static double
+BestNsPerOperation(uint32_t repeats, uint64_t operations, Run run)
+{
+    double best = std::numeric_limits<double>::infinity();
+    for (uint32_t i = 0; i < repeats; i++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        run(operations);
+        std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+        best = std::min(best, elapsed.count() / operations);
+    }
+    return best;
+}
+
+static void
+BenchFriis(BenchReport& report, uint32_t repeats, uint64_t calls)
+{
+    // receivers 10 m to 1 km away, cycled through so no call repeats the one before
+    Ptr<ConstantPositionMobilityModel> a = CreateObject<ConstantPositionMobilityModel>();
+    a->SetPosition(Vector(0, 0, 0));
+    std::vector<Ptr<MobilityModel>> receivers;
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        Ptr<ConstantPositionMobilityModel> b = CreateObject<ConstantPositionMobilityModel>();
+        b->SetPosition(Vector(10 + i * 3.9, (i % 7) * 2.0, 0));
+        receivers.push_back(b);
+    }
+
+    for (bool fastPath: {false, true})
+    {
+        for (int weather = 0; weather < 3; weather++)
+        {
+            Ptr<WeatheredFriisPropagationLossModel> friis = CreateObject<WeatheredFriisPropagationLossModel>();
+            friis->SetFastPath(fastPath);
+            friis->SetWeather(weather);
+            double ns = BestNsPerOperation(repeats, calls, [&](uint64_t n) {
+                double sum = 0;
+                for (uint64_t i = 0; i < n; i++)
+                {
+                    sum += friis->CalcRxPower(16.0, a, receivers[i & 255]);
+                }
+                g_sink = sum;
+            });
+            std::string name = std::string(fastPath ? "fast" : "exact") + " weather=" + std::to_string(weather);
+            report.AddRow({"friis", name, BenchReport::Field(calls), BenchReport::Field(ns)});
+        }
+    }
+    Simulator::Destroy();
+}
+
+static void
+BenchTraceLoad(BenchReport& report, uint32_t repeats, const std::string& tclFile)
+{
+    Ns2BinaryTraceCompiler compiler;
+    if (!compiler.Parse(tclFile))
+    {
+        std::cerr << "skipping traceload: could not read " << tclFile << "\n";
+        return;
+    }
+    uint32_t nNodes = compiler.GetNNodes();
+    std::string binFile = "bench_micro.wpt";
+    NS_ABORT_MSG_IF(!compiler.Write(binFile), "could not write " << binFile);
+
+    // one operation per whole load
+    double tcl = BestNsPerOperation(repeats, 1, [&](uint64_t) {
+        NodeContainer nodes;
+        nodes.Create(nNodes);
+        Ns2MobilityHelper ns2 = Ns2MobilityHelper(tclFile);
+        ns2.Install();
+        Simulator::Destroy();
+    });
+    double compile = BestNsPerOperation(repeats, 1, [&](uint64_t) {
+        Ns2BinaryTraceCompiler again;
+        again.Parse(tclFile);
+    });
+    double lazy = BestNsPerOperation(repeats, 1, [&](uint64_t) {
+        NodeContainer nodes;
+        nodes.Create(nNodes);
+        Ns2BinaryTraceHelper binaryTrace{binFile};
+        binaryTrace.InstallLazy();
+        Simulator::Destroy();
+    });
+    std::remove(binFile.c_str());
+    std::string nodes = " nodes=" + std::to_string(nNodes);
+    report.AddRow({"traceload", "tcl install" + nodes, "1", BenchReport::Field(tcl)});
+    report.AddRow({"traceload", "compile" + nodes, "1", BenchReport::Field(compile)});
+    report.AddRow({"traceload", "binary lazy install" + nodes, "1", BenchReport::Field(lazy)});
+}
+
+static void
+BenchMetrics(BenchReport& report, uint32_t repeats, uint64_t packets)
+{
+    // delays around 5 ms with a long tail, like the scenarios'
+    std::mt19937_64 generator{1};
+    std::lognormal_distribution<double> delay{std::log(0.005), 1.0};
+    std::vector<double> delays(4096);
+    for (double& d: delays)
+    {
+        d = delay(generator);
+    }
+
+    OnlineAccumulator accumulator;
+    double ns = BestNsPerOperation(repeats, packets, [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; i++)
+        {
+            accumulator.Add(delays[i & 4095]);
+        }
+        g_sink = accumulator.GetMean();
+    });
+    report.AddRow({"metrics", "accumulator add", BenchReport::Field(packets), BenchReport::Field(ns)});
+
+    LatencyHistogram histogram;
+    ns = BestNsPerOperation(repeats, packets, [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; i++)
+        {
+            histogram.Record(delays[i & 4095]);
+        }
+        g_sink = histogram.GetCount();
+    });
+    report.AddRow({"metrics", "histogram record", BenchReport::Field(packets), BenchReport::Field(ns)});
+
+    // one CheckThroughput: WindowedDelays::CloseWindow, as the scenarios call it
+    for (uint32_t nFlows: {10u, 100u, 1000u})
+    {
+        MetricsWriter metrics;
+        MetricsWriter flowMetrics;
+        metrics.Open("/dev/null", {"a", "b", "c", "d", "e", "f", "g", "h", "i", "j", "k", "l"});
+        flowMetrics.Open("/dev/null", {"a", "b", "c", "d", "e", "f", "g", "h", "i"});
+        WindowedDelays windows;
+        std::vector<WindowedDelays::Flow*> flows;
+        for (uint32_t f = 0; f < nFlows; f++)
+        {
+            flows.push_back(&windows.GetFlow(f, nFlows + f));
+        }
+        uint64_t nWindows = std::max<uint64_t>(1, 20000 / nFlows);
+        ns = BestNsPerOperation(repeats, nWindows, [&](uint64_t n) {
+            for (uint64_t w = 0; w < n; w++)
+            {
+                // a few packets per flow, so the percentiles have something to find
+                for (uint32_t f = 0; f < nFlows; f++)
+                {
+                    windows.Record(*flows[f], delays[(w + f) & 4095]);
+                }
+                windows.CloseWindow(w + 1.0, 1.0, 8.0, nFlows, nFlows, metrics, flowMetrics);
+            }
+        });
+        metrics.Close();
+        flowMetrics.Close();
+        report.AddRow({"metrics",
+                       "window close flows=" + std::to_string(nFlows),
+                       BenchReport::Field(nWindows),
+                       BenchReport::Field(ns)});
+    }
+}
+
+int
+main(int argc, char* argv[])
+{
+    std::string only;
+    std::string tclFile{"./scratch/cardiff.tcl"};
+    std::string format{"csv"};
+    std::string output;
+    uint32_t repeats = 5;
+    uint64_t calls = 1000000;
+
+    CommandLine cmd(__FILE__);
+    cmd.AddValue("only", "Comma separated benchmarks to run (friis, traceload, metrics); all when empty", only);
+    cmd.AddValue("tcl", "ns-2 mobility trace for the traceload benchmark", tclFile);
+    cmd.AddValue("format", "Report format, csv or json", format);
+    cmd.AddValue("output", "Report file; stdout when empty", output);
+    cmd.AddValue("repeats", "Repetitions of each benchmark, the best is reported", repeats);
+    cmd.AddValue("calls", "Operations per repetition of the per call benchmarks", calls);
+    cmd.Parse(argc, argv);
+
+    auto selected = [&only](const std::string& name) {
+        return only.empty() || ("," + only + ",").find("," + name + ",") != std::string::npos;
+    };
+    BenchReport report({"benchmark", "case", "operations", "ns_per_operation"});
+    if (selected("friis"))
+    {
+        BenchFriis(report, repeats, calls);
+    }
+    if (selected("traceload"))
+    {
+        BenchTraceLoad(report, repeats, tclFile);
+    }
+    if (selected("metrics"))
+    {
+        BenchMetrics(report, repeats, calls);
+    }
+    NS_ABORT_MSG_IF(!report.Write(output, format), "could not write " << output);
+    return 0;
+}
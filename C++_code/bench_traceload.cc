@@ -0,0 +1,100 @@
+/*
+ *  Startup benchmark: installing the cardiff mobility with Ns2MobilityHelper against the compiled
+ *  binary trace from compile_trace, both copied into waypoint models and read lazily.
+ *
+ *  To run, write:
+ *
+ *  "./ns3 run "scratch/bench_traceload --runs=10""
+ *
+ *  Prints one csv line per run (method, run, seconds) followed by the mean of each method.
+ */
+
+#include "ns3/core-module.h"
+#include "ns3/mobility-module.h"
+#include "ns3/network-module.h"
+#include "ns3/ns2-mobility-helper.h"
+
+#include "./kaka/ns2binarytrace.hpp"
+
+#include <chrono>
+#include <iostream>
+
+using namespace ns3;
+
+static double
+TimeTclInstall(const std::string& tclFile, uint32_t nNodes)
+{
+    NodeContainer nodes;
+    nodes.Create(nNodes);
+    auto start = std::chrono::steady_clock::now();
+    Ns2MobilityHelper ns2 = Ns2MobilityHelper(tclFile);
+    ns2.Install();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    Simulator::Destroy();
+    return elapsed.count();
+}
+
+static double
+TimeBinaryInstall(const std::string& binFile, uint32_t nNodes, bool lazy)
+{
+    NodeContainer nodes;
+    nodes.Create(nNodes);
+    auto start = std::chrono::steady_clock::now();
+    Ns2BinaryTraceHelper binaryTrace{binFile};
+    if (lazy)
+    {
+        binaryTrace.InstallLazy();
+    }
+    else
+    {
+        binaryTrace.Install();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    Simulator::Destroy();
+    return elapsed.count();
+}
+
+int
+main(int argc, char* argv[])
+{
+    std::string tclFile{"./scratch/cardiff.tcl"};
+    std::string binFile{"./scratch/cardiff.wpt"};
+    uint32_t runs = 5;
+
+    CommandLine cmd(__FILE__);
+    cmd.AddValue("tcl", "ns-2 mobility trace", tclFile);
+    cmd.AddValue("bin", "The same trace compiled with compile_trace", binFile);
+    cmd.AddValue("runs", "Number of timed installs per method", runs);
+    cmd.Parse(argc, argv);
+
+    uint32_t nNodes;
+    {
+        Ptr<Ns2BinaryTrace> trace = CreateObject<Ns2BinaryTrace>();
+        if (!trace->Load(binFile))
+        {
+            NS_FATAL_ERROR("could not load " << binFile << ", run compile_trace first");
+        }
+        nNodes = trace->GetNNodes();
+    }
+
+    double tclTotal = 0;
+    double binTotal = 0;
+    double lazyTotal = 0;
+    std::cout << "method,run,seconds\n";
+    for (uint32_t run = 0; run < runs; run++)
+    {
+        double tcl = TimeTclInstall(tclFile, nNodes);
+        double bin = TimeBinaryInstall(binFile, nNodes, false);
+        double lazy = TimeBinaryInstall(binFile, nNodes, true);
+        tclTotal += tcl;
+        binTotal += bin;
+        lazyTotal += lazy;
+        std::cout << "tcl," << run << "," << tcl << "\n";
+        std::cout << "binary," << run << "," << bin << "\n";
+        std::cout << "lazy," << run << "," << lazy << "\n";
+    }
+    std::cout << "# " << nNodes << " nodes, mean tcl " << tclTotal / runs << " s, mean binary "
+              << binTotal / runs << " s (" << tclTotal / binTotal << "x), mean lazy " << lazyTotal / runs
+              << " s (" << tclTotal / lazyTotal << "x)\n";
+    return 0;
+}
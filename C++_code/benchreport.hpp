@@ -0,0 +1,153 @@
+#ifndef BENCHREPORT_HPP
+#define BENCHREPORT_HPP
+
+#include "ns3/abort.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace ns3;
+
+// Results of a benchmark program as rows of named fields, written as csv or as a json array of objects
+// (numbers unquoted), so that the results of two builds can be compared by a script.
+class BenchReport{
+  public:
+    explicit BenchReport(std::vector<std::string> columns);
+
+    // one field per column
+    void AddRow(const std::vector<std::string>& fields);
+    // format is "csv" or "json"; an empty filename writes to stdout
+    bool Write(const std::string& filename, const std::string& format) const;
+
+    template <typename T>
+    static std::string Field(const T& value);
+
+  private:
+    void WriteCsv(std::ostream& os) const;
+    void WriteJson(std::ostream& os) const;
+
+    std::vector<std::string> m_columns;
+    std::vector<std::vector<std::string>> m_rows;
+};
+
+// ===================================================================== //
+
+BenchReport::BenchReport(std::vector<std::string> columns)
+    : m_columns(std::move(columns))
+{
+}
+
+void
+BenchReport::AddRow(const std::vector<std::string>& fields)
+{
+    NS_ABORT_MSG_IF(fields.size() != m_columns.size(), "a benchmark row needs one field per column");
+    m_rows.push_back(fields);
+}
+
+template <typename T>
+std::string
+BenchReport::Field(const T& value)
+{
+    std::ostringstream field;
+    field.precision(9);
+    field << value;
+    return field.str();
+}
+
+bool
+BenchReport::Write(const std::string& filename, const std::string& format) const
+{
+    NS_ABORT_MSG_IF(format != "csv" && format != "json", "unknown report format " << format);
+    std::ofstream file;
+    if (!filename.empty())
+    {
+        file.open(filename);
+        if (!file)
+        {
+            return false;
+        }
+    }
+    std::ostream& os = filename.empty() ? std::cout : file;
+    if (format == "csv")
+    {
+        WriteCsv(os);
+    }
+    else
+    {
+        WriteJson(os);
+    }
+    return static_cast<bool>(os);
+}
+
+void
+BenchReport::WriteCsv(std::ostream& os) const
+{
+    for (std::size_t i = 0; i < m_columns.size(); i++)
+    {
+        os << (i ? "," : "") << m_columns[i];
+    }
+    os << "\n";
+    for (const auto& row: m_rows)
+    {
+        for (std::size_t i = 0; i < row.size(); i++)
+        {
+            os << (i ? "," : "") << row[i];
+        }
+        os << "\n";
+    }
+}
+
+void
+BenchReport::WriteJson(std::ostream& os) const
+{
+    // 0 text, 1 number, 2 nan or inf (null)
+    auto kind = [](const std::string& field) {
+        char* end;
+        double value = std::strtod(field.c_str(), &end);
+        if (field.empty() || *end != '\0')
+        {
+            return 0;
+        }
+        return std::isfinite(value) ? 1 : 2;
+    };
+    os << "[\n";
+    for (std::size_t r = 0; r < m_rows.size(); r++)
+    {
+        os << "  {";
+        for (std::size_t i = 0; i < m_columns.size(); i++)
+        {
+            const std::string& field = m_rows[r][i];
+            os << (i ? ", " : "") << "\"" << m_columns[i] << "\": ";
+            if (kind(field) == 1)
+            {
+                os << field;
+            }
+            else if (kind(field) == 2)
+            {
+                os << "null";
+            }
+            else
+            {
+                os << "\"";
+                for (char c: field)
+                {
+                    if (c == '"' || c == '\\')
+                    {
+                        os << '\\';
+                    }
+                    os << c;
+                }
+                os << "\"";
+            }
+        }
+        os << "}" << (r + 1 < m_rows.size() ? "," : "") << "\n";
+    }
+    os << "]\n";
+}
+
+#endif
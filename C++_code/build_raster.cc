@@ -0,0 +1,147 @@
+/*
+ *  Precomputes the path loss between every pair of cells of a grid over the Cardiff map into a raster file,
+ *  which final_vanet then maps with --pathLossRaster and reads instead of evaluating the building models on
+ *  every frame. The loss is that of final_vanet's channel without its shadowing: the hybrid buildings model
+ *  and, with --buildings, the walls of the footprints crossed, with the same options as final_vanet.
+ *
+ *  To run, write:
+ *
+ *  "./ns3 run "scratch/build_raster --buildings=./scratch/osm.poly.xml.gz --buildingsNet=./scratch/new.net.xml
+ *   --output=./scratch/cardiff.plr""
+ *
+ *  The default area covers cardiff.tcl with 10 m cells (about 18 MB). Afterwards --validate links at random
+ *  positions are evaluated both ways and the error of the raster is printed.
+ */
+
+#include "ns3/buildings-module.h"
+#include "ns3/core-module.h"
+#include "ns3/mobility-module.h"
+#include "ns3/network-module.h"
+
+#include "./kaka/osmbuildings.hpp"
+#include "./kaka/pathlossraster.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+
+using namespace ns3;
+
+int
+main(int argc, char* argv[])
+{
+    double minX = -10.0;
+    double minY = -10.0;
+    double maxX = 430.0;
+    double maxY = 430.0;
+    double cellSize = 10.0;
+    double height = 1.0;
+    double frequency = 2.106e9;
+    std::string buildingsFile;
+    std::string buildingsNetFile;
+    double wallLoss = 12.0;
+    bool buildingBoxes = false;
+    uint32_t validate = 1000;
+    std::string output{"./scratch/cardiff.plr"};
+
+    CommandLine cmd(__FILE__);
+    cmd.AddValue("minX", "West edge of the area (m)", minX);
+    cmd.AddValue("minY", "South edge of the area (m)", minY);
+    cmd.AddValue("maxX", "East edge of the area (m)", maxX);
+    cmd.AddValue("maxY", "North edge of the area (m)", maxY);
+    cmd.AddValue("cellSize", "Side of a cell (m)", cellSize);
+    cmd.AddValue("height", "Height of both ends of every link (m), cardiff.tcl puts vehicles at 1 m", height);
+    cmd.AddValue("frequency", "Carrier frequency (Hz), by default that of the hybrid model in final_vanet", frequency);
+    cmd.AddValue("buildings", "Sumo polygon file whose building footprints attenuate the links", buildingsFile);
+    cmd.AddValue("buildingsNet", "Net the mobility trace was made on, to align the footprints with", buildingsNetFile);
+    cmd.AddValue("wallLoss", "Loss (dB) of each footprint wall a link crosses", wallLoss);
+    cmd.AddValue("buildingBoxes", "Footprints as bounding box buildings of the hybrid model, not walls", buildingBoxes);
+    cmd.AddValue("validate", "Random links to check the raster against the models on", validate);
+    cmd.AddValue("output", "Raster file to write", output);
+    cmd.Parse(argc, argv);
+
+    // the channel of final_vanet, less its shadowing
+    Ptr<HybridBuildingsPropagationLossModel> hybrid = CreateObject<HybridBuildingsPropagationLossModel>();
+    hybrid->SetAttribute("CitySize", StringValue("Small"));
+    hybrid->SetAttribute("InternalWallLoss", DoubleValue(10.0));
+    hybrid->SetAttribute("Environment", StringValue("Urban"));
+    hybrid->SetAttribute("Frequency", DoubleValue(frequency));
+    Ptr<BuildingWallsPropagationLossModel> walls;
+    if (!buildingsFile.empty())
+    {
+        Ptr<OsmBuildings> buildings = CreateObject<OsmBuildings>();
+        NS_ABORT_MSG_IF(!buildings->Load(buildingsFile, buildingsNetFile), "could not load " << buildingsFile);
+        if (buildingBoxes)
+        {
+            buildings->CreateBuildings();
+        }
+        else
+        {
+            walls = CreateObject<BuildingWallsPropagationLossModel>();
+            walls->SetAttribute("Buildings", PointerValue(buildings));
+            walls->SetAttribute("WallLoss", DoubleValue(wallLoss));
+        }
+        std::cout << buildingsFile << ": " << buildings->GetN() << " buildings\n";
+    }
+
+    NodeContainer ends;
+    ends.Create(2);
+    MobilityHelper mobility;
+    mobility.SetMobilityModel("ns3::ConstantPositionMobilityModel");
+    mobility.Install(ends);
+    BuildingsHelper::Install(ends);
+    Ptr<MobilityModel> a = ends.Get(0)->GetObject<MobilityModel>();
+    Ptr<MobilityModel> b = ends.Get(1)->GetObject<MobilityModel>();
+    auto loss = [&](const Vector& pa, const Vector& pb) {
+        a->SetPosition(pa);
+        b->SetPosition(pb);
+        return hybrid->GetLoss(a, b) - (walls ? walls->CalcRxPower(0.0, a, b) : 0.0);
+    };
+
+    uint32_t lastPercent = 0;
+    bool written = PathLossRaster::Build(output, minX, minY, maxX, maxY, cellSize, height, frequency, loss,
+                                         [&lastPercent](uint32_t done, uint32_t total) {
+                                             uint32_t percent = 100ull * done / total;
+                                             if (percent >= lastPercent + 10)
+                                             {
+                                                 std::cerr << percent << "%\n";
+                                                 lastPercent = percent;
+                                             }
+                                         });
+    NS_ABORT_MSG_IF(!written, "could not write " << output);
+    Ptr<PathLossRaster> raster = CreateObject<PathLossRaster>();
+    NS_ABORT_MSG_IF(!raster->Load(output), "could not read back " << output);
+    const PathLossRasterHeader& header = raster->GetHeader();
+    std::cout << output << ": " << header.nX << " x " << header.nY << " cells of " << cellSize << " m\n";
+
+    if (validate > 0)
+    {
+        std::mt19937 generator{1};
+        std::uniform_real_distribution<double> x{minX, maxX};
+        std::uniform_real_distribution<double> y{minY, maxY};
+        std::vector<double> errors;
+        double sum = 0;
+        for (uint32_t i = 0; i < validate; i++)
+        {
+            Vector pa(x(generator), y(generator), height);
+            Vector pb(x(generator), y(generator), height);
+            double error = raster->GetLoss(pa, pb) - loss(pa, pb);
+            sum += error;
+            errors.push_back(std::abs(error));
+        }
+        std::sort(errors.begin(), errors.end());
+        double absSum = 0;
+        for (double error: errors)
+        {
+            absSum += error;
+        }
+        std::cout << validate << " random links, raster minus models (dB): mean " << sum / validate
+                  << ", mean absolute " << absSum / validate << ", p95 absolute "
+                  << errors[static_cast<std::size_t>(0.95 * (errors.size() - 1))] << ", max absolute "
+                  << errors.back() << "\n";
+    }
+    Simulator::Destroy();
+    return 0;
+}
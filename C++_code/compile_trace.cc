@@ -0,0 +1,46 @@
+/*
+ *  Compiles an ns-2 mobility trace (such as cardiff.tcl) into the binary waypoint file read by
+ *  Ns2BinaryTraceHelper. This only needs to be done once per trace, afterwards the simulations map
+ *  the binary file instead of parsing the Tcl text on every run.
+ *
+ *  To run, write:
+ *
+ *  "./ns3 run "scratch/compile_trace --input=./scratch/cardiff.tcl --output=./scratch/cardiff.wpt""
+ *
+ *  bucketWidth sets the spacing (in seconds) of the time index used to seek into the trace.
+ */
+
+#include "ns3/core-module.h"
+
+#include "./kaka/ns2binarytrace.hpp"
+
+#include <iostream>
+
+using namespace ns3;
+
+int
+main(int argc, char* argv[])
+{
+    std::string input{"./scratch/cardiff.tcl"};
+    std::string output{"./scratch/cardiff.wpt"};
+    double bucketWidth = 60.0;
+
+    CommandLine cmd(__FILE__);
+    cmd.AddValue("input", "ns-2 mobility trace to compile", input);
+    cmd.AddValue("output", "Binary waypoint file to write", output);
+    cmd.AddValue("bucketWidth", "Time index spacing in seconds", bucketWidth);
+    cmd.Parse(argc, argv);
+
+    Ns2BinaryTraceCompiler compiler{bucketWidth};
+    if (!compiler.Parse(input))
+    {
+        NS_FATAL_ERROR("could not read " << input);
+    }
+    if (!compiler.Write(output))
+    {
+        NS_FATAL_ERROR("could not write " << output);
+    }
+    std::cout << input << " -> " << output << ": " << compiler.GetNNodes() << " nodes, "
+              << compiler.GetNRecords() << " waypoints\n";
+    return 0;
+}
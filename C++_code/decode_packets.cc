@@ -0,0 +1,75 @@
+/*
+ *  Decodes the binary packet trace written by final_sanet and final_vanet back into the lines they
+ *  used to print for every received packet:
+ *
+ *  "<seconds> <node> received one packet from <ip>"
+ *
+ *  To run, write:
+ *
+ *  "./ns3 run "scratch/decode_packets --input=sanet.output.packets.bin" > packets.txt"
+ *
+ *  Add --flows=1 to append the size and flow id of each packet to its line.
+ */
+
+#include "ns3/core-module.h"
+#include "ns3/ipv4-address.h"
+
+#include "./kaka/packettrace.hpp"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+using namespace ns3;
+
+int
+main(int argc, char* argv[])
+{
+    std::string input{"sanet.output.packets.bin"};
+    bool flows = false;
+
+    CommandLine cmd(__FILE__);
+    cmd.AddValue("input", "Binary packet trace to decode", input);
+    cmd.AddValue("flows", "Append the packet size and flow id to each line", flows);
+    cmd.Parse(argc, argv);
+
+    std::ifstream file(input, std::ios::binary);
+    if (!file)
+    {
+        NS_FATAL_ERROR("could not open " << input);
+    }
+    PacketTraceHeader header;
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        std::memcmp(header.magic, PACKET_TRACE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != PACKET_TRACE_VERSION || header.recordSize != sizeof(PacketTraceRecord))
+    {
+        NS_FATAL_ERROR(input << " is not a version " << PACKET_TRACE_VERSION << " packet trace");
+    }
+
+    // same formatting as the NS_LOG_UNCOND lines it replaces
+    std::vector<PacketTraceRecord> block(16384);
+    while (file)
+    {
+        file.read(reinterpret_cast<char*>(block.data()), block.size() * sizeof(PacketTraceRecord));
+        std::size_t n = file.gcount() / sizeof(PacketTraceRecord);
+        for (std::size_t i = 0; i < n; i++)
+        {
+            const PacketTraceRecord& record = block[i];
+            std::cout << record.time << " " << record.node;
+            if (record.sender != 0)
+            {
+                std::cout << " received one packet from " << Ipv4Address(record.sender);
+            }
+            else
+            {
+                std::cout << " received one packet!";
+            }
+            if (flows)
+            {
+                std::cout << " " << record.size << " " << record.flow;
+            }
+            std::cout << "\n";
+        }
+    }
+    return 0;
+}
@@ -1,7 +1,7 @@
 /*  Code for the Mobility Experiment
  *  
- *  The network is using YansChannelWifi and we use schedule a call to PrintPositions every second in order to 
- *  log positional data out.
+ *  The network is using YansChannelWifi and a PositionSampler snapshots the position of every node every second
+ *  in order to log positional data out.
  *
  *  To run, invoke ns3 by running 
  *
@@ -22,11 +22,16 @@
  *  Another option is timeOption. Set 0 for 50 seconds and 1 for 1 hour. You invoke this setting as the previous cli
  *  flags.
  *
- *  The generated file is called mobility.txt. Feed this into visualise_mobility.py to generate 
- *  the desired graph
+ *  Add --profile=1 to time every event, with progress printed to stderr as it runs and a profile at the end.
+ *
+ *  The generated file is called mobility.pos, a binary file of position snapshots (see positionsampler.hpp). Feed
+ *  this into visualise_mobility.py to generate the desired graph. --sampleInterval sets the time between snapshots
+ *  and --sampleNodes=0,3,7 samples only those nodes:
+ *
+ *  "./ns3 run "scratch/mobiFinal --nWifi=1000 --sampleInterval=10 --sampleNodes=0,1,2""
  */
 
-#include "fstream"
+#include <sstream>
 // NS3 Includes
 #include "ns3/applications-module.h"
 #include "ns3/core-module.h"
@@ -42,26 +47,13 @@
 // My includes
 #include "helpers.hpp"
 #include "./kaka/weatheredfriis.hpp"
+#include "./kaka/positionsampler.hpp"
+#include "./kaka/profiler.hpp"
 
 using namespace ns3;
 
 NS_LOG_COMPONENT_DEFINE("Adhoc");
 
-std::ofstream ofst{"mobility.txt", std::ios::out | std::ios::trunc};
-
-// The function which allows us to get output of positions. Prints to std::cout and to ofst
-void PrintPositions ()
-{
-  for (uint32_t i=0; i < NodeList::GetNNodes(); i++ )
-  {
-    Ptr<MobilityModel> mob = NodeList::GetNode(i)->GetObject<MobilityModel>();
-    Vector pos = mob->GetPosition ();
-    std::cout << "Node " << i << " | POS: x=" << pos.x << ", y=" << pos.y << '\n';
-    ofst << i << ", " << pos.x << ", " << pos.y << "\n";
-  }
-  Simulator::Schedule(Seconds(1), MakeCallback(&PrintPositions));
-}
-
 int
 main(int argc, char* argv[])
 {
@@ -71,12 +63,24 @@ main(int argc, char* argv[])
     uint32_t nWifi = 10;
     int mobiOption = 0;
     int timeOption = 0;
+    bool profile = false;
+    std::string positionFile{"mobility.pos"};
+    double sampleInterval = 1.0;
+    std::string sampleNodes;
 
     CommandLine cmd(__FILE__);
     cmd.AddValue("nWifi", "Number of moving nodes", nWifi);
     cmd.AddValue("mobiOption", "set 0 for randomwalk, 1 for randomwaypoint", mobiOption);
     cmd.AddValue("timeOption", "set 0 for 50 seconds, 1 for 1 hour", timeOption);
+    cmd.AddValue("positionFile", "Binary file of position snapshots", positionFile);
+    cmd.AddValue("sampleInterval", "Time between position snapshots (s)", sampleInterval);
+    cmd.AddValue("sampleNodes", "Comma separated ids of the nodes to sample; every node when empty", sampleNodes);
+    cmd.AddValue("profile", "Time every event, print progress and a profile to stderr", profile);
     cmd.Parse(argc, argv);
+    if (profile)
+    {
+        Profiler::Enable();
+    }
 
     // ===================================================================== //
 
@@ -175,11 +179,24 @@ main(int argc, char* argv[])
 
     // ===================================================================== //
 
-    // you need to put Simulator::Schedule in front of Simulator::Run();
-    //Simulator::Schedule(Seconds(2), &Print, "oioi");
-    Simulator::Schedule(Seconds(0), &PrintPositions); 
+    // Position snapshots
+    NodeContainer sampled;
+    std::istringstream ids(sampleNodes);
+    for (std::string id; std::getline(ids, id, ',');)
+    {
+        uint32_t i = std::stoul(id);
+        NS_ABORT_MSG_IF(i >= nWifi, "no node " << i << " to sample");
+        sampled.Add(adhocNodes.Get(i));
+    }
+    PositionSampler positions;
+    NS_ABORT_MSG_IF(!positions.Open(positionFile, sampleNodes.empty() ? adhocNodes : sampled, Seconds(sampleInterval)),
+                    "could not open " << positionFile);
+    positions.Start();
+
     Simulator::Stop(Hours(1));
     Simulator::Run();
+    positions.Close();
+    Profiler::WriteRunStats();
     Simulator::Destroy();
     return 0;
 }
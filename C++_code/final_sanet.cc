@@ -5,6 +5,30 @@
 //
 // "./ns3 run scratch/final_sanet"
 //
+// Add --batchedLoss=1 to compute the rx powers of each frame in one vectorised pass, on the table driven fast path
+// of the loss model (build with -mavx2 to get the AVX2 kernel).
+//
+// Add --weatherField=./scratch/storms.txt to put localised rain and snow cells (see weatherfield.hpp for the
+// format) over the area, on top of the rain that starts at 200 s.
+//
+// Received packets are traced to sanet.output.packets.bin; decode_packets turns it into the "T node received one
+// packet from IP" lines. Building with -DKAKA_NO_PACKET_TRACE removes the tracing altogether.
+//
+// Add --sweepConfig=./scratch/sweep.txt to run every combination of the options listed in the file (see sweep.hpp
+// for the format), --sweepJobs at a time, with one row per run in <sweepOutputDir>/results.csv:
+//
+// "./ns3 run "scratch/final_sanet --sweepConfig=./scratch/sweep.txt --sweepJobs=8""
+//
+// Add --forkAt=90 to a sweep to simulate the routing and mobility warm up once and fork every point off it at 90 s,
+// before traffic starts; the points can then only change sinks, weather and window. The routing tables at the
+// fork were built at the warm up's power, so txp cannot be forked.
+//
+// Add --memoryInterval=100 to count what every node holds (objects by type, routing table rows, queued packets) and
+// the heap every 100 s into sanet.output.memory.csv, to see which of them grows with the nodes or over time.
+//
+// Add --profile=1 to time every event and trace sink: progress and the time left are printed to stderr every few
+// seconds, and a profile sorted by self time at the end.
+//
 // This will produce the file sanet.output.csv. Feed this file into the visualise_sanet.py in order to generate the
 // graph.
 
@@ -18,34 +42,40 @@
 #include "ns3/mobility-module.h"
 #include "ns3/network-module.h"
 #include "ns3/olsr-module.h"
+#include "ns3/wifi-net-device.h"
 #include "ns3/yans-wifi-helper.h"
 
 #include "./kaka/weatheredfriis.hpp"
-
+#include "./kaka/batchedfriis.hpp"
+#include "./kaka/weatherfield.hpp"
+#include "./kaka/latency.hpp"
+#include "./kaka/memaccount.hpp"
+#include "./kaka/metrics.hpp"
+#include "./kaka/packettrace.hpp"
+#include "./kaka/sweep.hpp"
+#include "./kaka/profiler.hpp"
+
+#include <cerrno>
 #include <fstream>
 #include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <thread>
 #include <vector>
 
+#include <sys/stat.h>
+
 using namespace ns3;
 using namespace dsr;
 
 NS_LOG_COMPONENT_DEFINE("manet-routing-compare");
 
+// every device shares the one channel, and so the one loss model
 static void
-SetRainning(NodeContainer& nc, uint32_t size, int8_t weatherval){
-  for(uint32_t i = 0; i < size; i++){
-    Ptr<Channel> ptr = nc.Get(i)->GetDevice(0)->GetChannel();
-    NS_ASSERT(ptr);
-    Ptr<YansWifiChannel> dyw = ptr->GetObject<YansWifiChannel>();
-    NS_ASSERT(dyw);
-    PointerValue ph;
-    dyw->GetAttribute("PropagationLossModel", ph);
-    Ptr<PropagationLossModel> base_prop = ph.Get<PropagationLossModel>();
-    NS_ASSERT(base_prop);
-    Ptr<WeatheredFriisPropagationLossModel> friis = base_prop->GetObject<WeatheredFriisPropagationLossModel>();
-    NS_ASSERT(friis);
-    friis->SetWeather(weatherval);
-  }
+SetRainning(Ptr<WeatheredFriisPropagationLossModel> friis, int8_t weatherval){
+  PROFILE_SCOPE("SetRainning");
+  friis->SetWeather(weatherval);
 }
 
 static uint32_t packetsSent{0};
@@ -57,11 +87,24 @@ class RoutingExperiment
     void Run();
 
     void CommandSetup(int argc, char** argv);
+    bool IsSweep() const;
+    // runs every point of m_sweepConfigFile; argv is the command line every run starts from
+    bool RunSweep(int argc, char** argv);
 
   private:
     Ptr<Socket> SetupPacketReceive(Ipv4Address addr, Ptr<Node> node);
     void ReceivePacket(Ptr<Socket> socket);
+    static void PacketSent(RoutingExperiment* experiment,
+                           uint64_t flow,
+                           Ptr<const Packet> packet,
+                           const Address& from,
+                           const Address& to,
+                           const SeqTsSizeHeader& header);
     void CheckThroughput();
+    void GetSummary(double* results) const;
+    void OpenOutputs();
+    void InstallTraffic(double totalTime);
+    void ForkVariants(double totalTime);
 
     uint32_t port{9};            //!< Receiving port number.
     uint32_t bytesTotal{0};      //!< Total received bytes.
@@ -71,48 +114,74 @@ class RoutingExperiment
     int m_nSinks{10};                                      //!< Number of sink nodes.
     std::string m_protocolName{"AODV"};                    //!< Protocol name.
     double m_txp{7.5};                                     //!< Tx power.
+    int m_weather{1};                                      //!< Weather from 200 s on.
+    double m_rainRate{25.0};                               //!< Rain rate while it rains (mm/h).
+    double m_snowRate{10.0};                               //!< Snowfall rate while it snows (mm/h of water).
+    bool m_profile{false};                                 //!< Profile the event loop.
     bool m_traceMobility{false};                           //!< Enable mobility tracing.
     bool m_flowMonitor{false};                             //!< Enable FlowMonitor.
-    std::vector<double> delays;
+    bool m_batchedLoss{false};                             //!< Evaluate each transmission in one batch.
+    std::string m_weatherFieldFile;                        //!< Weather cells to load, if set.
+    Ptr<WeatherField> m_weatherField;                      //!< m_weatherFieldFile, once loaded.
+    double m_windowLength{1.0};                            //!< Length of a metrics window (s).
+    WindowedDelays m_delays;                               //!< End to end delays, by window and flow.
+    MetricsWriter m_metrics;                               //!< Writes the closed windows to m_CSVfileName.
+    std::map<uint32_t, uint32_t> m_nodeOfAddress;          //!< Node id of each interface address.
+    MetricsWriter m_flowMetrics;                           //!< Writes the per flow windows.
+    InFlightTable m_inFlight;                              //!< Send times of the packets in flight.
+    std::string m_packetTraceFile{"sanet.output.packets.bin"}; //!< Binary trace of received packets, if set.
+    PacketTraceWriter m_packetTrace;                       //!< Writes m_packetTraceFile.
+
+    uint64_t m_runSent{0};                                 //!< Packets sent over the run.
+    uint64_t m_runReceived{0};                             //!< Packets received over the run.
+    double m_memoryInterval{0};                            //!< Memory sampling interval (s), 0 for none.
+    MemoryAccount m_memory;                                //!< Samples the memory held per node.
+
+    std::string m_sweepConfigFile;                         //!< Parameter grid to sweep, if set.
+    uint32_t m_sweepJobs{std::max(1u, std::thread::hardware_concurrency())}; //!< Sweep runs at once.
+    std::string m_sweepOutputDir{"sweep"};                 //!< Directory of the sweep's files.
+    double m_forkAt{0};                                    //!< Warm start: time the sweep forks at, 0 for none.
+    std::unique_ptr<SweepRunner> m_variants;               //!< Warm start: the points to fork.
+    std::size_t m_variant{SweepRunner::NO_POINT};          //!< Warm start: the point this process runs.
+
+    NodeContainer m_adhocNodes;                            //!< Every ship.
+    Ipv4InterfaceContainer m_adhocInterfaces;              //!< Their addresses.
+    Ptr<WeatheredFriisPropagationLossModel> m_friis;       //!< Loss model of the shared channel.
 };
 
 RoutingExperiment::RoutingExperiment()
 {
 }
 
-double starttime = 0; // start of package sent
-
-static inline std::string
-PrintReceivedPacket(Ptr<Socket> socket, Ptr<Packet> packet, Address senderAddress)
-{
-    std::ostringstream oss;
-
-    oss << Simulator::Now().GetSeconds() << " " << socket->GetNode()->GetId();
-
-    if (InetSocketAddress::IsMatchingType(senderAddress))
-    {
-        InetSocketAddress addr = InetSocketAddress::ConvertFrom(senderAddress);
-        oss << " received one packet from " << addr.GetIpv4();
-    }
-    else
-    {
-        oss << " received one packet!";
-    }
-    return oss.str();
-}
-
 void
 RoutingExperiment::ReceivePacket(Ptr<Socket> socket)
 {
+    PROFILE_SCOPE("RoutingExperiment::ReceivePacket");
     Ptr<Packet> packet;
     Address senderAddress;
     while ((packet = socket->RecvFrom(senderAddress)))
     {
-      SeqTsHeader hdr;
-      double received = hdr.GetTs().GetSeconds();
+      SeqTsSizeHeader hdr;
       packet->PeekHeader(hdr);
-      double delta = received - starttime;
-      delays.push_back(delta);
+      uint32_t senderIp = 0;
+      uint32_t source = std::numeric_limits<uint32_t>::max();
+      if (InetSocketAddress::IsMatchingType(senderAddress))
+      {
+        senderIp = InetSocketAddress::ConvertFrom(senderAddress).GetIpv4().Get();
+        auto node = m_nodeOfAddress.find(senderIp);
+        if (node != m_nodeOfAddress.end())
+        {
+          source = node->second;
+        }
+      }
+      uint32_t sinkNode = socket->GetNode()->GetId();
+      WindowedDelays::Flow& flow = m_delays.GetFlow(source, sinkNode);
+      // duplicates and packets already given up as lost have no delay to add
+      double sentTime;
+      if (m_inFlight.Received(static_cast<uint64_t>(source) << 32 | sinkNode, hdr.GetSeq(), sentTime))
+      {
+        m_delays.Record(flow, Simulator::Now().GetSeconds() - sentTime);
+      }
 
       // ===================================================================== //
 
@@ -121,40 +190,39 @@ RoutingExperiment::ReceivePacket(Ptr<Socket> socket)
       // ===================================================================== //
 
         bytesTotal += packet->GetSize();
-        NS_LOG_UNCOND(PrintReceivedPacket(socket, packet, senderAddress));
+        PACKET_TRACE(m_packetTrace, Simulator::Now().GetSeconds(), socket->GetNode()->GetId(), senderIp,
+                     packet->GetSize(), flow.id);
     }
 }
 
 void
 RoutingExperiment::CheckThroughput()
 {
-    double kbs = (bytesTotal * 8.0) / 1000;
+    PROFILE_SCOPE("RoutingExperiment::CheckThroughput");
+    double kbs = (bytesTotal * 8.0) / 1000 / m_windowLength;
     bytesTotal = 0;
 
-    // ===================================================================== //
-    
-    float pdr = static_cast<float>(packetsReceived)/static_cast<float>(packetsSent);
-
-    // ===================================================================== //
-
-    double totale2e = 0;
-    for(double k: delays){
-      totale2e += k;
-    }
-    double average_e2e = totale2e/packetsReceived;
-    delays.erase(delays.begin(), delays.end());
-
-    // ===================================================================== //
-    
-    std::ofstream out(m_CSVfileName, std::ios::app);
-    out << (Simulator::Now()).GetSeconds() << "," << kbs << "," << packetsReceived << ","
-        << average_e2e << "," << pdr << ","
-        << m_nSinks << "," << m_protocolName << "," << m_txp << "" << std::endl;
-
-    out.close();
+    m_delays.CloseWindow(Simulator::Now().GetSeconds(), m_windowLength, kbs, packetsReceived, packetsSent, m_metrics,
+                         m_flowMetrics);
+    m_runReceived += packetsReceived;
+    m_runSent += packetsSent;
+    m_inFlight.Expire(Simulator::Now().GetSeconds());
     packetsReceived = 0;
     packetsSent = 0;
-    Simulator::Schedule(Seconds(1.0), &RoutingExperiment::CheckThroughput, this);
+    Simulator::Schedule(Seconds(m_windowLength), &RoutingExperiment::CheckThroughput, this);
+}
+
+// totals of the whole run, in the order of SWEEP_RESULT_COLUMNS
+void
+RoutingExperiment::GetSummary(double* results) const
+{
+    results[0] = m_runSent;
+    results[1] = m_runReceived;
+    results[2] = static_cast<double>(m_runReceived) / m_runSent;
+    results[3] = m_delays.GetRunDelay().GetMean();
+    results[4] = m_delays.GetRunHistogram().GetPercentile(50);
+    results[5] = m_delays.GetRunHistogram().GetPercentile(95);
+    results[6] = m_delays.GetRunHistogram().GetPercentile(99);
 }
 
 Ptr<Socket>
@@ -168,27 +236,147 @@ RoutingExperiment::SetupPacketReceive(Ipv4Address addr, Ptr<Node> node)
     return sink;
 }
 
-static void
-Tx( std::string c, 
-    Ptr<const Packet> packet
-  ){
-  packetsSent+=1;
-  SeqTsHeader hdr;
-  starttime = hdr.GetTs().GetSeconds();
+void
+RoutingExperiment::PacketSent(RoutingExperiment* experiment,
+                              uint64_t flow,
+                              Ptr<const Packet> packet,
+                              const Address& from,
+                              const Address& to,
+                              const SeqTsSizeHeader& header)
+{
+    PROFILE_SCOPE("RoutingExperiment::PacketSent");
+    packetsSent += 1;
+    experiment->m_inFlight.Sent(flow, header.GetSeq(), Simulator::Now().GetSeconds());
 }
 
 void
 RoutingExperiment::CommandSetup(int argc, char** argv)
 {
     CommandLine cmd(__FILE__);
+    cmd.AddValue("batchedLoss", "Compute the rx power of all receivers of a frame in one vectorised pass",
+                 m_batchedLoss);
+    cmd.AddValue("weatherField", "File of rain and snow cells, one 'x y radius start end attenuationDb' per line",
+                 m_weatherFieldFile);
+    cmd.AddValue("CSVfileName", "Windowed metrics csv; the per flow csv goes next to it", m_CSVfileName);
+    cmd.AddValue("packetTrace", "Binary trace of every received packet, read with decode_packets; empty for none",
+                 m_packetTraceFile);
+    cmd.AddValue("window", "Length (s) of the windows the metrics are reported over", m_windowLength);
+    cmd.AddValue("protocol", "Routing protocol: AODV, OLSR, DSDV or DSR", m_protocolName);
+    cmd.AddValue("sinks", "Number of sink nodes, each with its own sender", m_nSinks);
+    cmd.AddValue("txp", "Transmission power (dBm)", m_txp);
+    cmd.AddValue("weather", "Weather from 200 s on (0 normal, 1 rain, 2 snow)", m_weather);
+    cmd.AddValue("rainRate", "Rain rate (mm/h) while it rains", m_rainRate);
+    cmd.AddValue("snowRate", "Snowfall rate (mm/h of liquid water) while it snows", m_snowRate);
+    cmd.AddValue("sweepConfig", "Parameter grid to run, one 'option = value, value, ...' per line", m_sweepConfigFile);
+    cmd.AddValue("sweepJobs", "Sweep runs at once", m_sweepJobs);
+    cmd.AddValue("sweepOutputDir", "Directory for the files of every sweep run and results.csv", m_sweepOutputDir);
+    cmd.AddValue("memoryInterval", "Sample the memory held per node every this many seconds, into the .memory.csv "
+                 "next to the csv; 0 for none", m_memoryInterval);
+    cmd.AddValue("profile", "Time every event and trace sink, print progress and a profile to stderr", m_profile);
+    cmd.AddValue("forkAt", "Warm start the sweep: simulate up to this time (s, before traffic starts at 100 s) once, "
+                 "then fork every point off it", m_forkAt);
     cmd.Parse(argc, argv);
 }
 
+bool
+RoutingExperiment::IsSweep() const
+{
+    return !m_sweepConfigFile.empty();
+}
+
+static const std::vector<std::string> SWEEP_RESULT_COLUMNS{"PacketsSent",
+                                                           "PacketsReceived",
+                                                           "PacketDeliveryRatio",
+                                                           "MeanDelay",
+                                                           "DelayP50",
+                                                           "DelayP95",
+                                                           "DelayP99"};
+
+bool
+RoutingExperiment::RunSweep(int argc, char** argv)
+{
+    SweepConfig config;
+    NS_ABORT_MSG_IF(!config.Load(m_sweepConfigFile), "could not load " << m_sweepConfigFile);
+    if (mkdir(m_sweepOutputDir.c_str(), 0755) != 0 && errno != EEXIST)
+    {
+        NS_FATAL_ERROR("could not create " << m_sweepOutputDir);
+    }
+    // loaded once here, every run gets a copy on write view of it
+    if (!m_weatherFieldFile.empty())
+    {
+        m_weatherField = CreateObject<WeatherField>();
+        NS_ABORT_MSG_IF(!m_weatherField->Load(m_weatherFieldFile), "could not load " << m_weatherFieldFile);
+    }
+    std::string resultsFile = m_sweepOutputDir + "/results.csv";
+
+    if (m_forkAt > 0)
+    {
+        // one warm up for every point, forked off before anything they change has happened; the neighbours and
+        // routes of the warm up depend on the tx power, so it stays that of the warm up
+        NS_ABORT_MSG_IF(m_forkAt >= 100, "the warm start must fork before traffic starts at 100 s");
+        m_variants = std::make_unique<SweepRunner>(config.Expand(), SWEEP_RESULT_COLUMNS);
+        for (const auto& [name, value]: m_variants->GetPoint(0))
+        {
+            NS_ABORT_MSG_IF(name != "sinks" && name != "weather" && name != "window",
+                            name << " cannot change after a warm start, only sinks, weather and window");
+        }
+        Run();
+        if (m_variant != SweepRunner::NO_POINT)
+        {
+            return true;
+        }
+        NS_ABORT_MSG_IF(!m_variants->WriteResults(resultsFile), "could not write " << resultsFile);
+        return m_variants->AllSucceeded();
+    }
+
+    // every run starts from the command line minus the sweep options, then the options of its point
+    std::vector<std::string> baseArgs;
+    for (int i = 0; i < argc; i++)
+    {
+        if (i == 0 || std::string(argv[i]).rfind("--sweep", 0) != 0)
+        {
+            baseArgs.emplace_back(argv[i]);
+        }
+    }
+
+    SweepRunner runner(config.Expand(), SWEEP_RESULT_COLUMNS);
+    bool ok = runner.Run(m_sweepJobs, [&](const SweepPoint& point, double* results) {
+        std::vector<std::string> args = baseArgs;
+        for (const auto& [name, value]: point)
+        {
+            args.push_back("--" + name + "=" + value);
+        }
+        args.push_back("--CSVfileName=" + m_sweepOutputDir + "/" + SweepRunner::GetKey(point) + ".csv");
+        args.push_back("--packetTrace=");
+        std::vector<char*> runArgv;
+        for (std::string& arg: args)
+        {
+            runArgv.push_back(arg.data());
+        }
+        runArgv.push_back(nullptr);
+
+        RoutingExperiment run;
+        run.CommandSetup(args.size(), runArgv.data());
+        if (run.m_weatherFieldFile == m_weatherFieldFile)
+        {
+            run.m_weatherField = m_weatherField;
+        }
+        run.Run();
+        run.GetSummary(results);
+    });
+    NS_ABORT_MSG_IF(!runner.WriteResults(resultsFile), "could not write " << resultsFile);
+    return ok;
+}
+
 int
 main(int argc, char* argv[])
 {
     RoutingExperiment experiment;
     experiment.CommandSetup(argc, argv);
+    if (experiment.IsSweep())
+    {
+        return experiment.RunSweep(argc, argv) ? 0 : 1;
+    }
     experiment.Run();
 
     return 0;
@@ -197,19 +385,16 @@ main(int argc, char* argv[])
 void
 RoutingExperiment::Run()
 {
+    if (m_profile)
+    {
+        Profiler::Enable();
+    }
     Packet::EnablePrinting();
 
-    // blank out the last output file and write the column headers
-    std::ofstream out{m_CSVfileName, std::ios::trunc};
-    out << "SimulationSecond,"
-        << "ReceiveRate,"
-        << "PacketsReceived,"
-        << "Average End to End,"
-        << "Package Delivery Ratio,"
-        << "NumberOfSinks,"
-        << "RoutingProtocol,"
-        << "TransmissionPower" << std::endl;
-    out.close();
+    if (!m_variants)
+    {
+        OpenOutputs();
+    }
 
     // Setup
 
@@ -229,6 +414,8 @@ RoutingExperiment::Run()
 
     // Set Non-unicastMode rate to unicast mode
     Config::SetDefault("ns3::WifiRemoteStationManager::NonUnicastMode", StringValue(phyMode));
+    Config::SetDefault("ns3::WeatheredFriisPropagationLossModel::RainRate", DoubleValue(m_rainRate));
+    Config::SetDefault("ns3::WeatheredFriisPropagationLossModel::SnowRate", DoubleValue(m_snowRate));
 
     // -------------------------------------------------------------------------------------- //
     
@@ -259,8 +446,30 @@ RoutingExperiment::Run()
     YansWifiPhyHelper wifiPhy;
     YansWifiChannelHelper wifiChannel;
     wifiChannel.SetPropagationDelay("ns3::ConstantSpeedPropagationDelayModel");
-    wifiChannel.AddPropagationLoss("ns3::WeatheredFriisPropagationLossModel");
-    wifiPhy.SetChannel(wifiChannel.Create());
+    if (m_batchedLoss)
+    {
+        // the batch kernel is the fast path
+        wifiChannel.AddPropagationLoss("ns3::BatchedWeatheredFriisPropagationLossModel",
+                                       "FastPath", BooleanValue(true));
+    }
+    else
+    {
+        wifiChannel.AddPropagationLoss("ns3::WeatheredFriisPropagationLossModel");
+    }
+    Ptr<YansWifiChannel> channel = wifiChannel.Create();
+    wifiPhy.SetChannel(channel);
+    PointerValue lossModel;
+    channel->GetAttribute("PropagationLossModel", lossModel);
+    Ptr<WeatheredFriisPropagationLossModel> friis = lossModel.Get<WeatheredFriisPropagationLossModel>();
+    if (!m_weatherField && !m_weatherFieldFile.empty())
+    {
+        m_weatherField = CreateObject<WeatherField>();
+        NS_ABORT_MSG_IF(!m_weatherField->Load(m_weatherFieldFile), "could not load " << m_weatherFieldFile);
+    }
+    if (m_weatherField)
+    {
+        friis->SetWeatherField(m_weatherField);
+    }
 
     // Add a mac and disable rate control
     WifiMacHelper wifiMac;
@@ -328,17 +537,50 @@ RoutingExperiment::Run()
 
     mobilitySmallShips.Install(smallShips);
     mobilityMediumShips.Install(mediumShips);
+
+    if (m_batchedLoss)
+    {
+        DynamicCast<BatchedWeatheredFriisPropagationLossModel>(friis)->AddReceivers(adhocNodes);
+    }
     
     // -------------------------------------------------------------------------------------- //
 
     // Routing in adhoc + internet stack + ipv4
     AodvHelper aodv;
+    OlsrHelper olsr;
+    DsdvHelper dsdv;
+    DsrHelper dsr;
+    DsrMainHelper dsrMain;
     Ipv4ListRoutingHelper list;
     InternetStackHelper internet;
 
-    list.Add(aodv, 100);
-    internet.SetRoutingHelper(list);
-    internet.Install(adhocNodes);
+    if (m_protocolName == "AODV")
+    {
+        list.Add(aodv, 100);
+    }
+    else if (m_protocolName == "OLSR")
+    {
+        list.Add(olsr, 100);
+    }
+    else if (m_protocolName == "DSDV")
+    {
+        list.Add(dsdv, 100);
+    }
+    else if (m_protocolName != "DSR")
+    {
+        NS_FATAL_ERROR("No such protocol:" << m_protocolName);
+    }
+
+    if (m_protocolName == "DSR")
+    {
+        internet.Install(adhocNodes);
+        dsrMain.Install(dsr, adhocNodes);
+    }
+    else
+    {
+        internet.SetRoutingHelper(list);
+        internet.Install(adhocNodes);
+    }
     NS_LOG_INFO("assigning ip address");
 
     // -------------------------------------------------------------------------------------- //
@@ -348,41 +590,188 @@ RoutingExperiment::Run()
     addressAdhoc.SetBase("10.1.1.0", "255.255.255.0");
     Ipv4InterfaceContainer adhocInterfaces;
     adhocInterfaces = addressAdhoc.Assign(adhocDevices);
+    for (uint32_t i = 0; i < adhocInterfaces.GetN(); i++)
+    {
+        m_nodeOfAddress[adhocInterfaces.GetAddress(i).Get()] = adhocNodes.Get(i)->GetId();
+    }
+
+    m_adhocNodes = adhocNodes;
+    m_adhocInterfaces = adhocInterfaces;
+    m_friis = friis;
+
+    // ===================================================================== //
+    
+    NS_LOG_INFO("Run Simulation.");
+    if (m_memoryInterval > 0)
+    {
+        m_memory.AddProbe("flows", [this]() { return m_delays.GetNFlows(); }, WindowedDelays::GetFlowBytes());
+        m_memory.AddProbe("node of address", [this]() { return m_nodeOfAddress.size(); },
+                          sizeof(decltype(m_nodeOfAddress)::value_type));
+        m_memory.AddProbe("in flight table slots", [this]() { return m_inFlight.GetCapacity(); },
+                          InFlightTable::GetSlotBytes());
+        m_memory.Start(Seconds(m_memoryInterval));
+    }
+
+    if (m_variants)
+    {
+        Simulator::Schedule(Seconds(m_forkAt), &RoutingExperiment::ForkVariants, this, TotalTime);
+    }
+    else
+    {
+        InstallTraffic(TotalTime);
+        CheckThroughput();
+        Simulator::Schedule(Seconds(200), &SetRainning, friis, m_weather);
+    }
+    Simulator::Stop(Seconds(TotalTime));
+    Simulator::Run();
+    if (m_variants && m_variant == SweepRunner::NO_POINT)
+    {
+        // the warm up only forks the points
+        m_memory.Close();
+        Simulator::Destroy();
+        return;
+    }
+    // the open window is not written, only counted in the totals, with one row per flow over the whole run
+    m_delays.CloseRun(Simulator::Now().GetSeconds(), m_flowMetrics);
+    m_runReceived += packetsReceived;
+    m_runSent += packetsSent;
+    m_metrics.Close();
+    m_flowMetrics.Close();
+    m_packetTrace.Close();
+    std::cout << m_runSent << " packets sent, " << m_runReceived << " received, " << m_inFlight.GetLost()
+              << " given up as lost, " << m_inFlight.GetUnmatched() << " duplicate or late\n";
+    if (m_memoryInterval > 0)
+    {
+        m_memory.Sample();
+        m_memory.Close();
+        m_memory.Print(std::cout);
+    }
+    if (m_variants)
+    {
+        double results[SweepRunner::MAX_RESULTS];
+        GetSummary(results);
+        m_variants->SetResults(m_variant, results);
+    }
+    Profiler::WriteRunStats();
+
+    Simulator::Destroy();
+}
+
+void
+RoutingExperiment::OpenOutputs()
+{
+    // blank out the last output file and write the column headers; the windows are written from a background
+    // thread as they close
+    std::ostringstream txp;
+    txp << m_txp;
+    m_metrics.SetConstant("NumberOfSinks", std::to_string(m_nSinks));
+    m_metrics.SetConstant("RoutingProtocol", m_protocolName);
+    m_metrics.SetConstant("TransmissionPower", txp.str());
+    NS_ABORT_MSG_IF(!m_metrics.Open(m_CSVfileName,
+                                    {"SimulationSecond",
+                                     "ReceiveRate",
+                                     "PacketsReceived",
+                                     "Average End to End",
+                                     "Package Delivery Ratio",
+                                     "NumberOfSinks",
+                                     "RoutingProtocol",
+                                     "TransmissionPower",
+                                     "DelayStdDev",
+                                     "DelayMin",
+                                     "DelayMax",
+                                     "DelayP50",
+                                     "DelayP95",
+                                     "DelayP99",
+                                     "PacketsSent"}),
+                    "could not open " << m_CSVfileName);
+    // per flow delays next to it, sanet.output.csv -> sanet.output.flows.csv
+    std::string flowsFileName = m_CSVfileName.substr(0, m_CSVfileName.rfind(".csv")) + ".flows.csv";
+    NS_ABORT_MSG_IF(!m_flowMetrics.Open(flowsFileName,
+                                        {"WindowStart",
+                                         "WindowEnd",
+                                         "SourceNode",
+                                         "SinkNode",
+                                         "PacketsReceived",
+                                         "DelayP50",
+                                         "DelayP95",
+                                         "DelayP99",
+                                         "DelayMax"}),
+                    "could not open " << flowsFileName);
+    if (m_memoryInterval > 0)
+    {
+        std::string memoryFileName = m_CSVfileName.substr(0, m_CSVfileName.rfind(".csv")) + ".memory.csv";
+        NS_ABORT_MSG_IF(!m_memory.Open(memoryFileName), "could not open " << memoryFileName);
+    }
+    if (!m_packetTraceFile.empty())
+    {
+        NS_ABORT_MSG_IF(!m_packetTrace.Open(m_packetTraceFile), "could not open " << m_packetTraceFile);
+    }
+}
 
+// one sender per sink, sink i on node i and its sender on node i + m_nSinks
+void
+RoutingExperiment::InstallTraffic(double totalTime)
+{
     OnOffHelper onoff1("ns3::UdpSocketFactory", Address());
     onoff1.SetAttribute("OnTime", StringValue("ns3::ConstantRandomVariable[Constant=1.0]"));
     onoff1.SetAttribute("OffTime", StringValue("ns3::ConstantRandomVariable[Constant=0.0]"));
+    // sequence number and send time in every packet, for ReceivePacket to find it in m_inFlight
+    onoff1.SetAttribute("EnableSeqTsSizeHeader", BooleanValue(true));
 
     for (int i = 0; i < m_nSinks; i++)
     {
       // setting up source and sinks
-        Ptr<Socket> sink = SetupPacketReceive(adhocInterfaces.GetAddress(i), adhocNodes.Get(i));
+        Ptr<Socket> sink = SetupPacketReceive(m_adhocInterfaces.GetAddress(i), m_adhocNodes.Get(i));
 
-        AddressValue remoteAddress(InetSocketAddress(adhocInterfaces.GetAddress(i), port));
+        AddressValue remoteAddress(InetSocketAddress(m_adhocInterfaces.GetAddress(i), port));
         onoff1.SetAttribute("Remote", remoteAddress); // remote address is the destination
 
         Ptr<UniformRandomVariable> var = CreateObject<UniformRandomVariable>(); // random number
-        ApplicationContainer temp = onoff1.Install(adhocNodes.Get(i + m_nSinks)); // install a onoff sender at i +
-                                                                                  // m_nSinks, who send it to node i
-        std::ostringstream oss;
-        oss << "/NodeList/" << adhocNodes.Get(i + m_nSinks)->GetId()
-            << "/ApplicationList/0/$ns3::OnOffApplication/Tx";
-        Config::Connect(oss.str(), MakeCallback(&Tx));
-
-        temp.Start(Seconds(var->GetValue(100.0, 101.0)));
-        temp.Stop(Seconds(TotalTime));
+        ApplicationContainer temp = onoff1.Install(m_adhocNodes.Get(i + m_nSinks)); // install a onoff sender at i +
+                                                                                    // m_nSinks, who send it to node i
+        uint64_t flow = static_cast<uint64_t>(m_adhocNodes.Get(i + m_nSinks)->GetId()) << 32 |
+                        m_adhocNodes.Get(i)->GetId();
+        temp.Get(0)->TraceConnectWithoutContext("TxWithSeqTsSize",
+                                                MakeBoundCallback(&RoutingExperiment::PacketSent, this, flow));
+
+        // start and stop are relative to now, which is after the warm up when forked
+        temp.Start(Seconds(var->GetValue(100.0, 101.0)) - Simulator::Now());
+        temp.Stop(Seconds(totalTime) - Simulator::Now());
         
     }
+}
 
-    // ===================================================================== //
-    
-    NS_LOG_INFO("Run Simulation.");
+// runs at m_forkAt in the warm up; each fork continues as one point of the sweep
+void
+RoutingExperiment::ForkVariants(double totalTime)
+{
+    m_variant = m_variants->Fork(m_sweepJobs);
+    if (m_variant == SweepRunner::NO_POINT)
+    {
+        Simulator::Stop();
+        return;
+    }
+    const SweepPoint& point = m_variants->GetPoint(m_variant);
+    for (const auto& [name, value]: point)
+    {
+        if (name == "sinks")
+        {
+            m_nSinks = std::stoi(value);
+        }
+        else if (name == "weather")
+        {
+            m_weather = std::stoi(value);
+        }
+        else if (name == "window")
+        {
+            m_windowLength = std::stod(value);
+        }
+    }
+    m_CSVfileName = m_sweepOutputDir + "/" + SweepRunner::GetKey(point) + ".csv";
+    m_packetTraceFile.clear();
 
+    OpenOutputs();
+    InstallTraffic(totalTime);
     CheckThroughput();
-
-    Simulator::Schedule(Seconds(200), &SetRainning, smallShips, nSmallNodes, 1);
-    Simulator::Stop(Seconds(TotalTime));
-    Simulator::Run();
-
-    Simulator::Destroy();
+    Simulator::Schedule(Seconds(200) - Simulator::Now(), &SetRainning, m_friis, m_weather);
 }
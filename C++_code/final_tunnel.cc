@@ -15,15 +15,15 @@
  *  
  *  ./ns3 run "scratch/final_tunnel --wallType=1"
  *
- *  To generate different graphs for different types of walls, find ofst and change the string to the desired output
- *  name. For example the default output name is rssi_building_brick.txt, on page 49 is the initialisation.
+ *  To generate different graphs for different types of walls, set the output name with rssiFile. The default output
+ *  name is rssi_building_wood.txt; for concrete or stone walls run, for example,
  *
- *  std::ofstream ofst{"rssi_building_brick.txt"};
+ *  ./ns3 run "scratch/final_tunnel --wallType=1 --rssiFile=rssi_building_concrete.txt"
  *
- *  To generate the graphs for wood or concrete, one can change the name of the file to 
- *  "rssi_building_wood.txt"
+ *  and then feed the files to visualise_tunnel.py. Each line is one frame received over the link between the two
+ *  nodes: receiving node, distance, signal, time, noise and sending node (see linkprobe.hpp).
  *
- *  and then feed the graphs to visualise_tunnel.py.
+ *  Add --profile=1 to time every event and trace sink, with a profile printed to stderr at the end.
  *
  */
 
@@ -39,60 +39,35 @@
 #include "ns3/integer.h"
 #include "ns3/yans-wifi-helper.h"
 #include "ns3/buildings-module.h"
-// std includes
-#include <fstream>
-#include <cmath>
 // My includes
 #include "helpers.hpp"
 #include "./kaka/weatheredfriis.hpp"
+#include "./kaka/linkprobe.hpp"
+#include "./kaka/shadowingmap.hpp"
+#include "./kaka/profiler.hpp"
 
 using namespace ns3;
 
-std::ofstream ofst{"rssi_building_wood.txt"};
-
 NS_LOG_COMPONENT_DEFINE("TwoNodes");
 
-double EuclideanDistance(Vector& v1, Vector& v2){
-  double component1 = v1.x - v2.x;
-  double component2 = v1.y - v2.y;
-  double component3 = v1.z - v2.z;
-  return std::sqrt(component1*component1 + component2*component2 + component3*component3);
-}
-
-void 
-MonitorSnifferRxCallback( std::string context,
-                          Ptr< const Packet > packet, 
-                          uint16_t channelFreqMhz, 
-                          WifiTxVector txVector, 
-                          MpduInfo aMpdu, 
-                          SignalNoiseDbm signalNoise,
-                          uint16_t staId)
-{
-  std::cout << context << "\t\t|\t" << Simulator::Now() << "\t|\tPacket of size " << packet->GetSize() 
-            << " Recieved with Signal " << signalNoise.signal << " and noise " << signalNoise.noise
-            << '\n';
-  std::vector<Vector> posvecs;
-  for (uint32_t i=0; i < NodeList::GetNNodes(); i++ )
-  {
-    Ptr<MobilityModel> mob = NodeList::GetNode(i)->GetObject<MobilityModel>();
-    Vector pos = mob->GetPosition ();
-    posvecs.push_back(pos);
-  }
-  std::cout << "Distance: " << EuclideanDistance(posvecs[0], posvecs[1]) << '\n';
-  // node, distance, signal
-  ofst << context[10] << ',' << EuclideanDistance(posvecs[0], posvecs[1]) << ", " << signalNoise.signal << '\n';
-}
-
 int
 main(int argc, char* argv[])
 {
     // Setup
     uint32_t nWifi = 2;
     int wallType = 0;
+    bool profile = false;
+    std::string rssiFile{"rssi_building_wood.txt"};
 
     CommandLine cmd(__FILE__);
     cmd.AddValue("wallType", "Set the type of the walls. 0 for wood, 1 for concrete and 2 for stone", wallType);
+    cmd.AddValue("rssiFile", "Output file of the signal of every frame against the distance", rssiFile);
+    cmd.AddValue("profile", "Time every event and trace sink, print a profile to stderr", profile);
     cmd.Parse(argc, argv);
+    if (profile)
+    {
+        Profiler::Enable();
+    }
 
     LogComponentEnable("UdpEchoClientApplication", LOG_LEVEL_INFO);
     LogComponentEnable("UdpEchoServerApplication", LOG_LEVEL_INFO);
@@ -166,7 +141,8 @@ main(int argc, char* argv[])
     YansWifiChannelHelper channel = YansWifiChannelHelper::Default();
     //channel.AddPropagationLoss("ns3::WeatheredFriisPropagationLossModel");
     //channel.AddPropagationLoss("ns3::FriisPropagationLossModel");
-    channel.AddPropagationLoss("ns3::HybridBuildingsPropagationLossModel",
+    // the hybrid model, shadowed from a correlated map so the shadowing drifts as the node moves
+    channel.AddPropagationLoss("ns3::CorrelatedHybridBuildingsPropagationLossModel",
                                     "CitySize", StringValue("Small"),
                                     "ShadowSigmaOutdoor", DoubleValue (10.0),
                                     "ShadowSigmaExtWalls", DoubleValue (10.0),
@@ -232,20 +208,18 @@ main(int argc, char* argv[])
 
     // ===================================================================== //
     
-    std::ostringstream oss_rssSta;
-    oss_rssSta  << "/NodeList/" << wifiStaNode.Get(0)->GetId()
-                << "/DeviceList/0/$ns3::WifiNetDevice/Phy/MonitorSnifferRx";
-    Config::Connect(oss_rssSta.str(), MakeCallback(&MonitorSnifferRxCallback));
-
-    std::ostringstream oss_rssAp;
-    oss_rssAp   << "/NodeList/" << wifiApNode.Get(0)->GetId()
-                << "/DeviceList/0/$ns3::WifiNetDevice/Phy/MonitorSnifferRx";
-    Config::Connect(oss_rssAp.str(), MakeCallback(&MonitorSnifferRxCallback));
+    // both directions of the link
+    LinkProbe rssi;
+    NS_ABORT_MSG_IF(!rssi.Open(rssiFile), "could not open " << rssiFile);
+    rssi.AddLink(wifiApNode.Get(0), wifiStaNode.Get(0));
+    rssi.AddLink(wifiStaNode.Get(0), wifiApNode.Get(0));
 
     // ===================================================================== //
 
     Simulator::Stop(Seconds(20));
     Simulator::Run();
+    rssi.Close();
+    Profiler::WriteRunStats();
     Simulator::Destroy();
     return 0;
 }
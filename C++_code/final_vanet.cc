@@ -7,6 +7,52 @@
 //
 // "./ns3 run scratch/final_vanet"
 //
+// To skip parsing cardiff.tcl on every run, compile it once with compile_trace and pass the result:
+//
+// "./ns3 run "scratch/final_vanet --binaryTrace=./scratch/cardiff.wpt""
+//
+// Or stream the sumo fcd output straight in, with no traceExporter step at all:
+//
+// "./ns3 run "scratch/final_vanet --fcdTrace=./scratch/sumoTrace.xml""
+//
+// There is one vehicle per node of the trace (or per vehicle id of the fcd output), unless --vehicles says
+// otherwise, and the time and memory per vehicle of each setup phase are printed before the simulation starts.
+// generate_trace writes synthetic traces of any size to try larger networks with.
+//
+// Add --cullRange=300 to skip the loss models for receivers further than 300 m from the sender.
+//
+// Add --weatherField=./scratch/cardiff_storms.txt to run localised rain and snow cells over the map.
+//
+// Add --buildings=./scratch/osm.poly.xml.gz --buildingsNet=./scratch/new.net.xml to put the real Cardiff building
+// footprints in the place of the placeholder building: every link loses --wallLoss dB per footprint wall it
+// crosses. --buildingsNet is the net cardiff.tcl was made on, which the footprints are moved into.
+//
+// The shadowing of the buildings model comes from a spatially correlated map (see shadowingmap.hpp), which
+// decorrelates over --decorrelationDistance m, in fixed memory however many vehicles pass through.
+//
+// Add --pathLossRaster=./scratch/cardiff.plr to read the loss of every link from a raster precomputed by build_raster
+// over the same buildings, instead of evaluating the buildings models for each frame.
+//
+// Received packets are traced to vanet.packets.bin, see decode_packets.
+//
+// Add --sweepConfig=./scratch/sweep.txt to run every combination of the options listed in the file (see sweep.hpp
+// for the format), --sweepJobs at a time, with one row per run in <sweepOutputDir>/results.csv. The binary trace
+// and the weather field are loaded once for the whole sweep; without --binaryTrace every run parses cardiff.tcl,
+// as a single run does, so both use the same mobility models.
+//
+// Add --forkAt=90 to a sweep to simulate the routing and mobility warm up once and fork every point off it at 90 s,
+// before traffic starts; the points can then only change sinks and window. The routing tables at the fork were
+// built at the warm up's power, so txp cannot be forked.
+//
+// Add --probeLinks=0-1,5-7 to log the signal, noise and distance of every frame vehicle 0 sends to 1 and 5 to 7 into
+// vanet.links.csv.
+//
+// Add --memoryInterval=100 to count what every node holds (objects by type, routing table rows, queued packets) and
+// the heap every 100 s into vanet.memory.csv, to see which of them grows with the nodes or over time.
+//
+// Add --profile=1 to time every event and trace sink: progress and the time left are printed to stderr every few
+// seconds, and a profile sorted by self time at the end.
+//
 
 #include "ns3/aodv-module.h"
 #include "ns3/applications-module.h"
@@ -18,17 +64,41 @@
 #include "ns3/mobility-module.h"
 #include "ns3/network-module.h"
 #include "ns3/olsr-module.h"
+#include "ns3/wifi-net-device.h"
 #include "ns3/yans-wifi-helper.h"
 #include "ns3/mobility-module.h"
 #include "ns3/ns2-mobility-helper.h"
 #include "ns3/buildings-module.h"
 
 #include "./kaka/weatheredfriis.hpp"
-
+#include "./kaka/ns2binarytrace.hpp"
+#include "./kaka/sumofcd.hpp"
+#include "./kaka/gridculling.hpp"
+#include "./kaka/linkprobe.hpp"
+#include "./kaka/osmbuildings.hpp"
+#include "./kaka/shadowingmap.hpp"
+#include "./kaka/weatherfield.hpp"
+#include "./kaka/latency.hpp"
+#include "./kaka/memaccount.hpp"
+#include "./kaka/metrics.hpp"
+#include "./kaka/packettrace.hpp"
+#include "./kaka/pathlossraster.hpp"
+#include "./kaka/sweep.hpp"
+#include "./kaka/profiler.hpp"
+#include "./kaka/setupreport.hpp"
+
+#include <cerrno>
 #include <fstream>
 #include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <thread>
 #include <vector>
 
+#include <sys/stat.h>
+
 using namespace ns3;
 using namespace dsr;
 
@@ -42,11 +112,25 @@ class RoutingExperiment
     RoutingExperiment() = default;
     void Run();
     void CommandSetup(int argc, char** argv);
+    bool IsSweep() const;
+    // runs every point of m_sweepConfigFile; argv is the command line every run starts from
+    bool RunSweep(int argc, char** argv);
 
   private:
     Ptr<Socket> SetupPacketReceive(Ipv4Address addr, Ptr<Node> node);
     void ReceivePacket(Ptr<Socket> socket);
+    static void PacketSent(RoutingExperiment* experiment,
+                           uint64_t flow,
+                           Ptr<const Packet> packet,
+                           const Address& from,
+                           const Address& to,
+                           const SeqTsSizeHeader& header);
     void CheckThroughput();
+    void GetSummary(double* results) const;
+    void OpenOutputs();
+    void InstallTraffic(double totalTime);
+    void ForkVariants(double totalTime);
+    uint32_t CountTraceVehicles() const;
 
     uint32_t port{9};             //!< Receiving port number.
     uint32_t bytesTotal{0};       //!< Total received bytes.
@@ -56,44 +140,83 @@ class RoutingExperiment
     int m_nSinks{10};                                      //!< Number of sink nodes.
     std::string m_protocolName{"AODV"};                    //!< Protocol name.
     double m_txp{7.5};                                     //!< Tx power.
+    bool m_profile{false};                                 //!< Profile the event loop.
     bool m_traceMobility{false};                           //!< Enable mobility tracing.
     bool m_flowMonitor{false};                             //!< Enable FlowMonitor.
-    std::vector<double> delays;
+    std::string m_binaryTraceFile;                         //!< Compiled mobility trace, empty to parse the tcl.
+    Ptr<Ns2BinaryTrace> m_binaryTrace;                     //!< m_binaryTraceFile, once loaded.
+    std::string m_fcdTraceFile;                            //!< sumo fcd output streamed in directly, if set.
+    uint32_t m_nVehicles{0};                               //!< Number of vehicles, 0 to take it from the trace.
+    bool m_setupReport{true};                              //!< Print the time and memory of each setup phase.
+    double m_cullRange{0};                                 //!< Grid culling range, 0 to evaluate every receiver.
+    std::string m_weatherFieldFile;                        //!< Weather cells to load, if set.
+    Ptr<WeatherField> m_weatherField;                      //!< m_weatherFieldFile, once loaded.
+    std::string m_buildingsFile;                           //!< Building footprints to load, if set.
+    std::string m_buildingsNetFile;                        //!< Net the footprints are moved into, if set.
+    double m_wallLoss{12.0};                               //!< Loss of each footprint wall crossed (dB).
+    bool m_buildingBoxes{false};                           //!< Footprints as ns-3 buildings, not walls.
+    double m_decorrelationDistance{20.0};                  //!< Decorrelation distance of the shadowing (m).
+    Ptr<OsmBuildings> m_buildings;                         //!< m_buildingsFile, once loaded.
+    std::string m_pathLossRasterFile;                      //!< Precomputed path loss to map, if set.
+    Ptr<PathLossRaster> m_pathLossRaster;                  //!< m_pathLossRasterFile, once mapped.
+    double m_windowLength{1.0};                            //!< Length of a metrics window (s).
+    WindowedDelays m_delays;                               //!< End to end delays, by window and flow.
+    MetricsWriter m_metrics;                               //!< Writes the closed windows to m_CSVfileName.
+    std::map<uint32_t, uint32_t> m_nodeOfAddress;          //!< Node id of each interface address.
+    MetricsWriter m_flowMetrics;                           //!< Writes the per flow windows.
+    InFlightTable m_inFlight;                              //!< Send times of the packets in flight.
+    std::string m_packetTraceFile{"vanet.packets.bin"};        //!< Binary trace of received packets, if set.
+    PacketTraceWriter m_packetTrace;                       //!< Writes m_packetTraceFile.
+
+    uint64_t m_runSent{0};                                 //!< Packets sent over the run.
+    uint64_t m_runReceived{0};                             //!< Packets received over the run.
+    double m_memoryInterval{0};                            //!< Memory sampling interval (s), 0 for none.
+    MemoryAccount m_memory;                                //!< Samples the memory held per node.
+    std::string m_probeLinks;                              //!< "tx-rx,..." vehicle pairs to probe, if set.
+    LinkProbe m_linkProbe;                                 //!< Signal and distance of m_probeLinks.
+
+    std::string m_sweepConfigFile;                         //!< Parameter grid to sweep, if set.
+    uint32_t m_sweepJobs{std::max(1u, std::thread::hardware_concurrency())}; //!< Sweep runs at once.
+    std::string m_sweepOutputDir{"sweep"};                 //!< Directory of the sweep's files.
+    double m_forkAt{0};                                    //!< Warm start: time the sweep forks at, 0 for none.
+    std::unique_ptr<SweepRunner> m_variants;               //!< Warm start: the points to fork.
+    std::size_t m_variant{SweepRunner::NO_POINT};          //!< Warm start: the point this process runs.
+
+    NodeContainer m_adhocNodes;                            //!< Every vehicle.
+    Ipv4InterfaceContainer m_adhocInterfaces;              //!< Their addresses.
 };
 
-double starttime = 0;
-
-static inline std::string
-PrintReceivedPacket(Ptr<Socket> socket, Ptr<Packet> packet, Address senderAddress)
-{
-    std::ostringstream oss;
-
-    oss << Simulator::Now().GetSeconds() << " " << socket->GetNode()->GetId();
-
-    if (InetSocketAddress::IsMatchingType(senderAddress))
-    {
-        InetSocketAddress addr = InetSocketAddress::ConvertFrom(senderAddress);
-        oss << " received one packet from " << addr.GetIpv4();
-    }
-    else
-    {
-        oss << " received one packet!";
-    }
-    return oss.str();
-}
+static const std::string CARDIFF_TRACE{"./scratch/cardiff.tcl"}; // relative to where ns3 is stored
 
 void
 RoutingExperiment::ReceivePacket(Ptr<Socket> socket)
 {
+    PROFILE_SCOPE("RoutingExperiment::ReceivePacket");
     Ptr<Packet> packet;
     Address senderAddress;
     while ((packet = socket->RecvFrom(senderAddress)))
     {
-      SeqTsHeader hdr;
-      double received = hdr.GetTs().GetSeconds();
+      SeqTsSizeHeader hdr;
       packet->PeekHeader(hdr);
-      double delta = received - starttime;
-      delays.push_back(delta);
+      uint32_t senderIp = 0;
+      uint32_t source = std::numeric_limits<uint32_t>::max();
+      if (InetSocketAddress::IsMatchingType(senderAddress))
+      {
+        senderIp = InetSocketAddress::ConvertFrom(senderAddress).GetIpv4().Get();
+        auto node = m_nodeOfAddress.find(senderIp);
+        if (node != m_nodeOfAddress.end())
+        {
+          source = node->second;
+        }
+      }
+      uint32_t sinkNode = socket->GetNode()->GetId();
+      WindowedDelays::Flow& flow = m_delays.GetFlow(source, sinkNode);
+      // duplicates and packets already given up as lost have no delay to add
+      double sentTime;
+      if (m_inFlight.Received(static_cast<uint64_t>(source) << 32 | sinkNode, hdr.GetSeq(), sentTime))
+      {
+        m_delays.Record(flow, Simulator::Now().GetSeconds() - sentTime);
+      }
 
       // ===================================================================== //
 
@@ -102,41 +225,39 @@ RoutingExperiment::ReceivePacket(Ptr<Socket> socket)
       // ===================================================================== //
 
         bytesTotal += packet->GetSize();
-        NS_LOG_UNCOND(PrintReceivedPacket(socket, packet, senderAddress));
+        PACKET_TRACE(m_packetTrace, Simulator::Now().GetSeconds(), socket->GetNode()->GetId(), senderIp,
+                     packet->GetSize(), flow.id);
     }
 }
 
 void
 RoutingExperiment::CheckThroughput()
 {
-    double kbs = (bytesTotal * 8.0) / 1000;
+    PROFILE_SCOPE("RoutingExperiment::CheckThroughput");
+    double kbs = (bytesTotal * 8.0) / 1000 / m_windowLength;
     bytesTotal = 0;
 
-    // ===================================================================== //
-    
-    float pdr = static_cast<float>(packetsReceived)/static_cast<float>(packetsSent);
-
-    // ===================================================================== //
-
-    double totale2e = 0;
-    for(double k: delays){
-      totale2e += k;
-    }
-    double average_e2e = totale2e/packetsReceived;
-    delays.erase(delays.begin(), delays.end());
-
-    // ===================================================================== //
-    
-    std::ofstream out(m_CSVfileName, std::ios::app);
-
-    out << (Simulator::Now()).GetSeconds() << "," << kbs << "," << packetsReceived << ","
-        << average_e2e << "," << pdr << ","
-        << m_nSinks << "," << m_protocolName << "," << m_txp << "" << std::endl;
-
-    out.close();
+    m_delays.CloseWindow(Simulator::Now().GetSeconds(), m_windowLength, kbs, packetsReceived, packetsSent, m_metrics,
+                         m_flowMetrics);
+    m_runReceived += packetsReceived;
+    m_runSent += packetsSent;
+    m_inFlight.Expire(Simulator::Now().GetSeconds());
     packetsReceived = 0;
     packetsSent = 0;
-    Simulator::Schedule(Seconds(1.0), &RoutingExperiment::CheckThroughput, this);
+    Simulator::Schedule(Seconds(m_windowLength), &RoutingExperiment::CheckThroughput, this);
+}
+
+// totals of the whole run, in the order of SWEEP_RESULT_COLUMNS
+void
+RoutingExperiment::GetSummary(double* results) const
+{
+    results[0] = m_runSent;
+    results[1] = m_runReceived;
+    results[2] = static_cast<double>(m_runReceived) / m_runSent;
+    results[3] = m_delays.GetRunDelay().GetMean();
+    results[4] = m_delays.GetRunHistogram().GetPercentile(50);
+    results[5] = m_delays.GetRunHistogram().GetPercentile(95);
+    results[6] = m_delays.GetRunHistogram().GetPercentile(99);
 }
 
 Ptr<Socket>
@@ -150,18 +271,181 @@ RoutingExperiment::SetupPacketReceive(Ipv4Address addr, Ptr<Node> node)
     return sink;
 }
 
-static void
-Tx( std::string c, 
-    Ptr<const Packet> packet
-  ){
-  packetsSent+=1;
-  SeqTsHeader hdr;
-  starttime = hdr.GetTs().GetSeconds();
+void
+RoutingExperiment::PacketSent(RoutingExperiment* experiment,
+                              uint64_t flow,
+                              Ptr<const Packet> packet,
+                              const Address& from,
+                              const Address& to,
+                              const SeqTsSizeHeader& header)
+{
+    PROFILE_SCOPE("RoutingExperiment::PacketSent");
+    packetsSent += 1;
+    experiment->m_inFlight.Sent(flow, header.GetSeq(), Simulator::Now().GetSeconds());
 }
 
 void
 RoutingExperiment::CommandSetup(int argc, char** argv)
 {
+    CommandLine cmd(__FILE__);
+    cmd.AddValue("binaryTrace", "Mobility trace compiled by compile_trace, used instead of cardiff.tcl",
+                 m_binaryTraceFile);
+    cmd.AddValue("fcdTrace", "sumo fcd output (sumoTrace.xml) to stream in, skipping the ns-2 conversion",
+                 m_fcdTraceFile);
+    cmd.AddValue("vehicles", "Number of vehicles, 0 for one per vehicle of the mobility trace", m_nVehicles);
+    cmd.AddValue("setupReport", "Print the time and memory per vehicle of each setup phase", m_setupReport);
+    cmd.AddValue("cullRange", "Distance (m) past which receivers are culled without evaluating the loss models, "
+                 "0 to disable", m_cullRange);
+    cmd.AddValue("weatherField", "File of rain and snow cells, one 'x y radius start end attenuationDb' per line",
+                 m_weatherFieldFile);
+    cmd.AddValue("buildings", "Sumo polygon file (e.g. osm.poly.xml.gz) whose building footprints attenuate the links",
+                 m_buildingsFile);
+    cmd.AddValue("buildingsNet", "Net the mobility trace was made on, to align the footprints with", m_buildingsNetFile);
+    cmd.AddValue("wallLoss", "Loss (dB) of each footprint wall a link crosses", m_wallLoss);
+    cmd.AddValue("pathLossRaster", "Path loss raster written by build_raster, read in place of the buildings models",
+                 m_pathLossRasterFile);
+    cmd.AddValue("decorrelationDistance", "Distance (m) over which the shadowing decorrelates", m_decorrelationDistance);
+    cmd.AddValue("buildingBoxes", "Footprints as bounding box buildings of the hybrid model, not walls", m_buildingBoxes);
+    cmd.AddValue("CSVfileName", "Windowed metrics csv; the per flow csv goes next to it", m_CSVfileName);
+    cmd.AddValue("packetTrace", "Binary trace of every received packet, read with decode_packets; empty for none",
+                 m_packetTraceFile);
+    cmd.AddValue("window", "Length (s) of the windows the metrics are reported over", m_windowLength);
+    cmd.AddValue("protocol", "Routing protocol: AODV, OLSR, DSDV or DSR", m_protocolName);
+    cmd.AddValue("sinks", "Number of sink nodes, each with its own sender", m_nSinks);
+    cmd.AddValue("txp", "Transmission power (dBm)", m_txp);
+    cmd.AddValue("sweepConfig", "Parameter grid to run, one 'option = value, value, ...' per line", m_sweepConfigFile);
+    cmd.AddValue("sweepJobs", "Sweep runs at once", m_sweepJobs);
+    cmd.AddValue("sweepOutputDir", "Directory for the files of every sweep run and results.csv", m_sweepOutputDir);
+    cmd.AddValue("memoryInterval", "Sample the memory held per node every this many seconds, into the .memory.csv "
+                 "next to the csv; 0 for none", m_memoryInterval);
+    cmd.AddValue("probeLinks", "Comma separated tx-rx vehicle pairs, e.g. 0-1,5-7, whose frames are logged with their "
+                 "signal, noise and distance into the .links.csv next to the csv", m_probeLinks);
+    cmd.AddValue("profile", "Time every event and trace sink, print progress and a profile to stderr", m_profile);
+    cmd.AddValue("forkAt", "Warm start the sweep: simulate up to this time (s, before traffic starts at 100 s) once, "
+                 "then fork every point off it", m_forkAt);
+    cmd.Parse(argc, argv);
+}
+
+bool
+RoutingExperiment::IsSweep() const
+{
+    return !m_sweepConfigFile.empty();
+}
+
+static const std::vector<std::string> SWEEP_RESULT_COLUMNS{"PacketsSent",
+                                                           "PacketsReceived",
+                                                           "PacketDeliveryRatio",
+                                                           "MeanDelay",
+                                                           "DelayP50",
+                                                           "DelayP95",
+                                                           "DelayP99"};
+
+bool
+RoutingExperiment::RunSweep(int argc, char** argv)
+{
+    SweepConfig config;
+    NS_ABORT_MSG_IF(!config.Load(m_sweepConfigFile), "could not load " << m_sweepConfigFile);
+    if (mkdir(m_sweepOutputDir.c_str(), 0755) != 0 && errno != EEXIST)
+    {
+        NS_FATAL_ERROR("could not create " << m_sweepOutputDir);
+    }
+    // every run starts from the command line minus the sweep options, then the options of its point
+    std::vector<std::string> baseArgs;
+    for (int i = 0; i < argc; i++)
+    {
+        if (i == 0 || std::string(argv[i]).rfind("--sweep", 0) != 0)
+        {
+            baseArgs.emplace_back(argv[i]);
+        }
+    }
+
+    // loaded once here, every run gets a copy on write view of them. cardiff.tcl is left to Ns2MobilityHelper
+    // in every run, like a single run, as the binary trace drives different mobility models
+    if (!m_binaryTraceFile.empty())
+    {
+        m_binaryTrace = CreateObject<Ns2BinaryTrace>();
+        NS_ABORT_MSG_IF(!m_binaryTrace->Load(m_binaryTraceFile), "could not load " << m_binaryTraceFile);
+    }
+    if (!m_weatherFieldFile.empty())
+    {
+        m_weatherField = CreateObject<WeatherField>();
+        NS_ABORT_MSG_IF(!m_weatherField->Load(m_weatherFieldFile), "could not load " << m_weatherFieldFile);
+    }
+    if (!m_buildingsFile.empty())
+    {
+        m_buildings = CreateObject<OsmBuildings>();
+        NS_ABORT_MSG_IF(!m_buildings->Load(m_buildingsFile, m_buildingsNetFile), "could not load " << m_buildingsFile);
+    }
+    if (!m_pathLossRasterFile.empty())
+    {
+        m_pathLossRaster = CreateObject<PathLossRaster>();
+        NS_ABORT_MSG_IF(!m_pathLossRaster->Load(m_pathLossRasterFile), "could not load " << m_pathLossRasterFile);
+    }
+    std::string resultsFile = m_sweepOutputDir + "/results.csv";
+
+    if (m_forkAt > 0)
+    {
+        // one warm up for every point, forked off before anything they change has happened; the neighbours and
+        // routes of the warm up depend on the tx power, so it stays that of the warm up
+        NS_ABORT_MSG_IF(m_forkAt >= 100, "the warm start must fork before traffic starts at 100 s");
+        // the forks would share the one read offset of the streamed file
+        NS_ABORT_MSG_IF(!m_fcdTraceFile.empty(), "the warm start needs --binaryTrace or cardiff.tcl, not --fcdTrace");
+        m_variants = std::make_unique<SweepRunner>(config.Expand(), SWEEP_RESULT_COLUMNS);
+        for (const auto& [name, value]: m_variants->GetPoint(0))
+        {
+            NS_ABORT_MSG_IF(name != "sinks" && name != "window",
+                            name << " cannot change after a warm start, only sinks and window");
+        }
+        Run();
+        if (m_variant != SweepRunner::NO_POINT)
+        {
+            return true;
+        }
+        NS_ABORT_MSG_IF(!m_variants->WriteResults(resultsFile), "could not write " << resultsFile);
+        return m_variants->AllSucceeded();
+    }
+
+    SweepRunner runner(config.Expand(), SWEEP_RESULT_COLUMNS);
+    bool ok = runner.Run(m_sweepJobs, [&](const SweepPoint& point, double* results) {
+        std::vector<std::string> args = baseArgs;
+        for (const auto& [name, value]: point)
+        {
+            args.push_back("--" + name + "=" + value);
+        }
+        args.push_back("--CSVfileName=" + m_sweepOutputDir + "/" + SweepRunner::GetKey(point) + ".csv");
+        args.push_back("--packetTrace=");
+        args.push_back("--setupReport=0");
+        std::vector<char*> runArgv;
+        for (std::string& arg: args)
+        {
+            runArgv.push_back(arg.data());
+        }
+        runArgv.push_back(nullptr);
+
+        RoutingExperiment run;
+        run.CommandSetup(args.size(), runArgv.data());
+        // unless the point itself changes the file
+        if (run.m_binaryTraceFile == m_binaryTraceFile)
+        {
+            run.m_binaryTrace = m_binaryTrace;
+        }
+        if (run.m_weatherFieldFile == m_weatherFieldFile)
+        {
+            run.m_weatherField = m_weatherField;
+        }
+        if (run.m_buildingsFile == m_buildingsFile && run.m_buildingsNetFile == m_buildingsNetFile)
+        {
+            run.m_buildings = m_buildings;
+        }
+        if (run.m_pathLossRasterFile == m_pathLossRasterFile)
+        {
+            run.m_pathLossRaster = m_pathLossRaster;
+        }
+        run.Run();
+        run.GetSummary(results);
+    });
+    NS_ABORT_MSG_IF(!runner.WriteResults(resultsFile), "could not write " << resultsFile);
+    return ok;
 }
 
 int
@@ -169,6 +453,10 @@ main(int argc, char* argv[])
 {
     RoutingExperiment experiment;
     experiment.CommandSetup(argc, argv);
+    if (experiment.IsSweep())
+    {
+        return experiment.RunSweep(argc, argv) ? 0 : 1;
+    }
     experiment.Run();
     return 0;
 }
@@ -176,20 +464,37 @@ main(int argc, char* argv[])
 void
 RoutingExperiment::Run()
 {
+    if (m_profile)
+    {
+        Profiler::Enable();
+    }
     Packet::EnablePrinting();
-    std::ofstream out{m_CSVfileName + "output.csv"};
-    out << "SimulationSecond,"
-        << "ReceiveRate,"
-        << "PacketsReceived,"
-        << "Average End to End,"
-        << "Package Delivery Ratio,"
-        << "NumberOfSinks,"
-        << "RoutingProtocol,"
-        << "TransmissionPower" << std::endl;
-    out.close();
+    if (!m_variants)
+    {
+        OpenOutputs();
+    }
 
     // Setup
-    std::uint8_t nVehicles = 450; // there will be an integer overflow as 450 > 2^8
+    if (!m_binaryTrace && !m_binaryTraceFile.empty())
+    {
+        m_binaryTrace = CreateObject<Ns2BinaryTrace>();
+        NS_ABORT_MSG_IF(!m_binaryTrace->Load(m_binaryTraceFile), "could not load " << m_binaryTraceFile);
+    }
+    // one node per vehicle of the trace
+    uint32_t nVehicles = m_nVehicles > 0 ? m_nVehicles : CountTraceVehicles();
+    NS_ABORT_MSG_IF(nVehicles == 0, "could not count the vehicles of the mobility trace, give --vehicles");
+    if (m_nVehicles > 0 && !m_fcdTraceFile.empty())
+    {
+        // the fcd reader gives every vehicle id its own node of the pool and creates none on the fly
+        uint32_t nTraceVehicles = SumoFcdReader::CountVehicles(m_fcdTraceFile);
+        NS_ABORT_MSG_IF(m_nVehicles < nTraceVehicles,
+                        "--vehicles=" << m_nVehicles << " is below the " << nTraceVehicles << " vehicles of "
+                                      << m_fcdTraceFile);
+    }
+    NS_ABORT_MSG_IF(nVehicles < 2 * static_cast<uint32_t>(m_nSinks),
+                    nVehicles << " vehicles cannot hold " << m_nSinks << " sinks and their senders");
+    SetupReport setup{nVehicles};
+    setup.Mark("trace scan");
     double TotalTime = 3615.0;
     std::string rate("2048bps");
     std::string phyMode("DsssRate11Mbps");
@@ -209,6 +514,7 @@ RoutingExperiment::Run()
 
     NodeContainer adhocNodes;
     adhocNodes = vehicles;         // shallow copy
+    setup.Mark("nodes");
 
     // -------------------------------------------------------------------------------------- //
 
@@ -217,15 +523,57 @@ RoutingExperiment::Run()
     // Physical Layer
     YansWifiChannelHelper channel = YansWifiChannelHelper::Default();
     channel.SetPropagationDelay("ns3::ConstantSpeedPropagationDelayModel");
-    channel.AddPropagationLoss("ns3::HybridBuildingsPropagationLossModel",
-                                    "CitySize", StringValue("Small"),
-                                    "ShadowSigmaOutdoor", DoubleValue (10.0),
-                                    "ShadowSigmaExtWalls", DoubleValue (10.0),
-                                    "InternalWallLoss", DoubleValue (10.0),
-                                    "Environment", StringValue("Urban")
-                              );
+    // shadowing from a correlated map: a table of one draw per pair of vehicles would grow as n^2
+    Config::SetDefault("ns3::ShadowingMap::DecorrelationDistance", DoubleValue(m_decorrelationDistance));
+    if (!m_pathLossRaster && !m_pathLossRasterFile.empty())
+    {
+        m_pathLossRaster = CreateObject<PathLossRaster>();
+        NS_ABORT_MSG_IF(!m_pathLossRaster->Load(m_pathLossRasterFile), "could not load " << m_pathLossRasterFile);
+    }
+    if (m_pathLossRaster)
+    {
+        // the raster holds the buildings, with the outdoor shadowing of the hybrid model on top
+        NS_ABORT_MSG_IF(!m_buildingsFile.empty(), "the buildings are already in the path loss raster");
+        channel.AddPropagationLoss("ns3::RasterPropagationLossModel",
+                                   "Raster", PointerValue(m_pathLossRaster),
+                                   "ShadowSigma", DoubleValue(10.0));
+    }
+    else
+    {
+        channel.AddPropagationLoss("ns3::CorrelatedHybridBuildingsPropagationLossModel",
+                                        "CitySize", StringValue("Small"),
+                                        "ShadowSigmaOutdoor", DoubleValue (10.0),
+                                        "ShadowSigmaExtWalls", DoubleValue (10.0),
+                                        "InternalWallLoss", DoubleValue (10.0),
+                                        "Environment", StringValue("Urban")
+                                  );
+    }
+    if (!m_weatherField && !m_weatherFieldFile.empty())
+    {
+        m_weatherField = CreateObject<WeatherField>();
+        NS_ABORT_MSG_IF(!m_weatherField->Load(m_weatherFieldFile), "could not load " << m_weatherFieldFile);
+    }
+    if (m_weatherField)
+    {
+        channel.AddPropagationLoss("ns3::WeatherFieldPropagationLossModel", "Field", PointerValue(m_weatherField));
+    }
+    if (!m_buildings && !m_buildingsFile.empty())
+    {
+        m_buildings = CreateObject<OsmBuildings>();
+        NS_ABORT_MSG_IF(!m_buildings->Load(m_buildingsFile, m_buildingsNetFile), "could not load " << m_buildingsFile);
+    }
+    // the bounding boxes bring the hybrid model's own external wall loss, which would count the walls twice
+    if (m_buildings && !m_buildingBoxes)
+    {
+        channel.AddPropagationLoss("ns3::BuildingWallsPropagationLossModel",
+                                   "Buildings", PointerValue(m_buildings),
+                                   "WallLoss", DoubleValue(m_wallLoss));
+    }
     YansWifiPhyHelper phy;
-    phy.SetChannel(channel.Create());
+    Ptr<YansWifiChannel> wifiChannel = channel.Create();
+    phy.SetChannel(wifiChannel);
+    phy.Set("TxPowerStart", DoubleValue(m_txp));
+    phy.Set("TxPowerEnd", DoubleValue(m_txp));
     // MAC layer
     WifiMacHelper wifiMac;
     // wifi channel
@@ -239,79 +587,327 @@ RoutingExperiment::Run()
     wifiMac.SetType("ns3::AdhocWifiMac");
     // Devices
     NetDeviceContainer adhocDevices = wifi.Install(phy, wifiMac, vehicles);
+    setup.Mark("wifi devices");
 
     // -------------------------------------------------------------------------------------- //
 
     // mobility
-    std::string mobility_file_name{"./scratch/cardiff.tcl"};          // note this is a relative path from where ns3 is
-                                                                      // stored
-    Ns2MobilityHelper ns2 = Ns2MobilityHelper(mobility_file_name);
-    ns2.Install();
+    std::string mobility_file_name{CARDIFF_TRACE};
+    if (!m_fcdTraceFile.empty())
+    {
+        // vehicles take the nodes in the order their ids first appear in the fcd output
+        Ptr<SumoFcdReader> fcd = CreateObject<SumoFcdReader>();
+        NS_ABORT_MSG_IF(!fcd->Open(m_fcdTraceFile), "could not open " << m_fcdTraceFile);
+        fcd->SetNodePool(vehicles);
+        fcd->Start();
+    }
+    else if (!m_binaryTrace)
+    {
+        Ns2MobilityHelper ns2 = Ns2MobilityHelper(mobility_file_name);
+        ns2.Install();
+    }
+    else
+    {
+        // same trace, precompiled: mapped instead of parsed, and each vehicle only schedules its next
+        // waypoint
+        Ns2BinaryTraceHelper binaryTrace{m_binaryTrace};
+        binaryTrace.InstallLazy();
+    }
+
+    if (m_cullRange > 0)
+    {
+        // the range cannot be solved from the shadowed hybrid model, so it is given
+        Ptr<GridCullingPropagationLossModel> grid = CreateObject<GridCullingPropagationLossModel>();
+        grid->SetAttribute("MaxRange", DoubleValue(m_cullRange));
+        grid->InstallOn(wifiChannel);
+        grid->AddNodes(vehicles);
+    }
+    setup.Mark("mobility");
     
     // -------------------------------------------------------------------------------------- //
 
     // Buildings
-    double x_min = 0.5;
-    double x_max = 1.5;
-    double y_min = -0.5;
-    double y_max = 0.5;
-    double z_min = 0.0;
-    double z_max = 10.0;
-    Ptr<Building> b = CreateObject<Building>();
-    b->SetBoundaries(Box(x_min, x_max, y_min, y_max, z_min, z_max));
-    b->SetBuildingType(Building::Residential);
-    b->SetExtWallsType(Building::StoneBlocks);
+    if (m_buildings)
+    {
+        // the hybrid model scans every building at each position change, so only on request
+        if (m_buildingBoxes)
+        {
+            m_buildings->CreateBuildings();
+        }
+    }
+    else
+    {
+        double x_min = 0.5;
+        double x_max = 1.5;
+        double y_min = -0.5;
+        double y_max = 0.5;
+        double z_min = 0.0;
+        double z_max = 10.0;
+        Ptr<Building> b = CreateObject<Building>();
+        b->SetBoundaries(Box(x_min, x_max, y_min, y_max, z_min, z_max));
+        b->SetBuildingType(Building::Residential);
+        b->SetExtWallsType(Building::StoneBlocks);
+    }
     BuildingsHelper::Install(vehicles);
+    setup.Mark("buildings");
 
     // ===================================================================== //
     
     // Routing in adhoc + internet stack + ipv4
     AodvHelper aodv;
+    OlsrHelper olsr;
+    DsdvHelper dsdv;
+    DsrHelper dsr;
+    DsrMainHelper dsrMain;
     Ipv4ListRoutingHelper list;
     InternetStackHelper internet;
 
-    list.Add(aodv, 100);
-    internet.SetRoutingHelper(list);
-    internet.Install(adhocNodes);
+    if (m_protocolName == "AODV")
+    {
+        list.Add(aodv, 100);
+    }
+    else if (m_protocolName == "OLSR")
+    {
+        list.Add(olsr, 100);
+    }
+    else if (m_protocolName == "DSDV")
+    {
+        list.Add(dsdv, 100);
+    }
+    else if (m_protocolName != "DSR")
+    {
+        NS_FATAL_ERROR("No such protocol:" << m_protocolName);
+    }
+
+    if (m_protocolName == "DSR")
+    {
+        internet.Install(adhocNodes);
+        dsrMain.Install(dsr, adhocNodes);
+    }
+    else
+    {
+        internet.SetRoutingHelper(list);
+        internet.Install(adhocNodes);
+    }
+    setup.Mark("internet stack");
 
     // -------------------------------------------------------------------------------------- //
     
-    // ip address + masking
+    // ip address + masking: a /8, room for 16 million vehicles
     Ipv4AddressHelper addressAdhoc;
-    addressAdhoc.SetBase("10.1.1.0", "255.255.255.0");
+    addressAdhoc.SetBase("10.0.0.0", "255.0.0.0");
     Ipv4InterfaceContainer adhocInterfaces;
     adhocInterfaces = addressAdhoc.Assign(adhocDevices);
+    for (uint32_t i = 0; i < adhocInterfaces.GetN(); i++)
+    {
+        m_nodeOfAddress[adhocInterfaces.GetAddress(i).Get()] = adhocNodes.Get(i)->GetId();
+    }
+
+    m_adhocNodes = adhocNodes;
+    m_adhocInterfaces = adhocInterfaces;
+    setup.Mark("addresses");
+    std::istringstream links(m_probeLinks);
+    for (std::string link; std::getline(links, link, ',');)
+    {
+        uint32_t tx;
+        uint32_t rx;
+        char dash;
+        std::istringstream pair(link);
+        NS_ABORT_MSG_IF(!(pair >> tx >> dash >> rx) || dash != '-' || tx >= nVehicles || rx >= nVehicles,
+                        "bad link " << link << ", give tx-rx vehicle indices");
+        m_linkProbe.AddLink(adhocNodes.Get(tx), adhocNodes.Get(rx));
+    }
+    if (m_setupReport)
+    {
+        setup.Print(std::cout);
+    }
+
+    // ===================================================================== //
+    
+    NS_LOG_INFO("Run Simulation.");
+    if (m_memoryInterval > 0)
+    {
+        m_memory.AddProbe("flows", [this]() { return m_delays.GetNFlows(); }, WindowedDelays::GetFlowBytes());
+        m_memory.AddProbe("node of address", [this]() { return m_nodeOfAddress.size(); },
+                          sizeof(decltype(m_nodeOfAddress)::value_type));
+        m_memory.AddProbe("in flight table slots", [this]() { return m_inFlight.GetCapacity(); },
+                          InFlightTable::GetSlotBytes());
+        m_memory.Start(Seconds(m_memoryInterval));
+    }
+    if (m_variants)
+    {
+        Simulator::Schedule(Seconds(m_forkAt), &RoutingExperiment::ForkVariants, this, TotalTime);
+    }
+    else
+    {
+        InstallTraffic(TotalTime);
+        CheckThroughput();
+    }
+    Simulator::Stop(Seconds(1000));
+    Simulator::Run();
+    if (m_variants && m_variant == SweepRunner::NO_POINT)
+    {
+        // the warm up only forks the points
+        m_memory.Close();
+        Simulator::Destroy();
+        return;
+    }
+    // the open window is not written, only counted in the totals, with one row per flow over the whole run
+    m_delays.CloseRun(Simulator::Now().GetSeconds(), m_flowMetrics);
+    m_runReceived += packetsReceived;
+    m_runSent += packetsSent;
+    m_metrics.Close();
+    m_flowMetrics.Close();
+    m_packetTrace.Close();
+    m_linkProbe.Close();
+    std::cout << m_runSent << " packets sent, " << m_runReceived << " received, " << m_inFlight.GetLost()
+              << " given up as lost, " << m_inFlight.GetUnmatched() << " duplicate or late\n";
+    if (m_memoryInterval > 0)
+    {
+        m_memory.Sample();
+        m_memory.Close();
+        m_memory.Print(std::cout);
+    }
+    if (m_variants)
+    {
+        double results[SweepRunner::MAX_RESULTS];
+        GetSummary(results);
+        m_variants->SetResults(m_variant, results);
+    }
+    Profiler::WriteRunStats();
+    Simulator::Destroy();
+}
+
+uint32_t
+RoutingExperiment::CountTraceVehicles() const
+{
+    if (m_binaryTrace)
+    {
+        return m_binaryTrace->GetNNodes();
+    }
+    if (!m_fcdTraceFile.empty())
+    {
+        // one pass over the file ahead of the streaming one, so that every vehicle has its devices
+        return SumoFcdReader::CountVehicles(m_fcdTraceFile);
+    }
+    return Ns2BinaryTraceCompiler::CountNodes(CARDIFF_TRACE);
+}
+
+void
+RoutingExperiment::OpenOutputs()
+{
+    // blank out the last output file and write the column headers; the windows are written from a background
+    // thread as they close
+    std::ostringstream txp;
+    txp << m_txp;
+    m_metrics.SetConstant("NumberOfSinks", std::to_string(m_nSinks));
+    m_metrics.SetConstant("RoutingProtocol", m_protocolName);
+    m_metrics.SetConstant("TransmissionPower", txp.str());
+    NS_ABORT_MSG_IF(!m_metrics.Open(m_CSVfileName,
+                                    {"SimulationSecond",
+                                     "ReceiveRate",
+                                     "PacketsReceived",
+                                     "Average End to End",
+                                     "Package Delivery Ratio",
+                                     "NumberOfSinks",
+                                     "RoutingProtocol",
+                                     "TransmissionPower",
+                                     "DelayStdDev",
+                                     "DelayMin",
+                                     "DelayMax",
+                                     "DelayP50",
+                                     "DelayP95",
+                                     "DelayP99",
+                                     "PacketsSent"}),
+                    "could not open " << m_CSVfileName);
+    // per flow delays next to it, sanet.output.csv -> sanet.output.flows.csv
+    std::string flowsFileName = m_CSVfileName.substr(0, m_CSVfileName.rfind(".csv")) + ".flows.csv";
+    NS_ABORT_MSG_IF(!m_flowMetrics.Open(flowsFileName,
+                                        {"WindowStart",
+                                         "WindowEnd",
+                                         "SourceNode",
+                                         "SinkNode",
+                                         "PacketsReceived",
+                                         "DelayP50",
+                                         "DelayP95",
+                                         "DelayP99",
+                                         "DelayMax"}),
+                    "could not open " << flowsFileName);
+    if (!m_probeLinks.empty())
+    {
+        std::string linksFileName = m_CSVfileName.substr(0, m_CSVfileName.rfind(".csv")) + ".links.csv";
+        NS_ABORT_MSG_IF(!m_linkProbe.Open(linksFileName), "could not open " << linksFileName);
+    }
+    if (m_memoryInterval > 0)
+    {
+        std::string memoryFileName = m_CSVfileName.substr(0, m_CSVfileName.rfind(".csv")) + ".memory.csv";
+        NS_ABORT_MSG_IF(!m_memory.Open(memoryFileName), "could not open " << memoryFileName);
+    }
+    if (!m_packetTraceFile.empty())
+    {
+        NS_ABORT_MSG_IF(!m_packetTrace.Open(m_packetTraceFile), "could not open " << m_packetTraceFile);
+    }
+}
 
+// one sender per sink, sink i on node i and its sender on node i + m_nSinks
+void
+RoutingExperiment::InstallTraffic(double totalTime)
+{
     OnOffHelper onoff1("ns3::UdpSocketFactory", Address());
     onoff1.SetAttribute("OnTime", StringValue("ns3::ConstantRandomVariable[Constant=1.0]"));
     onoff1.SetAttribute("OffTime", StringValue("ns3::ConstantRandomVariable[Constant=0.0]"));
+    // sequence number and send time in every packet, for ReceivePacket to find it in m_inFlight
+    onoff1.SetAttribute("EnableSeqTsSizeHeader", BooleanValue(true));
 
     for (int i = 0; i < m_nSinks; i++)
     {
       // setting up source and sinks
-        Ptr<Socket> sink = SetupPacketReceive(adhocInterfaces.GetAddress(i), adhocNodes.Get(i));
+        Ptr<Socket> sink = SetupPacketReceive(m_adhocInterfaces.GetAddress(i), m_adhocNodes.Get(i));
 
-        AddressValue remoteAddress(InetSocketAddress(adhocInterfaces.GetAddress(i), port));
+        AddressValue remoteAddress(InetSocketAddress(m_adhocInterfaces.GetAddress(i), port));
         onoff1.SetAttribute("Remote", remoteAddress); // remote address is the destination
 
         Ptr<UniformRandomVariable> var = CreateObject<UniformRandomVariable>(); // random number
-        ApplicationContainer temp = onoff1.Install(adhocNodes.Get(i + m_nSinks)); // install a onoff sender at i +
-                                                                                  // m_nSinks, who send it to node i
-        std::ostringstream oss;
-        oss << "/NodeList/" << adhocNodes.Get(i + m_nSinks)->GetId()
-            << "/ApplicationList/0/$ns3::OnOffApplication/Tx";
-        Config::Connect(oss.str(), MakeCallback(&Tx));
-
-        temp.Start(Seconds(var->GetValue(100.0, 101.0)));
-        temp.Stop(Seconds(TotalTime));
+        ApplicationContainer temp = onoff1.Install(m_adhocNodes.Get(i + m_nSinks)); // install a onoff sender at i +
+                                                                                    // m_nSinks, who send it to node i
+        uint64_t flow = static_cast<uint64_t>(m_adhocNodes.Get(i + m_nSinks)->GetId()) << 32 |
+                        m_adhocNodes.Get(i)->GetId();
+        temp.Get(0)->TraceConnectWithoutContext("TxWithSeqTsSize",
+                                                MakeBoundCallback(&RoutingExperiment::PacketSent, this, flow));
+
+        // start and stop are relative to now, which is after the warm up when forked
+        temp.Start(Seconds(var->GetValue(100.0, 101.0)) - Simulator::Now());
+        temp.Stop(Seconds(totalTime) - Simulator::Now());
         
     }
+}
 
-    // ===================================================================== //
-    
-    NS_LOG_INFO("Run Simulation.");
+// runs at m_forkAt in the warm up; each fork continues as one point of the sweep
+void
+RoutingExperiment::ForkVariants(double totalTime)
+{
+    m_variant = m_variants->Fork(m_sweepJobs);
+    if (m_variant == SweepRunner::NO_POINT)
+    {
+        Simulator::Stop();
+        return;
+    }
+    const SweepPoint& point = m_variants->GetPoint(m_variant);
+    for (const auto& [name, value]: point)
+    {
+        if (name == "sinks")
+        {
+            m_nSinks = std::stoi(value);
+        }
+        else if (name == "window")
+        {
+            m_windowLength = std::stod(value);
+        }
+    }
+    m_CSVfileName = m_sweepOutputDir + "/" + SweepRunner::GetKey(point) + ".csv";
+    m_packetTraceFile.clear();
+
+    OpenOutputs();
+    InstallTraffic(totalTime);
     CheckThroughput();
-    Simulator::Stop(Seconds(1000));
-    Simulator::Run();
-    Simulator::Destroy();
 }
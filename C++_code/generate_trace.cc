@@ -0,0 +1,107 @@
+/*
+ *  Writes a synthetic ns-2 mobility trace, in the format of cardiff.tcl, for as many vehicles as needed to
+ *  find out how far final_vanet scales before trying it on a real sumo export. Vehicles drive a square
+ *  Manhattan grid of streets: each starts at a random intersection and keeps driving to a random
+ *  neighbouring one at a random speed until the end of the trace.
+ *
+ *  To run, write:
+ *
+ *  "./ns3 run "scratch/generate_trace --vehicles=10000 --output=./scratch/grid10k.tcl --compiled=./scratch/grid10k.wpt""
+ *
+ *  and then "./ns3 run "scratch/final_vanet --binaryTrace=./scratch/grid10k.wpt"". final_vanet takes its
+ *  number of vehicles from the trace. The same seed always gives the same trace.
+ */
+
+#include "ns3/core-module.h"
+
+#include "./kaka/ns2binarytrace.hpp"
+
+#include <cstdio>
+#include <iostream>
+#include <random>
+
+using namespace ns3;
+
+int
+main(int argc, char* argv[])
+{
+    uint32_t nVehicles = 10000;
+    double duration = 3615.0;
+    uint32_t gridBlocks = 20;
+    double blockLength = 200.0;
+    double minSpeed = 5.0;
+    double maxSpeed = 15.0;
+    uint32_t seed = 1;
+    std::string output{"./scratch/grid.tcl"};
+    std::string compiled;
+
+    CommandLine cmd(__FILE__);
+    cmd.AddValue("vehicles", "Number of vehicles", nVehicles);
+    cmd.AddValue("duration", "Length of the trace (s)", duration);
+    cmd.AddValue("gridBlocks", "Blocks along each side of the grid", gridBlocks);
+    cmd.AddValue("blockLength", "Length of a block (m)", blockLength);
+    cmd.AddValue("minSpeed", "Lowest speed (m/s)", minSpeed);
+    cmd.AddValue("maxSpeed", "Highest speed (m/s)", maxSpeed);
+    cmd.AddValue("seed", "Random seed", seed);
+    cmd.AddValue("output", "ns-2 mobility trace to write", output);
+    cmd.AddValue("compiled", "Binary waypoint file to compile the trace into as well, if set", compiled);
+    cmd.Parse(argc, argv);
+
+    NS_ABORT_MSG_IF(gridBlocks == 0 || minSpeed <= 0 || maxSpeed < minSpeed, "invalid grid or speeds");
+    std::FILE* out = std::fopen(output.c_str(), "w");
+    NS_ABORT_MSG_IF(!out, "could not write " << output);
+
+    std::mt19937 generator{seed};
+    std::uniform_int_distribution<uint32_t> intersection{0, gridBlocks};
+    std::uniform_int_distribution<int> direction{0, 3};
+    std::uniform_real_distribution<double> speed{minSpeed, maxSpeed};
+    uint64_t nMoves = 0;
+    for (uint32_t node = 0; node < nVehicles; node++)
+    {
+        uint32_t i = intersection(generator);
+        uint32_t j = intersection(generator);
+        std::fprintf(out, "$node_(%u) set X_ %.2f\n", node, i * blockLength);
+        std::fprintf(out, "$node_(%u) set Y_ %.2f\n", node, j * blockLength);
+        std::fprintf(out, "$node_(%u) set Z_ 0.0\n", node);
+        double time = 0.0;
+        while (time < duration)
+        {
+            // a step off the grid turns back instead
+            int d = direction(generator);
+            if (d == 0)
+            {
+                i = i < gridBlocks ? i + 1 : i - 1;
+            }
+            else if (d == 1)
+            {
+                i = i > 0 ? i - 1 : i + 1;
+            }
+            else if (d == 2)
+            {
+                j = j < gridBlocks ? j + 1 : j - 1;
+            }
+            else
+            {
+                j = j > 0 ? j - 1 : j + 1;
+            }
+            double v = speed(generator);
+            std::fprintf(out, "$ns_ at %.2f \"$node_(%u) setdest %.2f %.2f %.2f\"\n", time, node, i * blockLength,
+                         j * blockLength, v);
+            time += blockLength / v;
+            nMoves++;
+        }
+    }
+    NS_ABORT_MSG_IF(std::fclose(out) != 0, "could not write " << output);
+    std::cout << output << ": " << nVehicles << " vehicles, " << nMoves << " moves\n";
+
+    if (!compiled.empty())
+    {
+        Ns2BinaryTraceCompiler compiler;
+        if (!compiler.Parse(output) || !compiler.Write(compiled))
+        {
+            NS_FATAL_ERROR("could not compile " << output << " into " << compiled);
+        }
+        std::cout << output << " -> " << compiled << ": " << compiler.GetNRecords() << " waypoints\n";
+    }
+    return 0;
+}
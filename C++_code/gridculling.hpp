@@ -0,0 +1,340 @@
+#ifndef GRIDCULLING_HPP
+#define GRIDCULLING_HPP
+
+#include "ns3/abort.h"
+#include "ns3/double.h"
+#include "ns3/mobility-model.h"
+#include "ns3/node.h"
+#include "ns3/node-container.h"
+#include "ns3/nstime.h"
+#include "ns3/pointer.h"
+#include "ns3/propagation-loss-model.h"
+#include "ns3/simulator.h"
+#include "ns3/uinteger.h"
+#include "ns3/yans-wifi-channel.h"
+
+#include "weatheredfriis.hpp"
+#include "profiler.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+using namespace ns3;
+
+// Loss model shortcut: a decorator that skips the inner model for receivers that cannot hear the
+// transmission. It saves the cost of the inner model, not the per receiver work of the channel.
+//
+// Every registered node is binned into a uniform grid of CellSize x CellSize cells, rebinned at each
+// of its course changes and every RefreshInterval in between. A receiver whose cell is further from
+// the sender's cell than the maximum range (plus the distance both can have moved since they were
+// binned) gets a rx power far below any sensitivity and the inner model is not evaluated at all; the
+// others are passed through unchanged. The maximum range is MaxRange when set, otherwise it is solved
+// from the tx power, RxSensitivity and the current weather of an inner WeatheredFriis model.
+//
+// YansWifiChannel::Send is not virtual, so the channel still asks for the rx power of every node and
+// still schedules a receive event for each; a culled one is dropped by YansWifiChannel::Receive as too
+// weak, before it reaches the phy. Per frame work therefore still grows with the total node count, and
+// the shortcut only pays off when the inner model costs more than the two grid lookups, e.g. the
+// buildings models; in front of the Friis fast path, or when every node is in range, it is overhead.
+// The nodes are looked up by node id, so the mobility models must be aggregated to their nodes.
+class GridCullingPropagationLossModel: public PropagationLossModel{
+  public:
+    static TypeId GetTypeId(void);
+    GridCullingPropagationLossModel() = default;
+
+    GridCullingPropagationLossModel(const GridCullingPropagationLossModel& src) = delete;
+    GridCullingPropagationLossModel& operator=(const GridCullingPropagationLossModel& src) = delete;
+
+    void SetInner(Ptr<PropagationLossModel> inner);
+    Ptr<PropagationLossModel> GetInner() const;
+
+    // wrap whatever loss model chain channel has now and put this model in its place
+    void InstallOn(Ptr<YansWifiChannel> channel);
+
+    void AddNode(Ptr<MobilityModel> mobility);
+    void AddNodes(NodeContainer nodes);
+
+    // distance past which a transmission at txPowerDbm is culled, before the movement slack
+    double GetCullRange(double txPowerDbm) const;
+
+    uint64_t GetCulled() const;
+    uint64_t GetPassed() const;
+
+  protected:
+    void DoDispose() override;
+    double DoCalcRxPower(double txPowerDbm,
+                         Ptr<MobilityModel> a,
+                         Ptr<MobilityModel> b) const override;
+    int64_t DoAssignStreams(int64_t stream) override;
+
+  private:
+    void CourseChanged(Ptr<const MobilityModel> mobility);
+    void Bin(uint32_t id);
+    void Refresh();
+    // id of the node mobility is aggregated to, or -1 when that node is not registered
+    int64_t Find(const MobilityModel* mobility) const;
+
+    Ptr<PropagationLossModel> m_inner;
+    Ptr<WeatheredFriisPropagationLossModel> m_friis;    // m_inner, when it is one
+    double m_cellSize{100};
+    double m_maxRange{0};
+    double m_rxSensitivity{-101};
+    double m_maxSpeed{50};
+    Time m_refreshInterval{Seconds(1)};
+    EventId m_refreshEvent;
+
+    // by node id, null for the nodes that are not registered
+    std::vector<Ptr<MobilityModel>> m_nodes;
+    std::vector<int32_t> m_cellX, m_cellY;
+
+    // range of the last tx power and inner Friis loss asked for; GetMaxRange depends on nothing else
+    mutable double m_rangeTxPowerDbm{NAN};
+    mutable double m_rangeLossConstantDb{NAN};
+    mutable double m_rangeWeatherLossDbPerM{NAN};
+    mutable int32_t m_rangeCells{0};
+
+    mutable uint64_t m_nCulled{0};
+    mutable uint64_t m_nPassed{0};
+};
+
+// ===================================================================== //
+
+NS_OBJECT_ENSURE_REGISTERED(GridCullingPropagationLossModel);
+
+// answer for culled receivers, far below the sensitivity of any phy
+static const double CULLED_RX_POWER_DBM = -1000.0;
+
+TypeId
+GridCullingPropagationLossModel::GetTypeId(void)
+{
+    static TypeId tid =
+        TypeId("ns3::GridCullingPropagationLossModel")
+            .SetParent<PropagationLossModel>()
+            .SetGroupName("Propagation")
+            .AddConstructor<GridCullingPropagationLossModel>()
+            .AddAttribute("Inner",
+                          "The loss model evaluated for the receivers that are not culled.",
+                          PointerValue(),
+                          MakePointerAccessor(&GridCullingPropagationLossModel::SetInner,
+                                              &GridCullingPropagationLossModel::GetInner),
+                          MakePointerChecker<PropagationLossModel>())
+            .AddAttribute("CellSize",
+                          "Side of the grid cells (m).",
+                          DoubleValue(100.0),
+                          MakeDoubleAccessor(&GridCullingPropagationLossModel::m_cellSize),
+                          MakeDoubleChecker<double>(1.0))
+            .AddAttribute("MaxRange",
+                          "Distance (m) past which receivers are culled. 0 solves it from the inner model, "
+                          "which must then be a WeatheredFriisPropagationLossModel.",
+                          DoubleValue(0.0),
+                          MakeDoubleAccessor(&GridCullingPropagationLossModel::m_maxRange),
+                          MakeDoubleChecker<double>(0.0))
+            .AddAttribute("RxSensitivity",
+                          "Sensitivity (dBm) the range is solved for, less any rx antenna gain.",
+                          DoubleValue(-101.0),
+                          MakeDoubleAccessor(&GridCullingPropagationLossModel::m_rxSensitivity),
+                          MakeDoubleChecker<double>())
+            .AddAttribute("MaxSpeed",
+                          "Upper bound on the node speeds (m/s), for the distance a node can move between "
+                          "two refreshes.",
+                          DoubleValue(50.0),
+                          MakeDoubleAccessor(&GridCullingPropagationLossModel::m_maxSpeed),
+                          MakeDoubleChecker<double>(0.0))
+            .AddAttribute("RefreshInterval",
+                          "Time between two rebinnings of every node.",
+                          TimeValue(Seconds(1.0)),
+                          MakeTimeAccessor(&GridCullingPropagationLossModel::m_refreshInterval),
+                          MakeTimeChecker())
+            .AddAttribute("Culled",
+                          "Number of receivers culled so far.",
+                          TypeId::ATTR_GET,
+                          UintegerValue(0),
+                          MakeUintegerAccessor(&GridCullingPropagationLossModel::GetCulled),
+                          MakeUintegerChecker<uint64_t>())
+            .AddAttribute("Passed",
+                          "Number of receivers handed to the inner model so far.",
+                          TypeId::ATTR_GET,
+                          UintegerValue(0),
+                          MakeUintegerAccessor(&GridCullingPropagationLossModel::GetPassed),
+                          MakeUintegerChecker<uint64_t>());
+    return tid;
+}
+
+void
+GridCullingPropagationLossModel::SetInner(Ptr<PropagationLossModel> inner)
+{
+    m_inner = inner;
+    m_friis = DynamicCast<WeatheredFriisPropagationLossModel>(inner);
+    m_rangeTxPowerDbm = NAN;
+}
+
+Ptr<PropagationLossModel>
+GridCullingPropagationLossModel::GetInner() const
+{
+    return m_inner;
+}
+
+void
+GridCullingPropagationLossModel::InstallOn(Ptr<YansWifiChannel> channel)
+{
+    PointerValue current;
+    channel->GetAttribute("PropagationLossModel", current);
+    SetInner(current.Get<PropagationLossModel>());
+    channel->SetPropagationLossModel(this);
+}
+
+void
+GridCullingPropagationLossModel::AddNode(Ptr<MobilityModel> mobility)
+{
+    Ptr<Node> node = mobility->GetObject<Node>();
+    NS_ABORT_MSG_IF(!node, "the mobility model is not aggregated to a node");
+    uint32_t id = node->GetId();
+    if (id >= m_nodes.size())
+    {
+        m_nodes.resize(id + 1);
+        m_cellX.resize(id + 1, 0);
+        m_cellY.resize(id + 1, 0);
+    }
+    NS_ABORT_MSG_IF(m_nodes[id], "node " << id << " registered twice");
+    m_nodes[id] = mobility;
+    Bin(id);
+    mobility->TraceConnectWithoutContext(
+        "CourseChange",
+        MakeCallback(&GridCullingPropagationLossModel::CourseChanged, this));
+    if (!m_refreshEvent.IsRunning())
+    {
+        m_refreshEvent = Simulator::Schedule(m_refreshInterval, &GridCullingPropagationLossModel::Refresh, this);
+    }
+}
+
+void
+GridCullingPropagationLossModel::AddNodes(NodeContainer nodes)
+{
+    for (uint32_t i = 0; i < nodes.GetN(); i++)
+    {
+        Ptr<MobilityModel> mobility = nodes.Get(i)->GetObject<MobilityModel>();
+        NS_ABORT_MSG_IF(!mobility, "install the mobility before registering the nodes");
+        AddNode(mobility);
+    }
+}
+
+double
+GridCullingPropagationLossModel::GetCullRange(double txPowerDbm) const
+{
+    if (m_maxRange > 0)
+    {
+        return m_maxRange;
+    }
+    NS_ABORT_MSG_IF(!m_friis, "set MaxRange when the inner model is not a WeatheredFriisPropagationLossModel");
+    return m_friis->GetMaxRange(txPowerDbm, m_rxSensitivity);
+}
+
+uint64_t
+GridCullingPropagationLossModel::GetCulled() const
+{
+    return m_nCulled;
+}
+
+uint64_t
+GridCullingPropagationLossModel::GetPassed() const
+{
+    return m_nPassed;
+}
+
+void
+GridCullingPropagationLossModel::DoDispose()
+{
+    m_refreshEvent.Cancel();
+    m_nodes.clear();
+    m_inner = nullptr;
+    m_friis = nullptr;
+    PropagationLossModel::DoDispose();
+}
+
+void
+GridCullingPropagationLossModel::CourseChanged(Ptr<const MobilityModel> mobility)
+{
+    PROFILE_SCOPE("GridCullingPropagationLossModel::CourseChanged");
+    int64_t id = Find(PeekPointer(mobility));
+    NS_ABORT_MSG_IF(id < 0, "course change of a node that is not registered");
+    Bin(id);
+}
+
+void
+GridCullingPropagationLossModel::Bin(uint32_t id)
+{
+    Vector position = m_nodes[id]->GetPosition();
+    m_cellX[id] = static_cast<int32_t>(std::floor(position.x / m_cellSize));
+    m_cellY[id] = static_cast<int32_t>(std::floor(position.y / m_cellSize));
+}
+
+int64_t
+GridCullingPropagationLossModel::Find(const MobilityModel* mobility) const
+{
+    Ptr<Node> node = mobility->GetObject<Node>();
+    if (!node)
+    {
+        return -1;
+    }
+    uint32_t id = node->GetId();
+    return id < m_nodes.size() && PeekPointer(m_nodes[id]) == mobility ? id : -1;
+}
+
+void
+GridCullingPropagationLossModel::Refresh()
+{
+    PROFILE_SCOPE("GridCullingPropagationLossModel::Refresh");
+    for (uint32_t id = 0; id < m_nodes.size(); id++)
+    {
+        if (m_nodes[id])
+        {
+            Bin(id);
+        }
+    }
+    m_refreshEvent = Simulator::Schedule(m_refreshInterval, &GridCullingPropagationLossModel::Refresh, this);
+}
+
+double
+GridCullingPropagationLossModel::DoCalcRxPower(double txPowerDbm,
+                                                Ptr<MobilityModel> a,
+                                                Ptr<MobilityModel> b) const
+{
+    PROFILE_SCOPE("GridCullingPropagationLossModel::DoCalcRxPower");
+    NS_ABORT_MSG_IF(!m_inner, "GridCullingPropagationLossModel has no inner model");
+    int64_t i = Find(PeekPointer(a));
+    int64_t j = i < 0 ? -1 : Find(PeekPointer(b));
+    if (j >= 0)
+    {
+        double lossConstantDb = m_friis ? m_friis->GetLossConstantDb() : 0.0;
+        double weatherLossDbPerM = m_friis ? m_friis->GetWeatherLossDbPerM() : 0.0;
+        if (txPowerDbm != m_rangeTxPowerDbm || lossConstantDb != m_rangeLossConstantDb ||
+            weatherLossDbPerM != m_rangeWeatherLossDbPerM)
+        {
+            // both ends may have moved up to a refresh worth of distance since they were binned, and
+            // two points (n + 1) cells apart are at least n cells apart
+            double reach = GetCullRange(txPowerDbm) + 2 * m_maxSpeed * m_refreshInterval.GetSeconds();
+            m_rangeCells = static_cast<int32_t>(std::floor(reach / m_cellSize)) + 1;
+            m_rangeTxPowerDbm = txPowerDbm;
+            m_rangeLossConstantDb = lossConstantDb;
+            m_rangeWeatherLossDbPerM = weatherLossDbPerM;
+        }
+        if (std::abs(m_cellX[i] - m_cellX[j]) > m_rangeCells || std::abs(m_cellY[i] - m_cellY[j]) > m_rangeCells)
+        {
+            m_nCulled++;
+            return CULLED_RX_POWER_DBM;
+        }
+    }
+    m_nPassed++;
+    return m_inner->CalcRxPower(txPowerDbm, a, b);
+}
+
+int64_t
+GridCullingPropagationLossModel::DoAssignStreams(int64_t stream)
+{
+    return m_inner ? m_inner->AssignStreams(stream) : 0;
+}
+
+#endif
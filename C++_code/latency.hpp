@@ -0,0 +1,186 @@
+#ifndef LATENCY_HPP
+#define LATENCY_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Send times of the packets in flight, by (flow, sequence number), so each received packet is matched
+// to its own send time rather than to that of the last packet sent by anyone.
+//
+// Open addressing with linear probing over a fixed number of slots, and a probe never goes further than
+// MAX_PROBES slots, so sending and receiving are O(1) and the memory is the same whatever the loss rate.
+// A packet still in flight maxAge after it was sent is taken as lost: its slot is reused by the next
+// send that probes it, or freed by Expire. If every slot probed holds a packet younger than that, the
+// oldest of them is given up as lost early; with the default 2^16 slots this takes tens of thousands of
+// packets in flight at once.
+class InFlightTable{
+  public:
+    static const uint32_t MAX_PROBES = 16;
+
+    explicit InFlightTable(uint32_t capacityLog2 = 16, double maxAge = 30.0);
+
+    void Sent(uint64_t flow, uint32_t seq, double time);
+    // the send time of the packet, which is then forgotten; false for a duplicate, or a packet that
+    // arrived after being given up as lost
+    bool Received(uint64_t flow, uint32_t seq, double& sentTime);
+    // gives up every packet sent more than maxAge before now
+    void Expire(double now);
+
+    uint64_t GetInFlight() const;
+    uint64_t GetLost() const;
+    uint64_t GetUnmatched() const;
+    uint64_t GetCapacity() const;
+    static uint64_t GetSlotBytes();
+
+  private:
+    enum SlotState : uint32_t
+    {
+      EMPTY = 0,
+      LIVE,
+      // freed; a lookup has to probe past it, as the packet it looks for may have been placed after it
+      DELETED
+    };
+    struct Slot
+    {
+      uint64_t flow;
+      uint32_t seq;
+      uint32_t state;
+      double time;
+    };
+
+    static uint64_t Hash(uint64_t flow, uint32_t seq);
+
+    std::vector<Slot> m_slots;
+    uint64_t m_mask;
+    double m_maxAge;
+    uint64_t m_inFlight{0};
+    uint64_t m_lost{0};
+    uint64_t m_unmatched{0};
+};
+
+// ===================================================================== //
+
+InFlightTable::InFlightTable(uint32_t capacityLog2, double maxAge)
+    : m_slots(uint64_t{1} << std::max(capacityLog2, 4u), Slot{0, 0, EMPTY, 0}),
+      m_mask(m_slots.size() - 1),
+      m_maxAge(maxAge)
+{
+}
+
+// splitmix64 finaliser over both halves of the key
+uint64_t
+InFlightTable::Hash(uint64_t flow, uint32_t seq)
+{
+    uint64_t h = flow * 0x9e3779b97f4a7c15ull ^ seq;
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ull;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebull;
+    return h ^ (h >> 31);
+}
+
+void
+InFlightTable::Sent(uint64_t flow, uint32_t seq, double time)
+{
+    uint64_t h = Hash(flow, seq);
+    Slot* free = nullptr;
+    Slot* oldest = nullptr;
+    for (uint32_t p = 0; p < MAX_PROBES; p++)
+    {
+        Slot& slot = m_slots[(h + p) & m_mask];
+        if (slot.state != LIVE)
+        {
+            free = &slot;
+            break;
+        }
+        if (time - slot.time > m_maxAge)
+        {
+            m_lost++;
+            m_inFlight--;
+            free = &slot;
+            break;
+        }
+        if (!oldest || slot.time < oldest->time)
+        {
+            oldest = &slot;
+        }
+    }
+    if (!free)
+    {
+        m_lost++;
+        m_inFlight--;
+        free = oldest;
+    }
+    *free = Slot{flow, seq, LIVE, time};
+    m_inFlight++;
+}
+
+bool
+InFlightTable::Received(uint64_t flow, uint32_t seq, double& sentTime)
+{
+    uint64_t h = Hash(flow, seq);
+    for (uint32_t p = 0; p < MAX_PROBES; p++)
+    {
+        Slot& slot = m_slots[(h + p) & m_mask];
+        if (slot.state == EMPTY)
+        {
+            break;
+        }
+        if (slot.state == LIVE && slot.flow == flow && slot.seq == seq)
+        {
+            sentTime = slot.time;
+            slot.state = DELETED;
+            m_inFlight--;
+            return true;
+        }
+    }
+    m_unmatched++;
+    return false;
+}
+
+void
+InFlightTable::Expire(double now)
+{
+    for (Slot& slot: m_slots)
+    {
+        if (slot.state == LIVE && now - slot.time > m_maxAge)
+        {
+            slot.state = DELETED;
+            m_inFlight--;
+            m_lost++;
+        }
+    }
+}
+
+uint64_t
+InFlightTable::GetInFlight() const
+{
+    return m_inFlight;
+}
+
+uint64_t
+InFlightTable::GetLost() const
+{
+    return m_lost;
+}
+
+uint64_t
+InFlightTable::GetUnmatched() const
+{
+    return m_unmatched;
+}
+
+uint64_t
+InFlightTable::GetCapacity() const
+{
+    return m_slots.size();
+}
+
+uint64_t
+InFlightTable::GetSlotBytes()
+{
+    return sizeof(Slot);
+}
+
+#endif
@@ -0,0 +1,220 @@
+#ifndef LINKPROBE_HPP
+#define LINKPROBE_HPP
+
+#include "ns3/abort.h"
+#include "ns3/callback.h"
+#include "ns3/mac48-address.h"
+#include "ns3/mobility-model.h"
+#include "ns3/node.h"
+#include "ns3/packet.h"
+#include "ns3/simulator.h"
+#include "ns3/wifi-mac-header.h"
+#include "ns3/wifi-net-device.h"
+#include "ns3/wifi-phy.h"
+
+#include "profiler.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace ns3;
+
+// Signal and noise of the frames sent over chosen (tx, rx) links, with the distance of the link when
+// each was received.
+//
+// Each receiver's phy is hooked once, with the receiver bound into the callback instead of parsed out of a
+// trace context. A frame is matched to its link by the transmitter address of its mac header; control
+// frames without one (ACK, CTS) are skipped, as the sniffer also sees those of every neighbour and they
+// cannot be told apart. The mobility models of both ends are looked up when the link is added, so a frame
+// costs a header peek, a distance and a record in a preallocated buffer, which is formatted out to the csv
+// only when full.
+//
+// Rows are "rxNode, distance, signal, time, noise, txNode", the first three as visualise_tunnel.py always
+// read them.
+class LinkProbe{
+  public:
+    LinkProbe() = default;
+    ~LinkProbe();
+
+    LinkProbe(const LinkProbe& src) = delete;
+    LinkProbe& operator=(const LinkProbe& src) = delete;
+
+    // records are kept only while open
+    bool Open(const std::string& filename, std::size_t bufferRecords = 65536);
+    void Close();
+    // frames from tx's wifi device to rx's, both the device at deviceIndex of their node
+    void AddLink(Ptr<Node> tx, Ptr<Node> rx, uint32_t deviceIndex = 0);
+
+  private:
+    struct Entry
+    {
+      double time;
+      uint32_t link;
+      float distance;
+      float signal;
+      float noise;
+    };
+    struct Link
+    {
+      Mac48Address txAddress;
+      uint32_t txNode;
+      uint32_t rxNode;
+      Ptr<MobilityModel> txMobility;
+      Ptr<MobilityModel> rxMobility;
+    };
+    struct Receiver
+    {
+      Ptr<WifiPhy> phy;
+      std::vector<uint32_t> links;
+    };
+
+    static void Sniffed(LinkProbe* probe,
+                        uint32_t receiver,
+                        Ptr<const Packet> packet,
+                        uint16_t channelFreqMhz,
+                        WifiTxVector txVector,
+                        MpduInfo aMpdu,
+                        SignalNoiseDbm signalNoise,
+                        uint16_t staId);
+    void Record(uint32_t receiver, Ptr<const Packet> packet, const SignalNoiseDbm& signalNoise);
+    void Flush();
+
+    static Ptr<WifiNetDevice> GetWifiDevice(Ptr<Node> node, uint32_t deviceIndex);
+
+    std::ofstream m_file;
+    std::vector<Link> m_links;
+    std::vector<Receiver> m_receivers;
+    std::vector<Entry> m_buffer;
+    std::size_t m_bufferRecords{0};
+};
+
+// ===================================================================== //
+
+LinkProbe::~LinkProbe()
+{
+    Close();
+}
+
+bool
+LinkProbe::Open(const std::string& filename, std::size_t bufferRecords)
+{
+    m_file.open(filename, std::ios::out | std::ios::trunc);
+    m_bufferRecords = std::max<std::size_t>(bufferRecords, 1);
+    m_buffer.clear();
+    m_buffer.reserve(m_bufferRecords);
+    return static_cast<bool>(m_file);
+}
+
+void
+LinkProbe::Close()
+{
+    if (m_file.is_open())
+    {
+        Flush();
+        m_file.close();
+    }
+}
+
+Ptr<WifiNetDevice>
+LinkProbe::GetWifiDevice(Ptr<Node> node, uint32_t deviceIndex)
+{
+    NS_ABORT_MSG_IF(deviceIndex >= node->GetNDevices(), "node " << node->GetId() << " has no device " << deviceIndex);
+    Ptr<WifiNetDevice> device = DynamicCast<WifiNetDevice>(node->GetDevice(deviceIndex));
+    NS_ABORT_MSG_IF(!device, "device " << deviceIndex << " of node " << node->GetId() << " is not wifi");
+    return device;
+}
+
+void
+LinkProbe::AddLink(Ptr<Node> tx, Ptr<Node> rx, uint32_t deviceIndex)
+{
+    Link link{Mac48Address::ConvertFrom(GetWifiDevice(tx, deviceIndex)->GetAddress()),
+              tx->GetId(),
+              rx->GetId(),
+              tx->GetObject<MobilityModel>(),
+              rx->GetObject<MobilityModel>()};
+    NS_ABORT_MSG_IF(!link.txMobility || !link.rxMobility, "install the mobility before adding the links");
+    m_links.push_back(link);
+
+    Ptr<WifiPhy> phy = GetWifiDevice(rx, deviceIndex)->GetPhy();
+    for (Receiver& receiver: m_receivers)
+    {
+        if (receiver.phy == phy)
+        {
+            receiver.links.push_back(m_links.size() - 1);
+            return;
+        }
+    }
+    m_receivers.push_back({phy, {static_cast<uint32_t>(m_links.size() - 1)}});
+    uint32_t receiver = m_receivers.size() - 1;
+    phy->TraceConnectWithoutContext("MonitorSnifferRx", MakeBoundCallback(&LinkProbe::Sniffed, this, receiver));
+}
+
+void
+LinkProbe::Sniffed(LinkProbe* probe,
+                   uint32_t receiver,
+                   Ptr<const Packet> packet,
+                   uint16_t channelFreqMhz,
+                   WifiTxVector txVector,
+                   MpduInfo aMpdu,
+                   SignalNoiseDbm signalNoise,
+                   uint16_t staId)
+{
+    probe->Record(receiver, packet, signalNoise);
+}
+
+void
+LinkProbe::Record(uint32_t receiver, Ptr<const Packet> packet, const SignalNoiseDbm& signalNoise)
+{
+    PROFILE_SCOPE("LinkProbe::Record");
+    if (!m_file.is_open())
+    {
+        return;
+    }
+    const std::vector<uint32_t>& links = m_receivers[receiver].links;
+    WifiMacHeader header;
+    packet->PeekHeader(header);
+    if (header.IsAck() || header.IsCts())
+    {
+        return;
+    }
+    const Link* link = nullptr;
+    for (uint32_t i: links)
+    {
+        if (m_links[i].txAddress == header.GetAddr2())
+        {
+            link = &m_links[i];
+            break;
+        }
+    }
+    if (!link)
+    {
+        return;
+    }
+    m_buffer.push_back({Simulator::Now().GetSeconds(),
+                        static_cast<uint32_t>(link - m_links.data()),
+                        static_cast<float>(link->txMobility->GetDistanceFrom(link->rxMobility)),
+                        static_cast<float>(signalNoise.signal),
+                        static_cast<float>(signalNoise.noise)});
+    if (m_buffer.size() == m_bufferRecords)
+    {
+        Flush();
+    }
+}
+
+void
+LinkProbe::Flush()
+{
+    for (const Entry& entry: m_buffer)
+    {
+        const Link& link = m_links[entry.link];
+        m_file << link.rxNode << ", " << entry.distance << ", " << entry.signal << ", " << entry.time << ", "
+               << entry.noise << ", " << link.txNode << "\n";
+    }
+    m_buffer.clear();
+}
+
+#endif
@@ -0,0 +1,104 @@
+#ifndef MAPPEDFILE_HPP
+#define MAPPEDFILE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Read only memory mapping of a whole file. The mapping lives as long as the object, so anything
+// handing out pointers into GetData() must keep the MappedFile alive.
+class MappedFile{
+  public:
+    MappedFile() = default;
+    explicit MappedFile(const std::string& path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile& src) = delete;
+    MappedFile& operator=(const MappedFile& src) = delete;
+
+    bool Open(const std::string& path);
+    void Close();
+
+    bool IsOpen() const;
+    const uint8_t* GetData() const;
+    std::size_t GetSize() const;
+
+  private:
+    void* m_data{nullptr};
+    std::size_t m_size{0};
+};
+
+// ===================================================================== //
+
+MappedFile::MappedFile(const std::string& path)
+{
+    Open(path);
+}
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+bool
+MappedFile::Open(const std::string& path)
+{
+    Close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        ::close(fd);
+        return false;
+    }
+    void* data = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // the mapping keeps its own reference to the file
+    ::close(fd);
+    if (data == MAP_FAILED)
+    {
+        return false;
+    }
+    m_data = data;
+    m_size = st.st_size;
+    return true;
+}
+
+void
+MappedFile::Close()
+{
+    if (m_data)
+    {
+        ::munmap(m_data, m_size);
+        m_data = nullptr;
+        m_size = 0;
+    }
+}
+
+bool
+MappedFile::IsOpen() const
+{
+    return m_data != nullptr;
+}
+
+const uint8_t*
+MappedFile::GetData() const
+{
+    return static_cast<const uint8_t*>(m_data);
+}
+
+std::size_t
+MappedFile::GetSize() const
+{
+    return m_size;
+}
+
+#endif
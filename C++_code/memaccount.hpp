@@ -0,0 +1,316 @@
+#ifndef MEMACCOUNT_HPP
+#define MEMACCOUNT_HPP
+
+#include "ns3/application.h"
+#include "ns3/arp-cache.h"
+#include "ns3/event-id.h"
+#include "ns3/ipv4-interface.h"
+#include "ns3/ipv4-l3-protocol.h"
+#include "ns3/ipv4-list-routing.h"
+#include "ns3/ipv4-routing-protocol.h"
+#include "ns3/net-device.h"
+#include "ns3/node-list.h"
+#include "ns3/node.h"
+#include "ns3/nstime.h"
+#include "ns3/object.h"
+#include "ns3/output-stream-wrapper.h"
+#include "ns3/simulator.h"
+#include "ns3/wifi-mac-queue.h"
+#include "ns3/wifi-mac.h"
+#include "ns3/wifi-net-device.h"
+#include "ns3/wifi-phy.h"
+#include "ns3/wifi-remote-station-manager.h"
+
+#include "profiler.hpp"
+#include "setupreport.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <map>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+using namespace ns3;
+
+// Samples what the simulation holds, by node, at chosen simulated times:
+//
+//   object       every object aggregated to a node, by type
+//   device       the net devices, and the phy, mac and station manager of the wifi ones
+//   application  the applications
+//   routing      the rows of every routing table (one protocol per list routing entry)
+//   arp          the entries of the arp caches
+//   wifi queue   the packets waiting in the wifi mac queues, and their bytes
+//   scenario     whatever the scenario adds with AddProbe, e.g. its flow table
+//   process      the resident set and the heap in use
+//
+// Each row has a count and bytes, in total and per node. The bytes of an object are those of its own
+// allocation (malloc_usable_size, glibc only), not of the containers it owns: those show up as the
+// routing, arp, queue and scenario rows. Samples are written to a csv, one row per (time, category,
+// name), so a table that grows without bound is a row that keeps increasing from one sample to the next.
+class MemoryAccount{
+  public:
+    MemoryAccount() = default;
+
+    bool Open(const std::string& filename);
+    void Close();
+    // count() things of bytesEach bytes each, sampled along with the rest
+    void AddProbe(const std::string& name, std::function<uint64_t()> count, uint64_t bytesEach);
+    // samples now and then every interval; samples taken while no file is open are only kept for Print
+    void Start(Time interval);
+    void Sample();
+    // the last sample
+    void Print(std::ostream& os) const;
+
+  private:
+    struct Row
+    {
+      double count{0};
+      double bytes{0};
+    };
+    struct Probe
+    {
+      std::string name;
+      std::function<uint64_t()> count;
+      uint64_t bytesEach;
+    };
+
+    void Add(const std::string& category, const std::string& name, double count, double bytes);
+    void AddObject(const std::string& category, Ptr<const Object> object);
+    void AddRoutingTable(Ptr<Ipv4RoutingProtocol> routing);
+    void ScheduleSample();
+
+    static uint64_t GetAllocationBytes(Ptr<const Object> object);
+    static uint64_t GetHeapBytes();
+    // lines of a printed table that start with an address, i.e. one per entry
+    static uint32_t CountEntries(const std::string& table);
+
+    std::ofstream m_file;
+    std::vector<Probe> m_probes;
+    std::map<std::pair<std::string, std::string>, Row> m_sample;
+    double m_sampleTime{0};
+    uint32_t m_sampleNodes{0};
+    Time m_interval;
+    EventId m_event;
+};
+
+// ===================================================================== //
+
+bool
+MemoryAccount::Open(const std::string& filename)
+{
+    m_file.open(filename);
+    m_file << "Time,Category,Name,Count,Bytes,CountPerNode,BytesPerNode\n";
+    return static_cast<bool>(m_file);
+}
+
+void
+MemoryAccount::Close()
+{
+    m_event.Cancel();
+    if (m_file.is_open())
+    {
+        m_file.close();
+    }
+}
+
+void
+MemoryAccount::AddProbe(const std::string& name, std::function<uint64_t()> count, uint64_t bytesEach)
+{
+    m_probes.push_back({name, std::move(count), bytesEach});
+}
+
+void
+MemoryAccount::Start(Time interval)
+{
+    m_interval = interval;
+    m_event.Cancel();
+    m_event = Simulator::ScheduleNow(&MemoryAccount::ScheduleSample, this);
+}
+
+void
+MemoryAccount::ScheduleSample()
+{
+    Sample();
+    m_event = Simulator::Schedule(m_interval, &MemoryAccount::ScheduleSample, this);
+}
+
+uint64_t
+MemoryAccount::GetAllocationBytes(Ptr<const Object> object)
+{
+#ifdef __GLIBC__
+    // objects are allocated whole by CreateObject, so the most derived address is that of the allocation
+    return malloc_usable_size(const_cast<void*>(dynamic_cast<const void*>(PeekPointer(object))));
+#else
+    return 0;
+#endif
+}
+
+uint64_t
+MemoryAccount::GetHeapBytes()
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+#else
+    return 0;
+#endif
+}
+
+uint32_t
+MemoryAccount::CountEntries(const std::string& table)
+{
+    std::istringstream lines(table);
+    uint32_t n = 0;
+    std::string line;
+    while (std::getline(lines, line))
+    {
+        n += !line.empty() && line[0] >= '0' && line[0] <= '9';
+    }
+    return n;
+}
+
+void
+MemoryAccount::Add(const std::string& category, const std::string& name, double count, double bytes)
+{
+    Row& row = m_sample[{category, name}];
+    row.count += count;
+    row.bytes += bytes;
+}
+
+void
+MemoryAccount::AddObject(const std::string& category, Ptr<const Object> object)
+{
+    if (object)
+    {
+        Add(category, object->GetInstanceTypeId().GetName(), 1, GetAllocationBytes(object));
+    }
+}
+
+void
+MemoryAccount::AddRoutingTable(Ptr<Ipv4RoutingProtocol> routing)
+{
+    Ptr<Ipv4ListRouting> list = DynamicCast<Ipv4ListRouting>(routing);
+    if (list)
+    {
+        for (uint32_t i = 0; i < list->GetNRoutingProtocols(); i++)
+        {
+            int16_t priority;
+            AddRoutingTable(list->GetRoutingProtocol(i, priority));
+        }
+        return;
+    }
+    std::ostringstream table;
+    routing->PrintRoutingTable(Create<OutputStreamWrapper>(&table), Time::S);
+    Add("routing", routing->GetInstanceTypeId().GetName(), CountEntries(table.str()), 0);
+}
+
+void
+MemoryAccount::Sample()
+{
+    PROFILE_SCOPE("MemoryAccount::Sample");
+    m_sample.clear();
+    m_sampleTime = Simulator::Now().GetSeconds();
+    m_sampleNodes = NodeList::GetNNodes();
+    for (NodeList::Iterator it = NodeList::Begin(); it != NodeList::End(); ++it)
+    {
+        Ptr<Node> node = *it;
+        Object::AggregateIterator aggregates = node->GetAggregateIterator();
+        while (aggregates.HasNext())
+        {
+            AddObject("object", aggregates.Next());
+        }
+        for (uint32_t i = 0; i < node->GetNDevices(); i++)
+        {
+            Ptr<NetDevice> device = node->GetDevice(i);
+            AddObject("device", device);
+            Ptr<WifiNetDevice> wifi = DynamicCast<WifiNetDevice>(device);
+            if (!wifi)
+            {
+                continue;
+            }
+            AddObject("device", wifi->GetPhy());
+            AddObject("device", wifi->GetRemoteStationManager());
+            Ptr<WifiMac> mac = wifi->GetMac();
+            AddObject("device", mac);
+            Ptr<WifiMacQueue> queue = mac ? mac->GetTxopQueue(AC_BE_NQOS) : Ptr<WifiMacQueue>();
+            if (queue)
+            {
+                Add("wifi queue", "packets", queue->GetNPackets(), queue->GetNBytes());
+            }
+        }
+        for (uint32_t i = 0; i < node->GetNApplications(); i++)
+        {
+            AddObject("application", node->GetApplication(i));
+        }
+        Ptr<Ipv4L3Protocol> ipv4 = node->GetObject<Ipv4L3Protocol>();
+        if (!ipv4)
+        {
+            continue;
+        }
+        if (ipv4->GetRoutingProtocol())
+        {
+            AddRoutingTable(ipv4->GetRoutingProtocol());
+        }
+        for (uint32_t i = 0; i < ipv4->GetNInterfaces(); i++)
+        {
+            Ptr<ArpCache> arp = ipv4->GetInterface(i)->GetArpCache();
+            if (arp)
+            {
+                std::ostringstream cache;
+                arp->PrintArpCache(Create<OutputStreamWrapper>(&cache));
+                Add("arp", "entries", CountEntries(cache.str()), 0);
+            }
+        }
+    }
+    for (const Probe& probe: m_probes)
+    {
+        uint64_t count = probe.count();
+        Add("scenario", probe.name, count, count * probe.bytesEach);
+    }
+    Add("process", "resident", 0, SetupReport::GetResidentBytes());
+    Add("process", "heap in use", 0, GetHeapBytes());
+
+    if (!m_file.is_open())
+    {
+        return;
+    }
+    double nodes = std::max(m_sampleNodes, 1u);
+    for (const auto& [key, row]: m_sample)
+    {
+        m_file << m_sampleTime << "," << key.first << "," << key.second << "," << row.count << "," << row.bytes
+               << "," << row.count / nodes << "," << row.bytes / nodes << "\n";
+    }
+    m_file.flush();
+}
+
+void
+MemoryAccount::Print(std::ostream& os) const
+{
+    std::ios_base::fmtflags flags = os.flags();
+    std::streamsize precision = os.precision();
+    double nodes = std::max(m_sampleNodes, 1u);
+    os << "memory at " << m_sampleTime << " s, " << m_sampleNodes << " nodes:\n"
+       << "  " << std::left << std::setw(12) << "category" << std::setw(44) << "name" << std::right << std::setw(12)
+       << "count" << std::setw(12) << "MiB" << std::setw(12) << "per node" << std::setw(12) << "KiB/node" << "\n";
+    for (const auto& [key, row]: m_sample)
+    {
+        os << "  " << std::left << std::setw(12) << key.first << std::setw(44) << key.second << std::right
+           << std::fixed << std::setprecision(0) << std::setw(12) << row.count << std::setprecision(3)
+           << std::setw(12) << row.bytes / 1048576.0 << std::setw(12) << row.count / nodes << std::setw(12)
+           << row.bytes / 1024.0 / nodes << "\n";
+    }
+    os.flags(flags);
+    os.precision(precision);
+}
+
+#endif
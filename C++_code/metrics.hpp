@@ -0,0 +1,667 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <initializer_list>
+#include <limits>
+#include <map>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Count, mean, variance, min and max of a stream of samples in constant memory (Welford's update),
+// mergeable so windows and runs can be combined afterwards.
+class OnlineAccumulator{
+  public:
+    void Add(double x);
+    void Merge(const OnlineAccumulator& other);
+    void Reset();
+
+    uint64_t GetCount() const;
+    // NaN while empty
+    double GetMean() const;
+    // sample variance, NaN below two samples
+    double GetVariance() const;
+    double GetStdDev() const;
+    double GetMin() const;
+    double GetMax() const;
+
+  private:
+    uint64_t m_count{0};
+    double m_mean{0};
+    double m_m2{0};    // sum of squared differences from the mean
+    double m_min{std::numeric_limits<double>::infinity()};
+    double m_max{-std::numeric_limits<double>::infinity()};
+};
+
+// Two sided Student t critical value: the t for which P(|T| <= t) = confidence with df degrees of
+// freedom.
+double StudentTCritical(double confidence, uint64_t df);
+// Half width of the confidence interval of the mean of the samples in acc, NaN below two samples.
+double ConfidenceHalfWidth(const OnlineAccumulator& acc, double confidence);
+
+// Log bucketed histogram of delays in the style of HdrHistogram: values are recorded in whole
+// microseconds into 2^SUB_BUCKET_BITS linear sub-buckets per power of two, so any percentile is
+// within 1/128 of the true value, in fixed memory (30 KiB) and O(1) per sample. Histograms of the
+// same layout merge by adding counts, across windows, flows or runs.
+class LatencyHistogram{
+  public:
+    static const int SUB_BUCKET_BITS = 7;
+    static const int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    // values from 2^MAX_EXPONENT us (about 19 hours) up land in the last bucket
+    static const int MAX_EXPONENT = 36;
+    static const int BUCKETS = (MAX_EXPONENT - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    // negative delays count as zero
+    void Record(double seconds);
+    void Merge(const LatencyHistogram& other);
+    void Reset();
+
+    uint64_t GetCount() const;
+    // highest value (s) equivalent to the bucket holding the p-th percentile, capped at the
+    // largest sample; NaN while empty
+    double GetPercentile(double p) const;
+    // largest sample (s), exact; NaN while empty
+    double GetMax() const;
+
+  private:
+    static int IndexOf(uint64_t us);
+    static uint64_t HighestEquivalent(int index);
+
+    std::array<uint64_t, BUCKETS> m_counts{};
+    uint64_t m_count{0};
+    uint64_t m_maxUs{0};
+};
+
+// Bounded lock free queue between exactly one producer thread and one consumer thread. Capacity must
+// be a power of two.
+template <typename T, std::size_t Capacity>
+class SpscQueue{
+  public:
+    static_assert((Capacity & (Capacity - 1)) == 0, "SpscQueue capacity must be a power of two");
+
+    // false when full
+    bool TryPush(const T& item);
+    // false when empty
+    bool TryPop(T& item);
+
+  private:
+    std::array<T, Capacity> m_slots;
+    // the producer only writes m_tail and the consumer only m_head; kept on separate cache lines
+    alignas(64) std::atomic<std::size_t> m_head{0};
+    alignas(64) std::atomic<std::size_t> m_tail{0};
+};
+
+// Writes csv rows from a background thread, so the simulation never waits on the file.
+//
+// The columns are named once at Open. Columns given a constant with SetConstant (protocol, tx power,
+// ...) are filled in by the writer; Write takes the values of the others, in column order. Rows cross
+// to the writer thread through a SpscQueue, so Write must always be called from the same thread; it
+// only waits if the writer has fallen a whole queue behind.
+class MetricsWriter{
+  public:
+    static const std::size_t MAX_VALUES = 24;
+    struct Row
+    {
+        std::array<double, MAX_VALUES> values;
+        uint32_t nValues;
+    };
+
+    MetricsWriter() = default;
+    ~MetricsWriter();
+
+    MetricsWriter(const MetricsWriter& src) = delete;
+    MetricsWriter& operator=(const MetricsWriter& src) = delete;
+
+    void SetConstant(const std::string& column, const std::string& value);
+    // truncates filename, writes the header and starts the writer thread
+    bool Open(const std::string& filename, const std::vector<std::string>& columns);
+    void Write(const double* values, uint32_t nValues);
+    void Write(std::initializer_list<double> values);
+    // writes out every queued row, then stops the thread and closes the file
+    void Close();
+    bool IsOpen() const;
+
+  private:
+    void Run();
+    void WriteRow(const Row& row);
+
+    std::ofstream m_file;
+    std::vector<char> m_fileBuffer;
+    std::vector<std::string> m_columns;
+    std::map<std::string, std::string> m_constants;
+    std::thread m_thread;
+    std::atomic<bool> m_stop{false};
+    SpscQueue<Row, 4096> m_queue;
+};
+
+// The end to end delays of a run, cut into metrics windows. While a window is open the delays are kept
+// for all flows together and per (source node, sink node) flow; CloseWindow writes the rows of the
+// window and folds it into the run totals. final_sanet and final_vanet close their windows with it, and
+// bench_micro times the same call.
+class WindowedDelays{
+  public:
+    struct Flow
+    {
+        uint32_t id{0};              // order of the flow's first packet
+        LatencyHistogram window;     // delays of the current window
+        LatencyHistogram total;      // delays of the closed windows
+    };
+
+    // the flow from source to sink, made at its first packet
+    Flow& GetFlow(uint32_t source, uint32_t sink);
+    void Record(Flow& flow, double delay);
+
+    // writes the row of the window ending at now to metrics (time, kbs, received, mean delay, delivery
+    // ratio, delay stddev, min, max, p50, p95, p99, sent) and one row per flow to flowMetrics (window
+    // start, end, source, sink, received, p50, p95, p99, max), then starts the next window
+    void CloseWindow(double now,
+                     double windowLength,
+                     double kbs,
+                     uint64_t received,
+                     uint64_t sent,
+                     MetricsWriter& metrics,
+                     MetricsWriter& flowMetrics);
+    // at the end of the run: folds the open window into the totals and writes one row per flow over
+    // the whole run
+    void CloseRun(double now, MetricsWriter& flowMetrics);
+
+    const OnlineAccumulator& GetRunDelay() const;
+    const LatencyHistogram& GetRunHistogram() const;
+    std::size_t GetNFlows() const;
+    static std::size_t GetFlowBytes();
+
+  private:
+    OnlineAccumulator m_delay;
+    LatencyHistogram m_histogram;
+    OnlineAccumulator m_runDelay;
+    LatencyHistogram m_runHistogram;
+    std::map<std::pair<uint32_t, uint32_t>, Flow> m_flows;
+};
+
+// ===================================================================== //
+
+void
+OnlineAccumulator::Add(double x)
+{
+    m_count++;
+    double delta = x - m_mean;
+    m_mean += delta / m_count;
+    m_m2 += delta * (x - m_mean);
+    m_min = std::min(m_min, x);
+    m_max = std::max(m_max, x);
+}
+
+void
+OnlineAccumulator::Merge(const OnlineAccumulator& other)
+{
+    if (other.m_count == 0)
+    {
+        return;
+    }
+    if (m_count == 0)
+    {
+        *this = other;
+        return;
+    }
+    // Chan et al.'s pairwise combination
+    uint64_t count = m_count + other.m_count;
+    double delta = other.m_mean - m_mean;
+    m_mean += delta * other.m_count / count;
+    m_m2 += other.m_m2 + delta * delta * (static_cast<double>(m_count) * other.m_count / count);
+    m_count = count;
+    m_min = std::min(m_min, other.m_min);
+    m_max = std::max(m_max, other.m_max);
+}
+
+void
+OnlineAccumulator::Reset()
+{
+    *this = OnlineAccumulator();
+}
+
+uint64_t
+OnlineAccumulator::GetCount() const
+{
+    return m_count;
+}
+
+double
+OnlineAccumulator::GetMean() const
+{
+    return m_count ? m_mean : std::numeric_limits<double>::quiet_NaN();
+}
+
+double
+OnlineAccumulator::GetVariance() const
+{
+    return m_count > 1 ? m_m2 / (m_count - 1) : std::numeric_limits<double>::quiet_NaN();
+}
+
+double
+OnlineAccumulator::GetStdDev() const
+{
+    return std::sqrt(GetVariance());
+}
+
+double
+OnlineAccumulator::GetMin() const
+{
+    return m_count ? m_min : std::numeric_limits<double>::quiet_NaN();
+}
+
+double
+OnlineAccumulator::GetMax() const
+{
+    return m_count ? m_max : std::numeric_limits<double>::quiet_NaN();
+}
+
+// regularised incomplete beta function I_x(a, b), by its continued fraction (modified Lentz)
+static double
+IncompleteBeta(double a, double b, double x)
+{
+    if (x <= 0 || x >= 1)
+    {
+        return x <= 0 ? 0 : 1;
+    }
+    // the fraction converges quickly below the mean of the distribution, use the symmetry above it
+    if (x > (a + 1) / (a + b + 2))
+    {
+        return 1 - IncompleteBeta(b, a, 1 - x);
+    }
+    const double tiny = 1e-300;
+    double front = std::exp(std::lgamma(a + b) - std::lgamma(a) - std::lgamma(b) + a * std::log(x) +
+                            b * std::log(1 - x)) / a;
+    double c = 1;
+    double d = 1 - (a + b) * x / (a + 1);
+    d = 1 / (std::abs(d) < tiny ? tiny : d);
+    double f = d;
+    for (int m = 1; m <= 300; m++)
+    {
+        for (int odd = 0; odd < 2; odd++)
+        {
+            double numerator = odd ? -(a + m) * (a + b + m) * x / ((a + 2 * m) * (a + 2 * m + 1))
+                                   : m * (b - m) * x / ((a + 2 * m - 1) * (a + 2 * m));
+            d = 1 + numerator * d;
+            d = 1 / (std::abs(d) < tiny ? tiny : d);
+            c = 1 + numerator / c;
+            c = std::abs(c) < tiny ? tiny : c;
+            f *= c * d;
+        }
+        if (std::abs(c * d - 1) < 1e-15)
+        {
+            break;
+        }
+    }
+    return front * f;
+}
+
+double
+StudentTCritical(double confidence, uint64_t df)
+{
+    // P(|T| <= t) = 1 - I_{df / (df + t^2)}(df / 2, 1 / 2), increasing in t, so bisect
+    double lo = 0;
+    double hi = 1e4;
+    for (int i = 0; i < 200; i++)
+    {
+        double t = (lo + hi) / 2;
+        double covered = 1 - IncompleteBeta(df / 2.0, 0.5, df / (df + t * t));
+        (covered < confidence ? lo : hi) = t;
+    }
+    return (lo + hi) / 2;
+}
+
+double
+ConfidenceHalfWidth(const OnlineAccumulator& acc, double confidence)
+{
+    if (acc.GetCount() < 2)
+    {
+        return std::numeric_limits<double>::quiet_NaN();
+    }
+    return StudentTCritical(confidence, acc.GetCount() - 1) * acc.GetStdDev() / std::sqrt(acc.GetCount());
+}
+
+// ===================================================================== //
+
+void
+LatencyHistogram::Record(double seconds)
+{
+    uint64_t us = seconds > 0 ? static_cast<uint64_t>(seconds * 1e6 + 0.5) : 0;
+    m_counts[IndexOf(us)]++;
+    m_count++;
+    m_maxUs = std::max(m_maxUs, us);
+}
+
+void
+LatencyHistogram::Merge(const LatencyHistogram& other)
+{
+    for (int i = 0; i < BUCKETS; i++)
+    {
+        m_counts[i] += other.m_counts[i];
+    }
+    m_count += other.m_count;
+    m_maxUs = std::max(m_maxUs, other.m_maxUs);
+}
+
+void
+LatencyHistogram::Reset()
+{
+    m_counts.fill(0);
+    m_count = 0;
+    m_maxUs = 0;
+}
+
+uint64_t
+LatencyHistogram::GetCount() const
+{
+    return m_count;
+}
+
+double
+LatencyHistogram::GetPercentile(double p) const
+{
+    if (m_count == 0)
+    {
+        return std::numeric_limits<double>::quiet_NaN();
+    }
+    uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(p / 100 * m_count)));
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKETS; i++)
+    {
+        seen += m_counts[i];
+        if (seen >= rank)
+        {
+            return std::min(HighestEquivalent(i), m_maxUs) / 1e6;
+        }
+    }
+    return m_maxUs / 1e6;
+}
+
+double
+LatencyHistogram::GetMax() const
+{
+    return m_count ? m_maxUs / 1e6 : std::numeric_limits<double>::quiet_NaN();
+}
+
+int
+LatencyHistogram::IndexOf(uint64_t us)
+{
+    if (us < static_cast<uint64_t>(SUB_BUCKETS))
+    {
+        return static_cast<int>(us);
+    }
+    int exponent = 63 - __builtin_clzll(us);
+    if (exponent >= MAX_EXPONENT)
+    {
+        return BUCKETS - 1;
+    }
+    // the block of each power of two above the linear range keeps the top SUB_BUCKET_BITS bits
+    int shift = exponent - SUB_BUCKET_BITS;
+    return (shift + 1) * SUB_BUCKETS + static_cast<int>((us >> shift) & (SUB_BUCKETS - 1));
+}
+
+uint64_t
+LatencyHistogram::HighestEquivalent(int index)
+{
+    if (index < SUB_BUCKETS)
+    {
+        return index;
+    }
+    int shift = index / SUB_BUCKETS - 1;
+    uint64_t lowest = static_cast<uint64_t>(SUB_BUCKETS + index % SUB_BUCKETS) << shift;
+    return lowest + (uint64_t{1} << shift) - 1;
+}
+
+// ===================================================================== //
+
+template <typename T, std::size_t Capacity>
+bool
+SpscQueue<T, Capacity>::TryPush(const T& item)
+{
+    std::size_t tail = m_tail.load(std::memory_order_relaxed);
+    if (tail - m_head.load(std::memory_order_acquire) == Capacity)
+    {
+        return false;
+    }
+    m_slots[tail & (Capacity - 1)] = item;
+    m_tail.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+template <typename T, std::size_t Capacity>
+bool
+SpscQueue<T, Capacity>::TryPop(T& item)
+{
+    std::size_t head = m_head.load(std::memory_order_relaxed);
+    if (head == m_tail.load(std::memory_order_acquire))
+    {
+        return false;
+    }
+    item = m_slots[head & (Capacity - 1)];
+    m_head.store(head + 1, std::memory_order_release);
+    return true;
+}
+
+// ===================================================================== //
+
+MetricsWriter::~MetricsWriter()
+{
+    Close();
+}
+
+void
+MetricsWriter::SetConstant(const std::string& column, const std::string& value)
+{
+    m_constants[column] = value;
+}
+
+bool
+MetricsWriter::Open(const std::string& filename, const std::vector<std::string>& columns)
+{
+    Close();
+    // one write syscall per 1 MiB of csv
+    m_fileBuffer.resize(1 << 20);
+    m_file.rdbuf()->pubsetbuf(m_fileBuffer.data(), m_fileBuffer.size());
+    m_file.open(filename, std::ios::trunc);
+    if (!m_file)
+    {
+        return false;
+    }
+    m_columns = columns;
+    for (std::size_t i = 0; i < m_columns.size(); i++)
+    {
+        m_file << (i ? "," : "") << m_columns[i];
+    }
+    m_file << '\n';
+    m_stop = false;
+    m_thread = std::thread(&MetricsWriter::Run, this);
+    return true;
+}
+
+void
+MetricsWriter::Write(const double* values, uint32_t nValues)
+{
+    Row row;
+    row.nValues = std::min<uint32_t>(nValues, MAX_VALUES);
+    std::copy(values, values + row.nValues, row.values.begin());
+    while (!m_queue.TryPush(row))
+    {
+        std::this_thread::yield();
+    }
+}
+
+void
+MetricsWriter::Write(std::initializer_list<double> values)
+{
+    Write(values.begin(), values.size());
+}
+
+void
+MetricsWriter::Close()
+{
+    if (m_thread.joinable())
+    {
+        m_stop = true;
+        m_thread.join();
+    }
+    if (m_file.is_open())
+    {
+        m_file.close();
+    }
+}
+
+bool
+MetricsWriter::IsOpen() const
+{
+    return m_file.is_open();
+}
+
+void
+MetricsWriter::Run()
+{
+    Row row;
+    while (true)
+    {
+        // read the flag before draining, so rows queued before Close are never left behind
+        bool stop = m_stop;
+        bool wrote = false;
+        while (m_queue.TryPop(row))
+        {
+            WriteRow(row);
+            wrote = true;
+        }
+        if (stop)
+        {
+            break;
+        }
+        if (!wrote)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+    }
+    m_file.flush();
+}
+
+void
+MetricsWriter::WriteRow(const Row& row)
+{
+    uint32_t value = 0;
+    for (std::size_t i = 0; i < m_columns.size(); i++)
+    {
+        if (i)
+        {
+            m_file << ',';
+        }
+        auto constant = m_constants.find(m_columns[i]);
+        if (constant != m_constants.end())
+        {
+            m_file << constant->second;
+        }
+        else if (value < row.nValues)
+        {
+            m_file << row.values[value++];
+        }
+    }
+    m_file << '\n';
+}
+
+// ===================================================================== //
+
+WindowedDelays::Flow&
+WindowedDelays::GetFlow(uint32_t source, uint32_t sink)
+{
+    auto [flow, added] = m_flows.try_emplace({source, sink});
+    if (added)
+    {
+        flow->second.id = m_flows.size() - 1;
+    }
+    return flow->second;
+}
+
+void
+WindowedDelays::Record(Flow& flow, double delay)
+{
+    m_delay.Add(delay);
+    m_histogram.Record(delay);
+    flow.window.Record(delay);
+}
+
+void
+WindowedDelays::CloseWindow(double now,
+                            double windowLength,
+                            double kbs,
+                            uint64_t received,
+                            uint64_t sent,
+                            MetricsWriter& metrics,
+                            MetricsWriter& flowMetrics)
+{
+    double pdr = static_cast<double>(received) / static_cast<double>(sent);
+    metrics.Write({now, kbs, static_cast<double>(received), m_delay.GetMean(), pdr, m_delay.GetStdDev(),
+                   m_delay.GetMin(), m_delay.GetMax(), m_histogram.GetPercentile(50), m_histogram.GetPercentile(95),
+                   m_histogram.GetPercentile(99), static_cast<double>(sent)});
+    m_runDelay.Merge(m_delay);
+    m_runHistogram.Merge(m_histogram);
+    m_delay.Reset();
+    m_histogram.Reset();
+
+    double windowStart = std::max(0.0, now - windowLength);
+    for (auto& [key, flow]: m_flows)
+    {
+        flowMetrics.Write({windowStart, now, static_cast<double>(key.first), static_cast<double>(key.second),
+                           static_cast<double>(flow.window.GetCount()), flow.window.GetPercentile(50),
+                           flow.window.GetPercentile(95), flow.window.GetPercentile(99), flow.window.GetMax()});
+        flow.total.Merge(flow.window);
+        flow.window.Reset();
+    }
+}
+
+void
+WindowedDelays::CloseRun(double now, MetricsWriter& flowMetrics)
+{
+    m_runDelay.Merge(m_delay);
+    m_runHistogram.Merge(m_histogram);
+    m_delay.Reset();
+    m_histogram.Reset();
+    for (auto& [key, flow]: m_flows)
+    {
+        flow.total.Merge(flow.window);
+        flow.window.Reset();
+        flowMetrics.Write({0.0, now, static_cast<double>(key.first), static_cast<double>(key.second),
+                           static_cast<double>(flow.total.GetCount()), flow.total.GetPercentile(50),
+                           flow.total.GetPercentile(95), flow.total.GetPercentile(99), flow.total.GetMax()});
+    }
+}
+
+const OnlineAccumulator&
+WindowedDelays::GetRunDelay() const
+{
+    return m_runDelay;
+}
+
+const LatencyHistogram&
+WindowedDelays::GetRunHistogram() const
+{
+    return m_runHistogram;
+}
+
+std::size_t
+WindowedDelays::GetNFlows() const
+{
+    return m_flows.size();
+}
+
+std::size_t
+WindowedDelays::GetFlowBytes()
+{
+    return sizeof(decltype(m_flows)::value_type);
+}
+
+#endif
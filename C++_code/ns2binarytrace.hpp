@@ -0,0 +1,702 @@
+#ifndef NS2BINARYTRACE_HPP
+#define NS2BINARYTRACE_HPP
+
+#include "ns3/abort.h"
+#include "ns3/event-id.h"
+#include "ns3/mobility-model.h"
+#include "ns3/node-list.h"
+#include "ns3/node.h"
+#include "ns3/nstime.h"
+#include "ns3/object.h"
+#include "ns3/simulator.h"
+#include "ns3/type-id.h"
+#include "ns3/vector.h"
+#include "ns3/waypoint-mobility-model.h"
+#include "ns3/waypoint.h"
+
+#include "mappedfile.hpp"
+#include "profiler.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+using namespace ns3;
+
+// Compiled form of an ns-2 mobility trace such as cardiff.tcl.
+//
+// The setdest commands of the text trace are resolved offline into plain waypoints: a node moves in
+// a straight line from one record to the next, and stands still between two records with the same
+// position. On disk, everything naturally aligned:
+//
+//   Ns2BinaryTraceHeader
+//   Ns2BinaryTraceNode     [nodeCount]                  slice of the record array owned by each node
+//   uint32_t               [nodeCount * bucketCount]    time index
+//   Ns2BinaryTraceRecord   [recordCount]                contiguous per node, sorted by time
+//
+// Time index entry (n, b) is the offset, within node n's slice, of the last record whose time is
+// <= startTime + b * bucketWidth, so a seek to any time only scans the records of one bucket.
+
+struct Ns2BinaryTraceHeader{
+  char magic[8];
+  uint32_t version;
+  uint32_t nodeCount;
+  uint64_t recordCount;
+  uint32_t bucketCount;
+  uint32_t reserved;
+  double bucketWidth;
+  double startTime;
+  double endTime;
+  uint64_t nodeTableOffset;
+  uint64_t indexOffset;
+  uint64_t recordOffset;
+};
+
+struct Ns2BinaryTraceNode{
+  uint64_t firstRecord;
+  uint32_t recordCount;
+  uint32_t reserved;
+};
+
+struct Ns2BinaryTraceRecord{
+  double time;
+  float x;
+  float y;
+  float z;
+  uint32_t reserved;
+};
+
+static_assert(sizeof(Ns2BinaryTraceHeader) == 80, "binary trace header layout changed");
+static_assert(sizeof(Ns2BinaryTraceNode) == 16, "binary trace node layout changed");
+static_assert(sizeof(Ns2BinaryTraceRecord) == 24, "binary trace record layout changed");
+
+static const char NS2_BINARY_TRACE_MAGIC[8] = {'K', 'A', 'K', 'A', 'W', 'P', 'T', '1'};
+static const uint32_t NS2_BINARY_TRACE_VERSION = 1;
+
+// ===================================================================== //
+
+// One time conversion of the Tcl text into the binary format.
+class Ns2BinaryTraceCompiler{
+  public:
+    explicit Ns2BinaryTraceCompiler(double bucketWidth = 60.0);
+
+    bool Parse(const std::string& tclFile);
+    bool Write(const std::string& outFile);
+
+    uint32_t GetNNodes() const;
+    uint64_t GetNRecords() const;
+
+    // highest $node_(n) of a trace plus one, without resolving it; 0 if it cannot be read
+    static uint32_t CountNodes(const std::string& tclFile);
+
+  private:
+    struct NodeState{
+      Vector dest;            // where the node is heading, or its position when stopped
+      Vector from;            // position at the start of the current leg
+      double legStart{0};     // time the current leg started
+      double arrival{0};      // time the current leg ends, equal to legStart when stopped
+      std::vector<Ns2BinaryTraceRecord> records;
+    };
+
+    NodeState& GetState(uint32_t node);
+    void SetInitial(uint32_t node, char axis, double value);
+    void SetDestination(uint32_t node, double time, double x, double y, double speed);
+    void Finish();
+
+    static Vector PositionAt(const NodeState& state, double time);
+    static void Push(std::vector<Ns2BinaryTraceRecord>& records, double time, const Vector& pos);
+
+    double m_bucketWidth;
+    std::vector<NodeState> m_nodes;
+};
+
+// The mapped trace. Shared by every mobility model installed from it.
+class Ns2BinaryTrace: public Object{
+  public:
+    static TypeId GetTypeId(void);
+    Ns2BinaryTrace() = default;
+
+    bool Load(const std::string& filename);
+
+    uint32_t GetNNodes() const;
+    uint32_t GetNRecords(uint32_t node) const;
+    const Ns2BinaryTraceRecord* GetRecords(uint32_t node) const;
+    // index of the last record of node with time <= the given time, 0 if there is none
+    uint32_t FindRecord(uint32_t node, double time) const;
+
+    double GetStartTime() const;
+    double GetEndTime() const;
+
+  private:
+    MappedFile m_file;
+    const Ns2BinaryTraceHeader* m_header{nullptr};
+    const Ns2BinaryTraceNode* m_nodes{nullptr};
+    const uint32_t* m_index{nullptr};
+    const Ns2BinaryTraceRecord* m_records{nullptr};
+};
+
+// Mobility driven straight from the mapped trace. Only the leg the node is currently on is held,
+// and the only event in the scheduler is the end of that leg: the next waypoint is pulled from the
+// trace when it fires, instead of every setdest of the run being scheduled up front.
+class TraceMobilityModel: public MobilityModel{
+  public:
+    static TypeId GetTypeId(void);
+    TraceMobilityModel() = default;
+
+    void SetTrace(Ptr<Ns2BinaryTrace> trace, uint32_t node);
+
+  protected:
+    void DoDispose() override;
+
+  private:
+    void Advance();
+    void ScheduleAdvance();
+
+    Vector DoGetPosition() const override;
+    void DoSetPosition(const Vector& position) override;
+    Vector DoGetVelocity() const override;
+
+    Ptr<Ns2BinaryTrace> m_trace;
+    const Ns2BinaryTraceRecord* m_records{nullptr};
+    uint32_t m_nRecords{0};
+    uint32_t m_cursor{0};        // the node is between records m_cursor and m_cursor + 1
+    EventId m_advance;
+};
+
+// Drop in replacement for Ns2MobilityHelper: node_(i) of the trace drives NodeList node i.
+// Install copies the waypoints into WaypointMobilityModels, InstallLazy reads them from the mapping
+// on demand through TraceMobilityModels.
+class Ns2BinaryTraceHelper{
+  public:
+    explicit Ns2BinaryTraceHelper(std::string filename);
+    explicit Ns2BinaryTraceHelper(Ptr<Ns2BinaryTrace> trace);
+
+    void Install() const;
+    void InstallLazy() const;
+    Ptr<Ns2BinaryTrace> GetTrace() const;
+
+  private:
+    Ptr<Ns2BinaryTrace> m_trace;
+};
+
+// ===================================================================== //
+
+Ns2BinaryTraceCompiler::Ns2BinaryTraceCompiler(double bucketWidth)
+  : m_bucketWidth{bucketWidth}
+{
+    NS_ABORT_MSG_IF(bucketWidth <= 0, "bucket width must be positive");
+}
+
+Ns2BinaryTraceCompiler::NodeState&
+Ns2BinaryTraceCompiler::GetState(uint32_t node)
+{
+    if (node >= m_nodes.size())
+    {
+        m_nodes.resize(node + 1);
+    }
+    return m_nodes[node];
+}
+
+void
+Ns2BinaryTraceCompiler::SetInitial(uint32_t node, char axis, double value)
+{
+    NodeState& state = GetState(node);
+    if (!state.records.empty())
+    {
+        // only the initial placement is supported, the cardiff traces never reposition a node
+        return;
+    }
+    switch(axis){
+      case 'X':
+        state.dest.x = value;
+        break;
+      case 'Y':
+        state.dest.y = value;
+        break;
+      case 'Z':
+        state.dest.z = value;
+        break;
+    }
+    state.from = state.dest;
+}
+
+Vector
+Ns2BinaryTraceCompiler::PositionAt(const NodeState& state, double time)
+{
+    if (time >= state.arrival || state.arrival <= state.legStart)
+    {
+        return state.dest;
+    }
+    double f = (time - state.legStart) / (state.arrival - state.legStart);
+    return Vector(state.from.x + (state.dest.x - state.from.x) * f,
+                  state.from.y + (state.dest.y - state.from.y) * f,
+                  state.from.z + (state.dest.z - state.from.z) * f);
+}
+
+void
+Ns2BinaryTraceCompiler::Push(std::vector<Ns2BinaryTraceRecord>& records, double time, const Vector& pos)
+{
+    Ns2BinaryTraceRecord r{time, static_cast<float>(pos.x), static_cast<float>(pos.y), static_cast<float>(pos.z), 0};
+    if (!records.empty() && records.back().time >= time)
+    {
+        // a second command at the same instant wins, like it would in the simulator
+        r.time = records.back().time;
+        records.back() = r;
+        return;
+    }
+    std::size_t n = records.size();
+    if (n >= 2)
+    {
+        const Ns2BinaryTraceRecord& a = records[n - 2];
+        const Ns2BinaryTraceRecord& b = records[n - 1];
+        if (a.x == b.x && a.y == b.y && a.z == b.z && b.x == r.x && b.y == r.y && b.z == r.z)
+        {
+            // parked: stretch the stop instead of adding another identical waypoint
+            records.back().time = time;
+            return;
+        }
+    }
+    records.push_back(r);
+}
+
+void
+Ns2BinaryTraceCompiler::SetDestination(uint32_t node, double time, double x, double y, double speed)
+{
+    NodeState& state = GetState(node);
+    if (state.records.empty())
+    {
+        Push(state.records, std::min(0.0, time), state.dest);
+    }
+    if (time > state.arrival && state.arrival > state.legStart)
+    {
+        // the previous leg finished before this command
+        Push(state.records, state.arrival, state.dest);
+    }
+    Vector pos = PositionAt(state, time);
+    Push(state.records, time, pos);
+
+    state.legStart = time;
+    state.from = pos;
+    state.dest = Vector(x, y, pos.z);
+    double distance = CalculateDistance(state.from, state.dest);
+    if (speed > 0 && distance > 0)
+    {
+        state.arrival = time + distance / speed;
+    }
+    else
+    {
+        state.dest = pos;
+        state.arrival = time;
+    }
+}
+
+void
+Ns2BinaryTraceCompiler::Finish()
+{
+    for (NodeState& state: m_nodes)
+    {
+        if (state.arrival > state.legStart)
+        {
+            Push(state.records, state.arrival, state.dest);
+            state.legStart = state.arrival;
+            state.from = state.dest;
+        }
+    }
+}
+
+bool
+Ns2BinaryTraceCompiler::Parse(const std::string& tclFile)
+{
+    std::ifstream in{tclFile};
+    if (!in)
+    {
+        return false;
+    }
+    std::string line;
+    while (std::getline(in, line))
+    {
+        uint32_t node;
+        double time;
+        double x;
+        double y;
+        double speed;
+        char axis;
+        std::size_t start = line.find_first_not_of(" \t");
+        if (start == std::string::npos)
+        {
+            continue;
+        }
+        const char* s = line.c_str() + start;
+        if (std::sscanf(s, "$ns_ at %lf \"$node_(%u) setdest %lf %lf %lf\"", &time, &node, &x, &y, &speed) == 5)
+        {
+            SetDestination(node, time, x, y, speed);
+        }
+        else if (std::sscanf(s, "$node_(%u) set %c_ %lf", &node, &axis, &x) == 3)
+        {
+            SetInitial(node, axis, x);
+        }
+    }
+    Finish();
+    return true;
+}
+
+uint32_t
+Ns2BinaryTraceCompiler::GetNNodes() const
+{
+    return m_nodes.size();
+}
+
+uint64_t
+Ns2BinaryTraceCompiler::GetNRecords() const
+{
+    uint64_t n = 0;
+    for (const NodeState& state: m_nodes)
+    {
+        n += state.records.size();
+    }
+    return n;
+}
+
+uint32_t
+Ns2BinaryTraceCompiler::CountNodes(const std::string& tclFile)
+{
+    std::ifstream in{tclFile};
+    uint32_t nNodes = 0;
+    std::string line;
+    while (std::getline(in, line))
+    {
+        std::size_t pos = line.find("$node_(");
+        if (pos != std::string::npos)
+        {
+            nNodes = std::max(nNodes, static_cast<uint32_t>(std::strtoul(line.c_str() + pos + 7, nullptr, 10)) + 1);
+        }
+    }
+    return nNodes;
+}
+
+bool
+Ns2BinaryTraceCompiler::Write(const std::string& outFile)
+{
+    Finish();
+
+    double startTime = 0;
+    double endTime = 0;
+    for (const NodeState& state: m_nodes)
+    {
+        if (!state.records.empty())
+        {
+            startTime = std::min(startTime, state.records.front().time);
+            endTime = std::max(endTime, state.records.back().time);
+        }
+    }
+    uint32_t nodeCount = m_nodes.size();
+    uint32_t bucketCount = static_cast<uint32_t>((endTime - startTime) / m_bucketWidth) + 1;
+
+    Ns2BinaryTraceHeader header{};
+    std::memcpy(header.magic, NS2_BINARY_TRACE_MAGIC, sizeof(header.magic));
+    header.version = NS2_BINARY_TRACE_VERSION;
+    header.nodeCount = nodeCount;
+    header.recordCount = GetNRecords();
+    header.bucketCount = bucketCount;
+    header.bucketWidth = m_bucketWidth;
+    header.startTime = startTime;
+    header.endTime = endTime;
+    header.nodeTableOffset = sizeof(Ns2BinaryTraceHeader);
+    header.indexOffset = header.nodeTableOffset + uint64_t(nodeCount) * sizeof(Ns2BinaryTraceNode);
+    header.recordOffset = header.indexOffset + uint64_t(nodeCount) * bucketCount * sizeof(uint32_t);
+    header.recordOffset = (header.recordOffset + 7) & ~uint64_t(7);
+
+    std::vector<Ns2BinaryTraceNode> nodeTable(nodeCount);
+    std::vector<uint32_t> index(uint64_t(nodeCount) * bucketCount, 0);
+    uint64_t first = 0;
+    for (uint32_t n = 0; n < nodeCount; n++)
+    {
+        const std::vector<Ns2BinaryTraceRecord>& records = m_nodes[n].records;
+        nodeTable[n].firstRecord = first;
+        nodeTable[n].recordCount = records.size();
+        first += records.size();
+
+        uint32_t i = 0;
+        for (uint32_t b = 0; b < bucketCount && !records.empty(); b++)
+        {
+            double bucketStart = startTime + b * m_bucketWidth;
+            while (i + 1 < records.size() && records[i + 1].time <= bucketStart)
+            {
+                i++;
+            }
+            index[uint64_t(n) * bucketCount + b] = i;
+        }
+    }
+
+    std::ofstream out{outFile, std::ios::binary | std::ios::trunc};
+    if (!out)
+    {
+        return false;
+    }
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(nodeTable.data()), nodeTable.size() * sizeof(Ns2BinaryTraceNode));
+    out.write(reinterpret_cast<const char*>(index.data()), index.size() * sizeof(uint32_t));
+    uint64_t padding = header.recordOffset - (header.indexOffset + index.size() * sizeof(uint32_t));
+    const char zeros[8] = {};
+    out.write(zeros, padding);
+    for (const NodeState& state: m_nodes)
+    {
+        out.write(reinterpret_cast<const char*>(state.records.data()),
+                  state.records.size() * sizeof(Ns2BinaryTraceRecord));
+    }
+    return static_cast<bool>(out);
+}
+
+// ===================================================================== //
+
+NS_OBJECT_ENSURE_REGISTERED(Ns2BinaryTrace);
+
+TypeId
+Ns2BinaryTrace::GetTypeId(void)
+{
+    static TypeId tid =
+        TypeId("ns3::Ns2BinaryTrace")
+            .SetParent<Object>()
+            .SetGroupName("Mobility")
+            .AddConstructor<Ns2BinaryTrace>();
+    return tid;
+}
+
+bool
+Ns2BinaryTrace::Load(const std::string& filename)
+{
+    m_header = nullptr;
+    if (!m_file.Open(filename) || m_file.GetSize() < sizeof(Ns2BinaryTraceHeader))
+    {
+        return false;
+    }
+    const uint8_t* base = m_file.GetData();
+    const Ns2BinaryTraceHeader* header = reinterpret_cast<const Ns2BinaryTraceHeader*>(base);
+    if (std::memcmp(header->magic, NS2_BINARY_TRACE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != NS2_BINARY_TRACE_VERSION ||
+        header->recordOffset + header->recordCount * sizeof(Ns2BinaryTraceRecord) > m_file.GetSize())
+    {
+        m_file.Close();
+        return false;
+    }
+    m_header = header;
+    m_nodes = reinterpret_cast<const Ns2BinaryTraceNode*>(base + header->nodeTableOffset);
+    m_index = reinterpret_cast<const uint32_t*>(base + header->indexOffset);
+    m_records = reinterpret_cast<const Ns2BinaryTraceRecord*>(base + header->recordOffset);
+    return true;
+}
+
+uint32_t
+Ns2BinaryTrace::GetNNodes() const
+{
+    return m_header ? m_header->nodeCount : 0;
+}
+
+uint32_t
+Ns2BinaryTrace::GetNRecords(uint32_t node) const
+{
+    return m_nodes[node].recordCount;
+}
+
+const Ns2BinaryTraceRecord*
+Ns2BinaryTrace::GetRecords(uint32_t node) const
+{
+    return m_records + m_nodes[node].firstRecord;
+}
+
+uint32_t
+Ns2BinaryTrace::FindRecord(uint32_t node, double time) const
+{
+    const Ns2BinaryTraceNode& entry = m_nodes[node];
+    if (entry.recordCount == 0)
+    {
+        return 0;
+    }
+    double bucket = (time - m_header->startTime) / m_header->bucketWidth;
+    uint32_t b = 0;
+    if (bucket > 0)
+    {
+        b = std::min(static_cast<uint32_t>(bucket), m_header->bucketCount - 1);
+    }
+    uint32_t i = m_index[uint64_t(node) * m_header->bucketCount + b];
+    const Ns2BinaryTraceRecord* records = m_records + entry.firstRecord;
+    while (i + 1 < entry.recordCount && records[i + 1].time <= time)
+    {
+        i++;
+    }
+    return i;
+}
+
+double
+Ns2BinaryTrace::GetStartTime() const
+{
+    return m_header->startTime;
+}
+
+double
+Ns2BinaryTrace::GetEndTime() const
+{
+    return m_header->endTime;
+}
+
+// ===================================================================== //
+
+NS_OBJECT_ENSURE_REGISTERED(TraceMobilityModel);
+
+TypeId
+TraceMobilityModel::GetTypeId(void)
+{
+    static TypeId tid =
+        TypeId("ns3::TraceMobilityModel")
+            .SetParent<MobilityModel>()
+            .SetGroupName("Mobility")
+            .AddConstructor<TraceMobilityModel>();
+    return tid;
+}
+
+void
+TraceMobilityModel::SetTrace(Ptr<Ns2BinaryTrace> trace, uint32_t node)
+{
+    m_advance.Cancel();
+    m_trace = trace;
+    m_records = trace->GetRecords(node);
+    m_nRecords = trace->GetNRecords(node);
+    m_cursor = trace->FindRecord(node, Simulator::Now().GetSeconds());
+    ScheduleAdvance();
+}
+
+void
+TraceMobilityModel::DoDispose()
+{
+    m_advance.Cancel();
+    m_trace = nullptr;
+    m_records = nullptr;
+    m_nRecords = 0;
+    MobilityModel::DoDispose();
+}
+
+void
+TraceMobilityModel::ScheduleAdvance()
+{
+    if (m_cursor + 1 < m_nRecords)
+    {
+        Time at = Seconds(m_records[m_cursor + 1].time);
+        m_advance = Simulator::Schedule(Max(at - Simulator::Now(), Seconds(0)), &TraceMobilityModel::Advance, this);
+    }
+}
+
+void
+TraceMobilityModel::Advance()
+{
+    PROFILE_SCOPE("TraceMobilityModel::Advance");
+    double now = Simulator::Now().GetSeconds();
+    m_cursor++;
+    // zero length legs are jumps, step over them in one go
+    while (m_cursor + 1 < m_nRecords && m_records[m_cursor + 1].time <= now)
+    {
+        m_cursor++;
+    }
+    NotifyCourseChange();
+    ScheduleAdvance();
+}
+
+Vector
+TraceMobilityModel::DoGetPosition() const
+{
+    const Ns2BinaryTraceRecord& from = m_records[m_cursor];
+    if (m_cursor + 1 >= m_nRecords)
+    {
+        return Vector(from.x, from.y, from.z);
+    }
+    const Ns2BinaryTraceRecord& to = m_records[m_cursor + 1];
+    double f = (Simulator::Now().GetSeconds() - from.time) / (to.time - from.time);
+    f = std::min(std::max(f, 0.0), 1.0);
+    return Vector(from.x + (to.x - from.x) * f, from.y + (to.y - from.y) * f, from.z + (to.z - from.z) * f);
+}
+
+void
+TraceMobilityModel::DoSetPosition(const Vector& position)
+{
+    NS_FATAL_ERROR("the position of a trace driven node cannot be set");
+}
+
+Vector
+TraceMobilityModel::DoGetVelocity() const
+{
+    double now = Simulator::Now().GetSeconds();
+    if (m_cursor + 1 >= m_nRecords || now < m_records[m_cursor].time)
+    {
+        return Vector(0.0, 0.0, 0.0);
+    }
+    const Ns2BinaryTraceRecord& from = m_records[m_cursor];
+    const Ns2BinaryTraceRecord& to = m_records[m_cursor + 1];
+    double dt = to.time - from.time;
+    return Vector((to.x - from.x) / dt, (to.y - from.y) / dt, (to.z - from.z) / dt);
+}
+
+// ===================================================================== //
+
+Ns2BinaryTraceHelper::Ns2BinaryTraceHelper(std::string filename)
+  : m_trace{CreateObject<Ns2BinaryTrace>()}
+{
+    NS_ABORT_MSG_IF(!m_trace->Load(filename), "could not load binary mobility trace " << filename);
+}
+
+Ns2BinaryTraceHelper::Ns2BinaryTraceHelper(Ptr<Ns2BinaryTrace> trace)
+  : m_trace{trace}
+{
+}
+
+void
+Ns2BinaryTraceHelper::Install() const
+{
+    uint32_t nNodes = std::min(m_trace->GetNNodes(), NodeList::GetNNodes());
+    for (uint32_t i = 0; i < nNodes; i++)
+    {
+        uint32_t nRecords = m_trace->GetNRecords(i);
+        if (nRecords == 0)
+        {
+            continue;
+        }
+        Ptr<Node> node = NodeList::GetNode(i);
+        NS_ABORT_MSG_IF(node->GetObject<MobilityModel>(), "node " << i << " already has a mobility model");
+        Ptr<WaypointMobilityModel> model = CreateObject<WaypointMobilityModel>();
+        node->AggregateObject(model);
+        const Ns2BinaryTraceRecord* records = m_trace->GetRecords(i);
+        for (uint32_t k = 0; k < nRecords; k++)
+        {
+            model->AddWaypoint(Waypoint(Seconds(records[k].time), Vector(records[k].x, records[k].y, records[k].z)));
+        }
+    }
+}
+
+void
+Ns2BinaryTraceHelper::InstallLazy() const
+{
+    uint32_t nNodes = std::min(m_trace->GetNNodes(), NodeList::GetNNodes());
+    for (uint32_t i = 0; i < nNodes; i++)
+    {
+        if (m_trace->GetNRecords(i) == 0)
+        {
+            continue;
+        }
+        Ptr<Node> node = NodeList::GetNode(i);
+        NS_ABORT_MSG_IF(node->GetObject<MobilityModel>(), "node " << i << " already has a mobility model");
+        Ptr<TraceMobilityModel> model = CreateObject<TraceMobilityModel>();
+        model->SetTrace(m_trace, i);
+        node->AggregateObject(model);
+    }
+}
+
+Ptr<Ns2BinaryTrace>
+Ns2BinaryTraceHelper::GetTrace() const
+{
+    return m_trace;
+}
+
+#endif
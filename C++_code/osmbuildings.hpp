@@ -0,0 +1,606 @@
+#ifndef OSMBUILDINGS_HPP
+#define OSMBUILDINGS_HPP
+
+#include "ns3/abort.h"
+#include "ns3/box.h"
+#include "ns3/building.h"
+#include "ns3/double.h"
+#include "ns3/enum.h"
+#include "ns3/mobility-model.h"
+#include "ns3/object.h"
+#include "ns3/pointer.h"
+#include "ns3/propagation-loss-model.h"
+#include "ns3/vector.h"
+
+#include "profiler.hpp"
+#include "sumofcd.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace ns3;
+
+// Building footprints from the polygons of a sumo polyconvert file (SUMO_CardiffMobility/osm.poly.xml.gz),
+// kept as the real polygons and indexed by a bounding volume hierarchy, so "is this point indoors" and
+// "how many walls does this link cross" cost O(log n) in the number of buildings instead of a scan of
+// all of them.
+//
+// Polyconvert writes its shapes in the frame of the net it was given (osm.net.xml.gz), which is not the
+// frame of the net the vehicles drive on when that one was cut out and rebuilt (new.net.xml, which
+// cardiff.tcl comes from). Both frames are the projection shifted by the netOffset of their <location>, so
+// passing the net of the trace to Load moves the footprints by the difference of the two offsets.
+//
+// Only polygons of a building.* type are kept. Heights are not in the polygons: the index is 2D, and
+// the ns-3 buildings made by CreateBuildings all get the Height attribute.
+class OsmBuildings: public Object{
+  public:
+    static TypeId GetTypeId(void);
+    OsmBuildings() = default;
+
+    struct Footprint
+    {
+      std::string id;
+      std::string type;           // osm type, e.g. "building.university"
+      uint32_t first;             // first corner in GetCorners
+      uint32_t count;             // corners, without repeating the first
+      double minX;
+      double minY;
+      double maxX;
+      double maxY;
+    };
+
+    // netFile, if set, is the net the mobility was made on (.xml or .xml.gz)
+    bool Load(const std::string& polyFile, const std::string& netFile = "");
+    void AddFootprint(const std::string& id, const std::string& type, const std::vector<Vector2D>& corners);
+
+    uint32_t GetN() const;
+    const Footprint& GetFootprint(uint32_t i) const;
+    const std::vector<Vector2D>& GetCorners() const;
+    // what Load added to the polygon coordinates to put them in the frame of the net
+    Vector2D GetOffset() const;
+
+    // index of the footprint p lies in, -1 outdoors
+    int32_t GetFootprintAt(const Vector& p) const;
+    bool IsIndoor(const Vector& p) const;
+    // footprint edges crossed by the segment from a to b
+    uint32_t CountWalls(const Vector& a, const Vector& b) const;
+
+    // one ns-3 Building per footprint, its bounding box, for the models that look buildings up in
+    // BuildingList (they scan the whole list for every position change)
+    uint32_t CreateBuildings() const;
+
+  private:
+    struct BvhNode
+    {
+      double minX;
+      double minY;
+      double maxX;
+      double maxY;
+      uint32_t first;             // leaf: first entry of m_order; inner: index of the right child
+      uint32_t count;             // leaf: footprints in it; inner: 0, the left child follows the node
+    };
+    static const uint32_t LEAF_SIZE = 4;
+    static const uint32_t MAX_DEPTH = 64;
+
+    void BuildIndex() const;
+    uint32_t Build(uint32_t begin, uint32_t end) const;
+    bool Contains(const Footprint& footprint, double x, double y) const;
+    uint32_t Crossings(const Footprint& footprint, double ax, double ay, double bx, double by) const;
+
+    static bool ReadOffset(const std::string& tag, Vector2D& offset);
+    static Building::BuildingType_t GetBuildingType(const std::string& type);
+
+    std::vector<Footprint> m_footprints;
+    std::vector<Vector2D> m_corners;
+    Vector2D m_offset{0, 0};
+    double m_height{10};
+    Building::ExtWallsType_t m_wallsType{Building::ConcreteWithWindows};
+
+    // built at the first query after a footprint is added
+    mutable std::vector<BvhNode> m_nodes;
+    mutable std::vector<uint32_t> m_order;
+    mutable bool m_indexed{false};
+};
+
+// Loss of the walls of an OsmBuildings a link crosses, WallLoss dB each, added to a loss model chain
+// after an outdoor model (final_vanet puts it after the hybrid buildings model). A node inside a
+// footprint crosses its walls once on the way out.
+class BuildingWallsPropagationLossModel: public PropagationLossModel{
+  public:
+    static TypeId GetTypeId(void);
+    BuildingWallsPropagationLossModel() = default;
+
+  protected:
+    void DoDispose() override;
+    double DoCalcRxPower(double txPowerDbm,
+                         Ptr<MobilityModel> a,
+                         Ptr<MobilityModel> b) const override;
+    int64_t DoAssignStreams(int64_t stream) override;
+
+  private:
+    Ptr<OsmBuildings> m_buildings;
+    double m_wallLoss;
+};
+
+// ===================================================================== //
+
+NS_OBJECT_ENSURE_REGISTERED(OsmBuildings);
+
+TypeId
+OsmBuildings::GetTypeId(void)
+{
+    static TypeId tid =
+        TypeId("ns3::OsmBuildings")
+            .SetParent<Object>()
+            .SetGroupName("Buildings")
+            .AddConstructor<OsmBuildings>()
+            .AddAttribute("Height",
+                          "Height (m) of the buildings made by CreateBuildings.",
+                          DoubleValue(10.0),
+                          MakeDoubleAccessor(&OsmBuildings::m_height),
+                          MakeDoubleChecker<double>(0.0))
+            .AddAttribute("ExtWallsType",
+                          "External walls of the buildings made by CreateBuildings.",
+                          EnumValue(Building::ConcreteWithWindows),
+                          MakeEnumAccessor(&OsmBuildings::m_wallsType),
+                          MakeEnumChecker(Building::Wood,
+                                          "Wood",
+                                          Building::ConcreteWithWindows,
+                                          "ConcreteWithWindows",
+                                          Building::ConcreteWithoutWindows,
+                                          "ConcreteWithoutWindows",
+                                          Building::StoneBlocks,
+                                          "StoneBlocks"));
+    return tid;
+}
+
+bool
+OsmBuildings::ReadOffset(const std::string& tag, Vector2D& offset)
+{
+    const char* value = tag.compare(0, 9, "location ") == 0 ? FcdTokenizer::FindAttribute(tag, "netOffset") : nullptr;
+    if (!value)
+    {
+        return false;
+    }
+    char* end;
+    offset.x = std::strtod(value, &end);
+    offset.y = *end == ',' ? std::strtod(end + 1, nullptr) : 0.0;
+    return true;
+}
+
+bool
+OsmBuildings::Load(const std::string& polyFile, const std::string& netFile)
+{
+    Vector2D polyOffset{0, 0};
+    Vector2D netOffset{0, 0};
+    std::string tag;
+    if (!netFile.empty())
+    {
+        // the location comes first, the rest of the net is not needed
+        FcdTokenizer net;
+        bool found = false;
+        if (net.Open(netFile))
+        {
+            while (!found && net.NextTag(tag))
+            {
+                found = ReadOffset(tag, netOffset);
+            }
+        }
+        if (!found)
+        {
+            return false;
+        }
+    }
+    FcdTokenizer poly;
+    if (!poly.Open(polyFile))
+    {
+        return false;
+    }
+    bool located = false;
+    std::size_t before = m_footprints.size();
+    std::vector<Vector2D> corners;
+    while (poly.NextTag(tag))
+    {
+        if (!located && ReadOffset(tag, polyOffset))
+        {
+            located = true;
+            m_offset = netFile.empty() ? Vector2D{0, 0}
+                                       : Vector2D{netOffset.x - polyOffset.x, netOffset.y - polyOffset.y};
+            continue;
+        }
+        if (tag.compare(0, 5, "poly ") != 0)
+        {
+            continue;
+        }
+        const char* type = FcdTokenizer::FindAttribute(tag, "type");
+        const char* shape = FcdTokenizer::FindAttribute(tag, "shape");
+        const char* typeEnd = type ? std::strchr(type, '"') : nullptr;
+        if (!typeEnd || !shape || std::strncmp(type, "building", 8) != 0)
+        {
+            continue;
+        }
+        // the offset is only known from the location on, and polyconvert writes it first
+        if (!located)
+        {
+            return false;
+        }
+        // shapes in lon/lat (polyconvert --proj.plain-geo) would need the projection itself
+        const char* geo = FcdTokenizer::FindAttribute(tag, "geo");
+        NS_ABORT_MSG_IF(geo && (*geo == '1' || *geo == 't'), polyFile << " holds geo shapes, write it projected");
+        corners.clear();
+        const char* p = shape;
+        while (*p && *p != '"')
+        {
+            char* end;
+            double x = std::strtod(p, &end);
+            if (end == p || *end != ',')
+            {
+                break;
+            }
+            double y = std::strtod(end + 1, &end);
+            corners.push_back({x + m_offset.x, y + m_offset.y});
+            p = end;
+            while (*p == ' ')
+            {
+                p++;
+            }
+        }
+        const char* id = FcdTokenizer::FindAttribute(tag, "id");
+        const char* idEnd = id ? std::strchr(id, '"') : nullptr;
+        AddFootprint(idEnd ? std::string(id, idEnd) : "", std::string(type, typeEnd), corners);
+    }
+    return located && m_footprints.size() > before;
+}
+
+void
+OsmBuildings::AddFootprint(const std::string& id, const std::string& type, const std::vector<Vector2D>& corners)
+{
+    // sumo closes its shapes by repeating the first corner
+    uint32_t count = corners.size();
+    if (count > 1 && corners.front().x == corners.back().x && corners.front().y == corners.back().y)
+    {
+        count--;
+    }
+    if (count < 3)
+    {
+        return;
+    }
+    Footprint footprint{id, type, static_cast<uint32_t>(m_corners.size()), count,
+                        corners[0].x, corners[0].y, corners[0].x, corners[0].y};
+    for (uint32_t i = 0; i < count; i++)
+    {
+        m_corners.push_back(corners[i]);
+        footprint.minX = std::min(footprint.minX, corners[i].x);
+        footprint.minY = std::min(footprint.minY, corners[i].y);
+        footprint.maxX = std::max(footprint.maxX, corners[i].x);
+        footprint.maxY = std::max(footprint.maxY, corners[i].y);
+    }
+    m_footprints.push_back(footprint);
+    m_indexed = false;
+}
+
+uint32_t
+OsmBuildings::GetN() const
+{
+    return m_footprints.size();
+}
+
+const OsmBuildings::Footprint&
+OsmBuildings::GetFootprint(uint32_t i) const
+{
+    return m_footprints[i];
+}
+
+const std::vector<Vector2D>&
+OsmBuildings::GetCorners() const
+{
+    return m_corners;
+}
+
+Vector2D
+OsmBuildings::GetOffset() const
+{
+    return m_offset;
+}
+
+void
+OsmBuildings::BuildIndex() const
+{
+    m_order.resize(m_footprints.size());
+    for (uint32_t i = 0; i < m_order.size(); i++)
+    {
+        m_order[i] = i;
+    }
+    m_nodes.clear();
+    m_nodes.reserve(2 * m_footprints.size() / LEAF_SIZE + 1);
+    if (!m_footprints.empty())
+    {
+        Build(0, m_order.size());
+    }
+    m_indexed = true;
+}
+
+// median split of m_order[begin, end) along the longer side of the box of the footprint centres
+uint32_t
+OsmBuildings::Build(uint32_t begin, uint32_t end) const
+{
+    uint32_t index = m_nodes.size();
+    m_nodes.push_back({0, 0, 0, 0, begin, end - begin});
+    BvhNode node = m_nodes[index];
+    const Footprint& front = m_footprints[m_order[begin]];
+    node.minX = front.minX;
+    node.minY = front.minY;
+    node.maxX = front.maxX;
+    node.maxY = front.maxY;
+    double cMinX = front.minX + front.maxX;
+    double cMinY = front.minY + front.maxY;
+    double cMaxX = cMinX;
+    double cMaxY = cMinY;
+    for (uint32_t i = begin; i < end; i++)
+    {
+        const Footprint& f = m_footprints[m_order[i]];
+        node.minX = std::min(node.minX, f.minX);
+        node.minY = std::min(node.minY, f.minY);
+        node.maxX = std::max(node.maxX, f.maxX);
+        node.maxY = std::max(node.maxY, f.maxY);
+        cMinX = std::min(cMinX, f.minX + f.maxX);
+        cMinY = std::min(cMinY, f.minY + f.maxY);
+        cMaxX = std::max(cMaxX, f.minX + f.maxX);
+        cMaxY = std::max(cMaxY, f.minY + f.maxY);
+    }
+    if (end - begin > LEAF_SIZE)
+    {
+        bool alongX = cMaxX - cMinX >= cMaxY - cMinY;
+        uint32_t middle = begin + (end - begin) / 2;
+        std::nth_element(m_order.begin() + begin,
+                         m_order.begin() + middle,
+                         m_order.begin() + end,
+                         [this, alongX](uint32_t l, uint32_t r) {
+                             const Footprint& a = m_footprints[l];
+                             const Footprint& b = m_footprints[r];
+                             return alongX ? a.minX + a.maxX < b.minX + b.maxX : a.minY + a.maxY < b.minY + b.maxY;
+                         });
+        Build(begin, middle);
+        node.first = Build(middle, end);
+        node.count = 0;
+    }
+    m_nodes[index] = node;
+    return index;
+}
+
+bool
+OsmBuildings::Contains(const Footprint& footprint, double x, double y) const
+{
+    if (x < footprint.minX || x > footprint.maxX || y < footprint.minY || y > footprint.maxY)
+    {
+        return false;
+    }
+    // crossing number of a ray towards +x
+    bool inside = false;
+    const Vector2D* c = m_corners.data() + footprint.first;
+    for (uint32_t i = 0, j = footprint.count - 1; i < footprint.count; j = i++)
+    {
+        if ((c[i].y > y) != (c[j].y > y) && x < c[j].x + (y - c[j].y) * (c[i].x - c[j].x) / (c[i].y - c[j].y))
+        {
+            inside = !inside;
+        }
+    }
+    return inside;
+}
+
+uint32_t
+OsmBuildings::Crossings(const Footprint& footprint, double ax, double ay, double bx, double by) const
+{
+    // an edge is crossed when its ends lie on opposite sides of the link and the link's ends on opposite
+    // sides of the edge; "opposite" is half open so a link through a corner counts one of its two edges
+    auto side = [](double px, double py, double qx, double qy, double rx, double ry) {
+        return (qx - px) * (ry - py) - (qy - py) * (rx - px) > 0;
+    };
+    uint32_t n = 0;
+    const Vector2D* c = m_corners.data() + footprint.first;
+    for (uint32_t i = 0, j = footprint.count - 1; i < footprint.count; j = i++)
+    {
+        n += side(ax, ay, bx, by, c[j].x, c[j].y) != side(ax, ay, bx, by, c[i].x, c[i].y) &&
+             side(c[j].x, c[j].y, c[i].x, c[i].y, ax, ay) != side(c[j].x, c[j].y, c[i].x, c[i].y, bx, by);
+    }
+    return n;
+}
+
+int32_t
+OsmBuildings::GetFootprintAt(const Vector& p) const
+{
+    if (!m_indexed)
+    {
+        BuildIndex();
+    }
+    if (m_nodes.empty())
+    {
+        return -1;
+    }
+    uint32_t stack[MAX_DEPTH];
+    uint32_t top = 0;
+    stack[top++] = 0;
+    while (top > 0)
+    {
+        const BvhNode& node = m_nodes[stack[--top]];
+        if (p.x < node.minX || p.x > node.maxX || p.y < node.minY || p.y > node.maxY)
+        {
+            continue;
+        }
+        if (node.count > 0)
+        {
+            for (uint32_t i = node.first; i < node.first + node.count; i++)
+            {
+                if (Contains(m_footprints[m_order[i]], p.x, p.y))
+                {
+                    return m_order[i];
+                }
+            }
+            continue;
+        }
+        stack[top++] = node.first;
+        stack[top++] = &node - m_nodes.data() + 1;
+    }
+    return -1;
+}
+
+bool
+OsmBuildings::IsIndoor(const Vector& p) const
+{
+    return GetFootprintAt(p) >= 0;
+}
+
+uint32_t
+OsmBuildings::CountWalls(const Vector& a, const Vector& b) const
+{
+    if (!m_indexed)
+    {
+        BuildIndex();
+    }
+    if (m_nodes.empty())
+    {
+        return 0;
+    }
+    double dx = b.x - a.x;
+    double dy = b.y - a.y;
+    uint32_t walls = 0;
+    uint32_t stack[MAX_DEPTH];
+    uint32_t top = 0;
+    stack[top++] = 0;
+    while (top > 0)
+    {
+        const BvhNode& node = m_nodes[stack[--top]];
+        // slab test of the segment against the box
+        double t0 = 0;
+        double t1 = 1;
+        bool hit = true;
+        for (int axis = 0; axis < 2 && hit; axis++)
+        {
+            double origin = axis == 0 ? a.x : a.y;
+            double d = axis == 0 ? dx : dy;
+            double lo = axis == 0 ? node.minX : node.minY;
+            double hi = axis == 0 ? node.maxX : node.maxY;
+            if (d == 0)
+            {
+                hit = origin >= lo && origin <= hi;
+                continue;
+            }
+            double near = (lo - origin) / d;
+            double far = (hi - origin) / d;
+            if (near > far)
+            {
+                std::swap(near, far);
+            }
+            t0 = std::max(t0, near);
+            t1 = std::min(t1, far);
+            hit = t0 <= t1;
+        }
+        if (!hit)
+        {
+            continue;
+        }
+        if (node.count > 0)
+        {
+            for (uint32_t i = node.first; i < node.first + node.count; i++)
+            {
+                walls += Crossings(m_footprints[m_order[i]], a.x, a.y, b.x, b.y);
+            }
+            continue;
+        }
+        stack[top++] = node.first;
+        stack[top++] = &node - m_nodes.data() + 1;
+    }
+    return walls;
+}
+
+Building::BuildingType_t
+OsmBuildings::GetBuildingType(const std::string& type)
+{
+    for (const char* office: {"office", "university", "college", "school", "hospital", "public", "civic", "government"})
+    {
+        if (type.find(office) != std::string::npos)
+        {
+            return Building::Office;
+        }
+    }
+    for (const char* commercial: {"commercial", "retail", "shop", "supermarket", "hotel", "industrial", "warehouse"})
+    {
+        if (type.find(commercial) != std::string::npos)
+        {
+            return Building::Commercial;
+        }
+    }
+    return Building::Residential;
+}
+
+uint32_t
+OsmBuildings::CreateBuildings() const
+{
+    for (const Footprint& footprint: m_footprints)
+    {
+        Ptr<Building> building = CreateObject<Building>();
+        building->SetBoundaries(Box(footprint.minX, footprint.maxX, footprint.minY, footprint.maxY, 0.0, m_height));
+        building->SetBuildingType(GetBuildingType(footprint.type));
+        building->SetExtWallsType(m_wallsType);
+        building->SetNFloors(std::max(1, static_cast<int>(m_height / 3.0)));
+    }
+    return m_footprints.size();
+}
+
+// ===================================================================== //
+
+NS_OBJECT_ENSURE_REGISTERED(BuildingWallsPropagationLossModel);
+
+TypeId
+BuildingWallsPropagationLossModel::GetTypeId(void)
+{
+    static TypeId tid =
+        TypeId("ns3::BuildingWallsPropagationLossModel")
+            .SetParent<PropagationLossModel>()
+            .SetGroupName("Buildings")
+            .AddConstructor<BuildingWallsPropagationLossModel>()
+            .AddAttribute("Buildings",
+                          "The footprints whose walls attenuate the links.",
+                          PointerValue(),
+                          MakePointerAccessor(&BuildingWallsPropagationLossModel::m_buildings),
+                          MakePointerChecker<OsmBuildings>())
+            .AddAttribute("WallLoss",
+                          "Loss (dB) of each external wall crossed, 12 dB being stone blocks in the "
+                          "buildings models.",
+                          DoubleValue(12.0),
+                          MakeDoubleAccessor(&BuildingWallsPropagationLossModel::m_wallLoss),
+                          MakeDoubleChecker<double>(0.0));
+    return tid;
+}
+
+void
+BuildingWallsPropagationLossModel::DoDispose()
+{
+    m_buildings = nullptr;
+    PropagationLossModel::DoDispose();
+}
+
+double
+BuildingWallsPropagationLossModel::DoCalcRxPower(double txPowerDbm,
+                                                  Ptr<MobilityModel> a,
+                                                  Ptr<MobilityModel> b) const
+{
+    PROFILE_SCOPE("BuildingWallsPropagationLossModel::DoCalcRxPower");
+    if (!m_buildings)
+    {
+        return txPowerDbm;
+    }
+    return txPowerDbm - m_wallLoss * m_buildings->CountWalls(a->GetPosition(), b->GetPosition());
+}
+
+int64_t
+BuildingWallsPropagationLossModel::DoAssignStreams(int64_t stream)
+{
+    return 0;
+}
+
+#endif
@@ -0,0 +1,194 @@
+#ifndef PACKETTRACE_HPP
+#define PACKETTRACE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Binary trace of received packets, replacing the "T node received one packet from IP" lines.
+//
+// On disk, a PacketTraceHeader followed by PacketTraceRecord until the end of the file. decode_packets
+// turns it back into the text. Building with -DKAKA_NO_PACKET_TRACE removes every PACKET_TRACE call
+// site, arguments included, and makes Open a no-op, so no file is created and no writer thread started.
+
+struct PacketTraceHeader{
+  char magic[8];
+  uint32_t version;
+  uint32_t recordSize;
+};
+
+struct PacketTraceRecord{
+  double time;        // simulation seconds
+  uint32_t node;      // receiving node id
+  uint32_t sender;    // sender IPv4 address as Ipv4Address::Get(), 0 when it was not IPv4
+  uint32_t size;      // bytes
+  uint32_t flow;      // flow id, in order of first appearance
+};
+
+static_assert(sizeof(PacketTraceHeader) == 16, "packet trace header layout changed");
+static_assert(sizeof(PacketTraceRecord) == 24, "packet trace record layout changed");
+
+static const char PACKET_TRACE_MAGIC[8] = {'K', 'A', 'K', 'A', 'P', 'K', 'T', '1'};
+static const uint32_t PACKET_TRACE_VERSION = 1;
+
+#ifdef KAKA_NO_PACKET_TRACE
+#define PACKET_TRACE(trace, ...) do { } while (false)
+#else
+#define PACKET_TRACE(trace, ...) (trace).Append(PacketTraceRecord{__VA_ARGS__})
+#endif
+
+// Records go into a preallocated ring; a background thread writes it out in blocks of BlockRecords,
+// so the simulation thread neither formats nor does I/O per packet. Append must always be called from
+// the same thread, and only waits when the writer has fallen the whole ring behind.
+class PacketTraceWriter{
+  public:
+    PacketTraceWriter() = default;
+    ~PacketTraceWriter();
+
+    PacketTraceWriter(const PacketTraceWriter& src) = delete;
+    PacketTraceWriter& operator=(const PacketTraceWriter& src) = delete;
+
+    // ringRecords is rounded up to a whole number of blocks
+    bool Open(const std::string& filename, std::size_t blockRecords = 16384, std::size_t ringRecords = 262144);
+    // no-op while closed
+    void Append(const PacketTraceRecord& record);
+    // writes out everything appended, then stops the thread and closes the file
+    void Close();
+    bool IsOpen() const;
+
+  private:
+    void Run();
+    void WriteSpan(std::size_t from, std::size_t to);
+
+    std::ofstream m_file;
+    std::vector<PacketTraceRecord> m_ring;
+    std::size_t m_blockRecords{0};
+    std::thread m_thread;
+    std::atomic<bool> m_stop{false};
+    // record counts since Open; the ring slot of record i is i % m_ring.size()
+    alignas(64) std::atomic<std::size_t> m_written{0};
+    alignas(64) std::atomic<std::size_t> m_appended{0};
+};
+
+// ===================================================================== //
+
+PacketTraceWriter::~PacketTraceWriter()
+{
+    Close();
+}
+
+bool
+PacketTraceWriter::Open(const std::string& filename, std::size_t blockRecords, std::size_t ringRecords)
+{
+#ifdef KAKA_NO_PACKET_TRACE
+    return true;
+#else
+    Close();
+    m_file.open(filename, std::ios::binary | std::ios::trunc);
+    if (!m_file)
+    {
+        return false;
+    }
+    PacketTraceHeader header;
+    std::memcpy(header.magic, PACKET_TRACE_MAGIC, sizeof(header.magic));
+    header.version = PACKET_TRACE_VERSION;
+    header.recordSize = sizeof(PacketTraceRecord);
+    m_file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    m_blockRecords = std::max<std::size_t>(blockRecords, 1);
+    std::size_t blocks = std::max<std::size_t>((ringRecords + m_blockRecords - 1) / m_blockRecords, 2);
+    m_ring.assign(blocks * m_blockRecords, PacketTraceRecord{});
+    m_written = 0;
+    m_appended = 0;
+    m_stop = false;
+    m_thread = std::thread(&PacketTraceWriter::Run, this);
+    return true;
+#endif
+}
+
+void
+PacketTraceWriter::Append(const PacketTraceRecord& record)
+{
+    if (m_ring.empty())
+    {
+        return;
+    }
+    std::size_t appended = m_appended.load(std::memory_order_relaxed);
+    while (appended - m_written.load(std::memory_order_acquire) == m_ring.size())
+    {
+        std::this_thread::yield();
+    }
+    m_ring[appended % m_ring.size()] = record;
+    m_appended.store(appended + 1, std::memory_order_release);
+}
+
+void
+PacketTraceWriter::Close()
+{
+    if (m_thread.joinable())
+    {
+        m_stop = true;
+        m_thread.join();
+    }
+    if (m_file.is_open())
+    {
+        m_file.close();
+    }
+    m_ring.clear();
+    m_ring.shrink_to_fit();
+}
+
+bool
+PacketTraceWriter::IsOpen() const
+{
+    return m_file.is_open();
+}
+
+void
+PacketTraceWriter::Run()
+{
+    while (true)
+    {
+        // read the flag before the count, so records appended before Close are never left behind
+        bool stop = m_stop;
+        std::size_t appended = m_appended.load(std::memory_order_acquire);
+        std::size_t written = m_written.load(std::memory_order_relaxed);
+        // whole blocks while running, everything once stopping
+        std::size_t to = stop ? appended : written + (appended - written) / m_blockRecords * m_blockRecords;
+        if (to != written)
+        {
+            WriteSpan(written, to);
+            m_written.store(to, std::memory_order_release);
+        }
+        if (stop)
+        {
+            break;
+        }
+        if (to == written)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+    }
+    m_file.flush();
+}
+
+void
+PacketTraceWriter::WriteSpan(std::size_t from, std::size_t to)
+{
+    // at most two pieces, either side of the end of the ring
+    while (from != to)
+    {
+        std::size_t slot = from % m_ring.size();
+        std::size_t n = std::min(to - from, m_ring.size() - slot);
+        m_file.write(reinterpret_cast<const char*>(&m_ring[slot]), n * sizeof(PacketTraceRecord));
+        from += n;
+    }
+}
+
+#endif
@@ -0,0 +1,364 @@
+#ifndef PATHLOSSRASTER_HPP
+#define PATHLOSSRASTER_HPP
+
+#include "ns3/abort.h"
+#include "ns3/double.h"
+#include "ns3/mobility-model.h"
+#include "ns3/object.h"
+#include "ns3/pointer.h"
+#include "ns3/propagation-loss-model.h"
+#include "ns3/vector.h"
+
+#include "mappedfile.hpp"
+#include "profiler.hpp"
+#include "shadowingmap.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+
+using namespace ns3;
+
+// Path loss precomputed offline between every pair of cells of a square grid over the map, for a given
+// frequency, node height and set of buildings (build_raster writes it), so a simulation reads the loss
+// of a link instead of evaluating the building models for it.
+//
+// Samples are taken with both ends at cell centres; a link in between is interpolated bilinearly over
+// the transmitter's four nearest centres and again over the receiver's (16 samples). What is stored and
+// interpolated is the loss minus 20 log10(distance), which varies slowly, and the log of the actual
+// distance is added back, so short links are not smeared across the steep part of the loss curve.
+// Positions outside the grid are clamped to its edge and heights are ignored.
+//
+// On disk:
+//
+//   PathLossRasterHeader
+//   float  [nX * nY][tilesX * tilesY * tileSize^2]     one row per transmitter cell (j * nX + i)
+//
+// A row holds the receiver cells in tiles of tileSize x tileSize, tile after tile, so the four cells
+// around a receiver are mostly in the same cache line. Cells of the padding past nX, nY are 0.
+
+struct PathLossRasterHeader{
+  char magic[8];
+  uint32_t version;
+  uint32_t tileSize;
+  uint32_t nX;
+  uint32_t nY;
+  uint32_t tilesX;
+  uint32_t tilesY;
+  double minX;
+  double minY;
+  double cellSize;
+  double frequency;
+  double height;
+  uint64_t dataOffset;
+};
+
+static_assert(sizeof(PathLossRasterHeader) == 80, "path loss raster header layout changed");
+
+static const char PATH_LOSS_RASTER_MAGIC[8] = {'K', 'A', 'K', 'A', 'P', 'L', 'R', '1'};
+static const uint32_t PATH_LOSS_RASTER_VERSION = 1;
+
+class PathLossRaster: public Object{
+  public:
+    static TypeId GetTypeId(void);
+    PathLossRaster() = default;
+
+    // loss (dB) between two points at the given height, evaluated once per pair of cell centres
+    typedef std::function<double(const Vector& a, const Vector& b)> LossFunction;
+    static const uint32_t TILE_SIZE = 8;
+
+    // samples loss over the cells of cellSize covering [minX, maxX] x [minY, maxY] and writes the raster;
+    // progress, if set, is called after each transmitter cell with the cells done and the total
+    static bool Build(const std::string& filename,
+                      double minX,
+                      double minY,
+                      double maxX,
+                      double maxY,
+                      double cellSize,
+                      double height,
+                      double frequency,
+                      const LossFunction& loss,
+                      const std::function<void(uint32_t, uint32_t)>& progress = nullptr);
+
+    bool Load(const std::string& filename);
+    bool IsLoaded() const;
+    const PathLossRasterHeader& GetHeader() const;
+
+    // interpolated loss (dB) of the link between a and b
+    double GetLoss(const Vector& a, const Vector& b) const;
+
+  private:
+    struct Axis
+    {
+      uint32_t i0;
+      uint32_t i1;
+      double t;
+    };
+
+    Axis Locate(double x, double min, uint32_t n) const;
+    // column of receiver cell (i, j) in a row
+    static uint64_t GetColumn(uint32_t i, uint32_t j, uint32_t tilesX);
+    static double DistanceTerm(double d);
+
+    MappedFile m_file;
+    const PathLossRasterHeader* m_header{nullptr};
+    const float* m_data{nullptr};
+    uint64_t m_rowLength{0};
+};
+
+// Loss of a link read from a PathLossRaster, with optional shadowing from a ShadowingMap of ShadowSigma
+// dB, in place of the building models the raster was computed from.
+class RasterPropagationLossModel: public PropagationLossModel{
+  public:
+    static TypeId GetTypeId(void);
+    RasterPropagationLossModel() = default;
+
+  protected:
+    void DoDispose() override;
+    double DoCalcRxPower(double txPowerDbm,
+                         Ptr<MobilityModel> a,
+                         Ptr<MobilityModel> b) const override;
+    int64_t DoAssignStreams(int64_t stream) override;
+
+  private:
+    Ptr<PathLossRaster> m_raster;
+    double m_shadowSigma;
+    mutable Ptr<ShadowingMap> m_map;
+};
+
+// ===================================================================== //
+
+NS_OBJECT_ENSURE_REGISTERED(PathLossRaster);
+
+TypeId
+PathLossRaster::GetTypeId(void)
+{
+    static TypeId tid = TypeId("ns3::PathLossRaster")
+                            .SetParent<Object>()
+                            .SetGroupName("Propagation")
+                            .AddConstructor<PathLossRaster>();
+    return tid;
+}
+
+double
+PathLossRaster::DistanceTerm(double d)
+{
+    return 20 * std::log10(std::max(d, 1.0));
+}
+
+bool
+PathLossRaster::Build(const std::string& filename,
+                      double minX,
+                      double minY,
+                      double maxX,
+                      double maxY,
+                      double cellSize,
+                      double height,
+                      double frequency,
+                      const LossFunction& loss,
+                      const std::function<void(uint32_t, uint32_t)>& progress)
+{
+    NS_ABORT_MSG_IF(cellSize <= 0 || maxX <= minX || maxY <= minY, "the raster needs an area and a cell size");
+    PathLossRasterHeader header{};
+    std::memcpy(header.magic, PATH_LOSS_RASTER_MAGIC, sizeof(header.magic));
+    header.version = PATH_LOSS_RASTER_VERSION;
+    header.tileSize = TILE_SIZE;
+    header.nX = static_cast<uint32_t>(std::ceil((maxX - minX) / cellSize));
+    header.nY = static_cast<uint32_t>(std::ceil((maxY - minY) / cellSize));
+    header.tilesX = (header.nX + TILE_SIZE - 1) / TILE_SIZE;
+    header.tilesY = (header.nY + TILE_SIZE - 1) / TILE_SIZE;
+    header.minX = minX;
+    header.minY = minY;
+    header.cellSize = cellSize;
+    header.frequency = frequency;
+    header.height = height;
+    header.dataOffset = sizeof(PathLossRasterHeader);
+
+    std::ofstream file(filename, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!file)
+    {
+        return false;
+    }
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    std::vector<float> row(uint64_t(header.tilesX) * header.tilesY * TILE_SIZE * TILE_SIZE, 0.0f);
+    uint32_t cells = header.nX * header.nY;
+    for (uint32_t tj = 0; tj < header.nY; tj++)
+    {
+        for (uint32_t ti = 0; ti < header.nX; ti++)
+        {
+            Vector tx(minX + (ti + 0.5) * cellSize, minY + (tj + 0.5) * cellSize, height);
+            for (uint32_t rj = 0; rj < header.nY; rj++)
+            {
+                for (uint32_t ri = 0; ri < header.nX; ri++)
+                {
+                    Vector rx(minX + (ri + 0.5) * cellSize, minY + (rj + 0.5) * cellSize, height);
+                    // a cell with itself is sampled half a cell apart, the models have no loss at 0 m
+                    if (ri == ti && rj == tj)
+                    {
+                        rx.x += cellSize / 2;
+                    }
+                    double d = std::hypot(rx.x - tx.x, rx.y - tx.y);
+                    row[GetColumn(ri, rj, header.tilesX)] = loss(tx, rx) - DistanceTerm(d);
+                }
+            }
+            file.write(reinterpret_cast<const char*>(row.data()), row.size() * sizeof(float));
+            if (progress)
+            {
+                progress(tj * header.nX + ti + 1, cells);
+            }
+        }
+    }
+    return static_cast<bool>(file);
+}
+
+bool
+PathLossRaster::Load(const std::string& filename)
+{
+    m_header = nullptr;
+    if (!m_file.Open(filename) || m_file.GetSize() < sizeof(PathLossRasterHeader))
+    {
+        return false;
+    }
+    const PathLossRasterHeader* header = reinterpret_cast<const PathLossRasterHeader*>(m_file.GetData());
+    uint64_t rowLength = uint64_t(header->tilesX) * header->tilesY * header->tileSize * header->tileSize;
+    if (std::memcmp(header->magic, PATH_LOSS_RASTER_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != PATH_LOSS_RASTER_VERSION || header->tileSize != TILE_SIZE || header->nX == 0 ||
+        header->nY == 0 ||
+        header->dataOffset + uint64_t(header->nX) * header->nY * rowLength * sizeof(float) > m_file.GetSize())
+    {
+        m_file.Close();
+        return false;
+    }
+    m_header = header;
+    m_data = reinterpret_cast<const float*>(m_file.GetData() + header->dataOffset);
+    m_rowLength = rowLength;
+    return true;
+}
+
+bool
+PathLossRaster::IsLoaded() const
+{
+    return m_header != nullptr;
+}
+
+const PathLossRasterHeader&
+PathLossRaster::GetHeader() const
+{
+    return *m_header;
+}
+
+uint64_t
+PathLossRaster::GetColumn(uint32_t i, uint32_t j, uint32_t tilesX)
+{
+    uint64_t tile = uint64_t(j / TILE_SIZE) * tilesX + i / TILE_SIZE;
+    return tile * TILE_SIZE * TILE_SIZE + (j % TILE_SIZE) * TILE_SIZE + i % TILE_SIZE;
+}
+
+PathLossRaster::Axis
+PathLossRaster::Locate(double x, double min, uint32_t n) const
+{
+    double u = std::clamp((x - min) / m_header->cellSize - 0.5, 0.0, n - 1.0);
+    uint32_t i0 = std::min(static_cast<uint32_t>(u), n - 1);
+    return {i0, std::min(i0 + 1, n - 1), u - i0};
+}
+
+double
+PathLossRaster::GetLoss(const Vector& a, const Vector& b) const
+{
+    PROFILE_SCOPE("PathLossRaster::GetLoss");
+    const PathLossRasterHeader& h = *m_header;
+    Axis ax = Locate(a.x, h.minX, h.nX);
+    Axis ay = Locate(a.y, h.minY, h.nY);
+    Axis bx = Locate(b.x, h.minX, h.nX);
+    Axis by = Locate(b.y, h.minY, h.nY);
+    uint64_t b00 = GetColumn(bx.i0, by.i0, h.tilesX);
+    uint64_t b10 = GetColumn(bx.i1, by.i0, h.tilesX);
+    uint64_t b01 = GetColumn(bx.i0, by.i1, h.tilesX);
+    uint64_t b11 = GetColumn(bx.i1, by.i1, h.tilesX);
+    auto receiver = [&](uint32_t i, uint32_t j) {
+        const float* row = m_data + (uint64_t(j) * h.nX + i) * m_rowLength;
+        return (1 - by.t) * ((1 - bx.t) * row[b00] + bx.t * row[b10]) +
+               by.t * ((1 - bx.t) * row[b01] + bx.t * row[b11]);
+    };
+    double residual = (1 - ay.t) * ((1 - ax.t) * receiver(ax.i0, ay.i0) + ax.t * receiver(ax.i1, ay.i0)) +
+                      ay.t * ((1 - ax.t) * receiver(ax.i0, ay.i1) + ax.t * receiver(ax.i1, ay.i1));
+    return residual + DistanceTerm(std::hypot(b.x - a.x, b.y - a.y));
+}
+
+// ===================================================================== //
+
+NS_OBJECT_ENSURE_REGISTERED(RasterPropagationLossModel);
+
+TypeId
+RasterPropagationLossModel::GetTypeId(void)
+{
+    static TypeId tid =
+        TypeId("ns3::RasterPropagationLossModel")
+            .SetParent<PropagationLossModel>()
+            .SetGroupName("Propagation")
+            .AddConstructor<RasterPropagationLossModel>()
+            .AddAttribute("Raster",
+                          "The loaded raster the losses are read from.",
+                          PointerValue(),
+                          MakePointerAccessor(&RasterPropagationLossModel::m_raster),
+                          MakePointerChecker<PathLossRaster>())
+            .AddAttribute("ShadowSigma",
+                          "Standard deviation (dB) of the shadowing added from a ShadowingMap, 0 for none.",
+                          DoubleValue(0.0),
+                          MakeDoubleAccessor(&RasterPropagationLossModel::m_shadowSigma),
+                          MakeDoubleChecker<double>(0.0))
+            .AddAttribute("ShadowingMap",
+                          "The field the shadowing is read from; a default one is made at the first frame if "
+                          "none is set.",
+                          PointerValue(),
+                          MakePointerAccessor(&RasterPropagationLossModel::m_map),
+                          MakePointerChecker<ShadowingMap>());
+    return tid;
+}
+
+void
+RasterPropagationLossModel::DoDispose()
+{
+    m_raster = nullptr;
+    m_map = nullptr;
+    PropagationLossModel::DoDispose();
+}
+
+double
+RasterPropagationLossModel::DoCalcRxPower(double txPowerDbm,
+                                          Ptr<MobilityModel> a,
+                                          Ptr<MobilityModel> b) const
+{
+    PROFILE_SCOPE("RasterPropagationLossModel::DoCalcRxPower");
+    NS_ABORT_MSG_IF(!m_raster || !m_raster->IsLoaded(), "RasterPropagationLossModel needs a loaded raster");
+    Vector pa = a->GetPosition();
+    Vector pb = b->GetPosition();
+    double rxPowerDbm = txPowerDbm - m_raster->GetLoss(pa, pb);
+    if (m_shadowSigma > 0)
+    {
+        if (!m_map)
+        {
+            m_map = CreateObject<ShadowingMap>();
+        }
+        rxPowerDbm -= m_shadowSigma * m_map->GetLinkValue(pa, pb);
+    }
+    return rxPowerDbm;
+}
+
+int64_t
+RasterPropagationLossModel::DoAssignStreams(int64_t stream)
+{
+    if (!m_map)
+    {
+        m_map = CreateObject<ShadowingMap>();
+    }
+    return m_map->AssignStreams(stream);
+}
+
+#endif
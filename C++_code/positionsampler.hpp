@@ -0,0 +1,189 @@
+#ifndef POSITIONSAMPLER_HPP
+#define POSITIONSAMPLER_HPP
+
+#include "ns3/abort.h"
+#include "ns3/event-id.h"
+#include "ns3/mobility-model.h"
+#include "ns3/node-container.h"
+#include "ns3/nstime.h"
+#include "ns3/simulator.h"
+#include "ns3/vector.h"
+
+#include "profiler.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+using namespace ns3;
+
+// Snapshots of node positions, replacing the "node, x, y" text lines of PrintPositions.
+//
+// On disk, columnar: the header, the ids of the sampled nodes, then blocks of snapshots until the end
+// of the file, each block holding
+//
+//   PositionBlockHeader
+//   double   time [snapshotCount]
+//   float    x    [snapshotCount * nodeCount]      snapshot major: node j of snapshot i at i * nodeCount + j
+//   float    y    [snapshotCount * nodeCount]
+//   float    z    [snapshotCount * nodeCount]
+//
+// so a reader takes each column of a block in one read. visualise_mobility.py reads it.
+
+struct PositionSnapshotHeader{
+  char magic[8];
+  uint32_t version;
+  uint32_t nodeCount;
+  double interval;
+};
+
+struct PositionBlockHeader{
+  uint32_t snapshotCount;
+  uint32_t reserved;
+};
+
+static_assert(sizeof(PositionSnapshotHeader) == 24, "position snapshot header layout changed");
+static_assert(sizeof(PositionBlockHeader) == 8, "position block header layout changed");
+
+static const char POSITION_SNAPSHOT_MAGIC[8] = {'K', 'A', 'K', 'A', 'P', 'O', 'S', '1'};
+static const uint32_t POSITION_SNAPSHOT_VERSION = 1;
+
+// The mobility model of every sampled node is looked up once, in Open. Each snapshot then only reads
+// the positions into one column per coordinate; a block is written out once blockSnapshots are held.
+class PositionSampler{
+  public:
+    PositionSampler() = default;
+    ~PositionSampler();
+
+    PositionSampler(const PositionSampler& src) = delete;
+    PositionSampler& operator=(const PositionSampler& src) = delete;
+
+    // every node of nodes must have a mobility model already
+    bool Open(const std::string& filename, NodeContainer nodes, Time interval, uint32_t blockSnapshots = 256);
+    // snapshots now and then every interval, until Close
+    void Start();
+    // writes out the snapshots held and closes the file
+    void Close();
+
+  private:
+    void Sample();
+    void WriteBlock();
+
+    std::ofstream m_file;
+    std::vector<Ptr<MobilityModel>> m_mobility;
+    Time m_interval;
+    uint32_t m_blockSnapshots{0};
+    EventId m_event;
+
+    std::vector<double> m_time;
+    std::vector<float> m_x;
+    std::vector<float> m_y;
+    std::vector<float> m_z;
+};
+
+// ===================================================================== //
+
+PositionSampler::~PositionSampler()
+{
+    if (m_file.is_open())
+    {
+        WriteBlock();
+    }
+}
+
+bool
+PositionSampler::Open(const std::string& filename, NodeContainer nodes, Time interval, uint32_t blockSnapshots)
+{
+    NS_ABORT_MSG_IF(!interval.IsStrictlyPositive(), "the sampling interval must be positive");
+    m_file.open(filename, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!m_file)
+    {
+        return false;
+    }
+    m_interval = interval;
+    m_blockSnapshots = std::max(blockSnapshots, 1u);
+    m_mobility.clear();
+    std::vector<uint32_t> ids;
+    for (uint32_t i = 0; i < nodes.GetN(); i++)
+    {
+        Ptr<MobilityModel> mobility = nodes.Get(i)->GetObject<MobilityModel>();
+        NS_ABORT_MSG_IF(!mobility, "node " << nodes.Get(i)->GetId() << " has no mobility model to sample");
+        m_mobility.push_back(mobility);
+        ids.push_back(nodes.Get(i)->GetId());
+    }
+    std::size_t values = static_cast<std::size_t>(m_blockSnapshots) * m_mobility.size();
+    m_time.reserve(m_blockSnapshots);
+    m_x.reserve(values);
+    m_y.reserve(values);
+    m_z.reserve(values);
+
+    PositionSnapshotHeader header{};
+    std::copy(POSITION_SNAPSHOT_MAGIC, POSITION_SNAPSHOT_MAGIC + 8, header.magic);
+    header.version = POSITION_SNAPSHOT_VERSION;
+    header.nodeCount = m_mobility.size();
+    header.interval = interval.GetSeconds();
+    m_file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    m_file.write(reinterpret_cast<const char*>(ids.data()), ids.size() * sizeof(uint32_t));
+    return static_cast<bool>(m_file);
+}
+
+void
+PositionSampler::Start()
+{
+    m_event.Cancel();
+    m_event = Simulator::ScheduleNow(&PositionSampler::Sample, this);
+}
+
+void
+PositionSampler::Close()
+{
+    m_event.Cancel();
+    if (m_file.is_open())
+    {
+        WriteBlock();
+        m_file.close();
+    }
+}
+
+void
+PositionSampler::Sample()
+{
+    PROFILE_SCOPE("PositionSampler::Sample");
+    m_time.push_back(Simulator::Now().GetSeconds());
+    for (const Ptr<MobilityModel>& mobility: m_mobility)
+    {
+        Vector pos = mobility->GetPosition();
+        m_x.push_back(pos.x);
+        m_y.push_back(pos.y);
+        m_z.push_back(pos.z);
+    }
+    if (m_time.size() == m_blockSnapshots)
+    {
+        WriteBlock();
+    }
+    m_event = Simulator::Schedule(m_interval, &PositionSampler::Sample, this);
+}
+
+void
+PositionSampler::WriteBlock()
+{
+    if (m_time.empty())
+    {
+        return;
+    }
+    PositionBlockHeader header{static_cast<uint32_t>(m_time.size()), 0};
+    m_file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    m_file.write(reinterpret_cast<const char*>(m_time.data()), m_time.size() * sizeof(double));
+    for (const std::vector<float>* column: {&m_x, &m_y, &m_z})
+    {
+        m_file.write(reinterpret_cast<const char*>(column->data()), column->size() * sizeof(float));
+    }
+    m_time.clear();
+    m_x.clear();
+    m_y.clear();
+    m_z.clear();
+}
+
+#endif
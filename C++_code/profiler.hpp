@@ -0,0 +1,414 @@
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+#include "ns3/default-simulator-impl.h"
+#include "ns3/event-impl.h"
+#include "ns3/global-value.h"
+#include "ns3/nstime.h"
+#include "ns3/ptr.h"
+#include "ns3/simulator.h"
+#include "ns3/string.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <typeindex>
+#include <unordered_map>
+#include <vector>
+
+#include <cxxabi.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+using namespace ns3;
+
+// Wall clock profile of a simulation, enabled at run time with Profiler::Enable (--profile=1 in the
+// final_* programs).
+//
+// Every event the simulator runs is timed and counted under the function it calls; PROFILE_SCOPE adds
+// sites of our own inside events (trace sinks, loss models). Each site gets its total time and its self
+// time, the total less the time of the sites nested in it. While the simulation runs, the simulated
+// seconds per wall second and the time left are printed every few seconds; the sites sorted by self time
+// are printed at Simulator::Destroy. Everything goes to stderr.
+//
+// Timestamps are the time stamp counter where there is one. Building with -DKAKA_NO_PROFILE removes
+// every PROFILE_SCOPE.
+//
+// Separately, WriteRunStats leaves the event count of a run where bench_macro can read it, with or
+// without profiling.
+
+struct ProfileSite{
+  std::string name;
+  uint64_t calls{0};
+  uint64_t ticks{0};         // inclusive
+  uint64_t childTicks{0};    // in sites nested in this one
+};
+
+#ifdef KAKA_NO_PROFILE
+#define PROFILE_SCOPE(name) do { } while (false)
+#else
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_SCOPE(name)                                                                            \
+    static ProfileSite& PROFILE_CONCAT(profileSite, __LINE__) = Profiler::GetSite(name);              \
+    ProfileScope PROFILE_CONCAT(profileScope, __LINE__)                                                \
+    {                                                                                                  \
+        PROFILE_CONCAT(profileSite, __LINE__)                                                          \
+    }
+#endif
+
+class Profiler{
+  public:
+    // selects the profiling simulator, so it must come before anything uses the Simulator
+    static void Enable(double progressInterval = 5.0);
+    static bool IsEnabled();
+    static double GetProgressInterval();
+
+    // the reference stays valid for the whole program
+    static ProfileSite& GetSite(const std::string& name);
+    static uint64_t Ticks();
+    // sorted by self time
+    static void Report(std::ostream& os, double wallSeconds, uint64_t ticks);
+    // appends "<events> <simulated seconds>" to the file named by $KAKA_RUN_STATS, if set; call before
+    // Simulator::Destroy
+    static void WriteRunStats();
+
+  private:
+    friend class ProfileScope;
+
+    inline static bool s_enabled{false};
+    inline static double s_progressInterval{5.0};
+    inline static std::deque<ProfileSite> s_sites;
+    inline static std::unordered_map<std::string, ProfileSite*> s_siteByName;
+    inline static ProfileSite* s_current{nullptr};
+};
+
+class ProfileScope{
+  public:
+    explicit ProfileScope(ProfileSite& site);
+    ~ProfileScope();
+
+    ProfileScope(const ProfileScope& src) = delete;
+    ProfileScope& operator=(const ProfileScope& src) = delete;
+
+  private:
+    ProfileSite* m_site{nullptr};
+    ProfileSite* m_parent{nullptr};
+    uint64_t m_start{0};
+};
+
+// The default simulator, with every scheduled event wrapped so that it runs inside a ProfileScope named
+// after the function it calls.
+class ProfilingSimulatorImpl: public DefaultSimulatorImpl{
+  public:
+    static TypeId GetTypeId(void);
+    ProfilingSimulatorImpl() = default;
+
+    void Destroy() override;
+    void Run() override;
+    void Stop(const Time& delay) override;
+    EventId Schedule(const Time& delay, EventImpl* event) override;
+    void ScheduleWithContext(uint32_t context, const Time& delay, EventImpl* event) override;
+    EventId ScheduleNow(EventImpl* event) override;
+
+  private:
+    class ProfiledEvent;
+
+    EventImpl* Wrap(EventImpl* event);
+    ProfileSite& GetEventSite(const EventImpl* event);
+    void CheckProgress();
+
+    std::unordered_map<std::type_index, ProfileSite*> m_siteByType;
+    uint64_t m_events{0};
+    Time m_stopAt;
+    std::chrono::steady_clock::time_point m_wallStart;
+    std::chrono::steady_clock::time_point m_lastProgress;
+    uint64_t m_ticksStart{0};
+    bool m_running{false};
+};
+
+class ProfilingSimulatorImpl::ProfiledEvent: public EventImpl{
+  public:
+    ProfiledEvent(ProfilingSimulatorImpl* simulator, ProfileSite& site, EventImpl* event)
+        : m_simulator{simulator},
+          m_site{site},
+          m_event{event, false}
+    {
+    }
+
+  protected:
+    void Notify() override
+    {
+        {
+            ProfileScope scope{m_site};
+            m_event->Invoke();
+        }
+        m_simulator->CheckProgress();
+    }
+
+  private:
+    ProfilingSimulatorImpl* m_simulator;
+    ProfileSite& m_site;
+    Ptr<EventImpl> m_event;
+};
+
+// ===================================================================== //
+
+void
+Profiler::Enable(double progressInterval)
+{
+    GlobalValue::Bind("SimulatorImplementationType", StringValue("ns3::ProfilingSimulatorImpl"));
+    s_enabled = true;
+    s_progressInterval = progressInterval;
+}
+
+bool
+Profiler::IsEnabled()
+{
+    return s_enabled;
+}
+
+double
+Profiler::GetProgressInterval()
+{
+    return s_progressInterval;
+}
+
+ProfileSite&
+Profiler::GetSite(const std::string& name)
+{
+    auto found = s_siteByName.find(name);
+    if (found != s_siteByName.end())
+    {
+        return *found->second;
+    }
+    s_sites.push_back(ProfileSite{name});
+    s_siteByName[name] = &s_sites.back();
+    return s_sites.back();
+}
+
+uint64_t
+Profiler::Ticks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+#endif
+}
+
+void
+Profiler::Report(std::ostream& os, double wallSeconds, uint64_t ticks)
+{
+    double secondsPerTick = ticks ? wallSeconds / ticks : 0;
+    std::vector<const ProfileSite*> sites;
+    for (const ProfileSite& site: s_sites)
+    {
+        if (site.calls)
+        {
+            sites.push_back(&site);
+        }
+    }
+    auto self = [](const ProfileSite* site) { return site->ticks - std::min(site->childTicks, site->ticks); };
+    std::sort(sites.begin(), sites.end(), [&self](const ProfileSite* a, const ProfileSite* b) {
+        return self(a) > self(b);
+    });
+
+    char line[160];
+    std::snprintf(line, sizeof(line), "%7s %10s %10s %12s %10s  %s\n", "self%", "self s", "total s", "calls",
+                  "ns/call", "site");
+    os << line;
+    for (const ProfileSite* site: sites)
+    {
+        double selfSeconds = self(site) * secondsPerTick;
+        double totalSeconds = site->ticks * secondsPerTick;
+        std::snprintf(line, sizeof(line), "%6.2f%% %10.4f %10.4f %12llu %10.1f  ",
+                      wallSeconds > 0 ? 100 * selfSeconds / wallSeconds : 0.0, selfSeconds, totalSeconds,
+                      static_cast<unsigned long long>(site->calls), 1e9 * totalSeconds / site->calls);
+        os << line << site->name << "\n";
+    }
+}
+
+void
+Profiler::WriteRunStats()
+{
+    const char* filename = std::getenv("KAKA_RUN_STATS");
+    if (!filename || !*filename)
+    {
+        return;
+    }
+    std::ofstream file(filename, std::ios::app);
+    file << Simulator::GetEventCount() << " " << Simulator::Now().GetSeconds() << "\n";
+}
+
+// ===================================================================== //
+
+ProfileScope::ProfileScope(ProfileSite& site)
+{
+    if (!Profiler::s_enabled)
+    {
+        return;
+    }
+    m_site = &site;
+    m_parent = Profiler::s_current;
+    Profiler::s_current = m_site;
+    m_start = Profiler::Ticks();
+}
+
+ProfileScope::~ProfileScope()
+{
+    if (!m_site)
+    {
+        return;
+    }
+    uint64_t ticks = Profiler::Ticks() - m_start;
+    m_site->calls++;
+    m_site->ticks += ticks;
+    if (m_parent)
+    {
+        m_parent->childTicks += ticks;
+    }
+    Profiler::s_current = m_parent;
+}
+
+// ===================================================================== //
+
+NS_OBJECT_ENSURE_REGISTERED(ProfilingSimulatorImpl);
+
+TypeId
+ProfilingSimulatorImpl::GetTypeId(void)
+{
+    static TypeId tid = TypeId("ns3::ProfilingSimulatorImpl")
+                            .SetParent<DefaultSimulatorImpl>()
+                            .SetGroupName("Core")
+                            .AddConstructor<ProfilingSimulatorImpl>();
+    return tid;
+}
+
+void
+ProfilingSimulatorImpl::Run()
+{
+    m_wallStart = std::chrono::steady_clock::now();
+    m_lastProgress = m_wallStart;
+    m_ticksStart = Profiler::Ticks();
+    m_running = true;
+    DefaultSimulatorImpl::Run();
+    m_running = false;
+}
+
+void
+ProfilingSimulatorImpl::Destroy()
+{
+    if (m_ticksStart)
+    {
+        double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_wallStart).count();
+        uint64_t ticks = Profiler::Ticks() - m_ticksStart;
+        std::cerr << "profile: " << m_events << " events in " << wallSeconds << " s wall, "
+                  << Now().GetSeconds() / wallSeconds << " simulated s per wall s\n";
+        Profiler::Report(std::cerr, wallSeconds, ticks);
+    }
+    DefaultSimulatorImpl::Destroy();
+}
+
+void
+ProfilingSimulatorImpl::Stop(const Time& delay)
+{
+    m_stopAt = Now() + delay;
+    DefaultSimulatorImpl::Stop(delay);
+}
+
+EventId
+ProfilingSimulatorImpl::Schedule(const Time& delay, EventImpl* event)
+{
+    return DefaultSimulatorImpl::Schedule(delay, Wrap(event));
+}
+
+void
+ProfilingSimulatorImpl::ScheduleWithContext(uint32_t context, const Time& delay, EventImpl* event)
+{
+    DefaultSimulatorImpl::ScheduleWithContext(context, delay, Wrap(event));
+}
+
+EventId
+ProfilingSimulatorImpl::ScheduleNow(EventImpl* event)
+{
+    return DefaultSimulatorImpl::ScheduleNow(Wrap(event));
+}
+
+EventImpl*
+ProfilingSimulatorImpl::Wrap(EventImpl* event)
+{
+    return new ProfiledEvent(this, GetEventSite(event), event);
+}
+
+// "event void (ns3::YansWifiPhy::*)(...)", the function type out of the MakeEvent type that wraps it
+ProfileSite&
+ProfilingSimulatorImpl::GetEventSite(const EventImpl* event)
+{
+    std::type_index type{typeid(*event)};
+    auto found = m_siteByType.find(type);
+    if (found != m_siteByType.end())
+    {
+        return *found->second;
+    }
+    int status;
+    char* demangled = abi::__cxa_demangle(type.name(), nullptr, nullptr, &status);
+    std::string name = status == 0 ? demangled : type.name();
+    std::free(demangled);
+    std::size_t from = name.find("MakeEvent<");
+    if (from != std::string::npos)
+    {
+        from += 10;
+        int depth = 0;
+        std::size_t to = from;
+        for (; to < name.size(); to++)
+        {
+            char c = name[to];
+            if (depth == 0 && (c == ',' || c == '>'))
+            {
+                break;
+            }
+            depth += (c == '<' || c == '(') - (c == '>' || c == ')');
+        }
+        name = name.substr(from, to - from);
+    }
+    ProfileSite& site = Profiler::GetSite("event " + name);
+    m_siteByType[type] = &site;
+    return site;
+}
+
+void
+ProfilingSimulatorImpl::CheckProgress()
+{
+    // the clock is only read every few thousand events
+    if (++m_events % 4096 != 0 || !m_running)
+    {
+        return;
+    }
+    auto now = std::chrono::steady_clock::now();
+    if (std::chrono::duration<double>(now - m_lastProgress).count() < Profiler::GetProgressInterval())
+    {
+        return;
+    }
+    m_lastProgress = now;
+    double wallSeconds = std::chrono::duration<double>(now - m_wallStart).count();
+    double simSeconds = Now().GetSeconds();
+    double rate = simSeconds / wallSeconds;
+    std::cerr << "profile: " << simSeconds << " s simulated, " << rate << " simulated s per wall s";
+    if (m_stopAt.IsStrictlyPositive() && rate > 0)
+    {
+        std::cerr << ", " << (m_stopAt.GetSeconds() - simSeconds) / rate << " s left";
+    }
+    std::cerr << std::endl;
+}
+
+#endif
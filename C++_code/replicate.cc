@@ -0,0 +1,305 @@
+/*
+ *  Independent replications of final_sanet or final_vanet, run in parallel worker processes until the
+ *  confidence intervals of the packet delivery ratio and the end to end delay are narrow enough.
+ *
+ *  Each replication is the scenario binary run with its own --RngRun and its own files in outputDir
+ *  (run-<k>.csv, run-<k>.flows.csv and run-<k>.log). Once minRuns have finished, no new replication
+ *  is started when both half widths are below their targets, or at maxRuns. Replications are only
+ *  counted in RngRun order, so the stopping point and the results do not depend on which worker
+ *  finished first.
+ *
+ *  To run, write (the scenario must have been built, e.g. by running it once):
+ *
+ *  "./ns3 run "scratch/replicate --program=./build/scratch/ns3.39-final_sanet-default --jobs=8
+ *   --pdrHalfWidth=0.01 --delayHalfWidth=0.005""
+ *
+ *  Anything in --args is passed to every replication. Writes the per run means to replications.csv
+ *  and the mean and half width of every window to windows.csv, both in outputDir.
+ */
+
+#include "ns3/core-module.h"
+
+#include "./kaka/metrics.hpp"
+
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace ns3;
+
+// what one replication's csv boils down to
+struct Replication
+{
+    bool done{false};
+    bool ok{false};
+    double pdr{0};      // packets received over packets sent, across every window
+    double delay{0};    // mean delay over every received packet
+    std::map<double, std::pair<double, double>> windows;    // time -> (pdr, delay), finite values only
+};
+
+static std::vector<std::string>
+SplitCsvLine(const std::string& line)
+{
+    std::vector<std::string> fields;
+    std::istringstream stream(line);
+    std::string field;
+    while (std::getline(stream, field, ','))
+    {
+        fields.push_back(field);
+    }
+    return fields;
+}
+
+static bool
+ReadReplication(const std::string& csvFile, Replication& replication)
+{
+    std::ifstream file(csvFile);
+    std::string line;
+    if (!std::getline(file, line))
+    {
+        return false;
+    }
+    std::vector<std::string> header = SplitCsvLine(line);
+    auto column = [&header](const std::string& name) {
+        for (std::size_t i = 0; i < header.size(); i++)
+        {
+            if (header[i] == name)
+            {
+                return static_cast<int>(i);
+            }
+        }
+        return -1;
+    };
+    int timeColumn = column("SimulationSecond");
+    int receivedColumn = column("PacketsReceived");
+    int delayColumn = column("Average End to End");
+    int pdrColumn = column("Package Delivery Ratio");
+    int sentColumn = column("PacketsSent");
+    if (timeColumn < 0 || receivedColumn < 0 || delayColumn < 0 || pdrColumn < 0 || sentColumn < 0)
+    {
+        return false;
+    }
+
+    double delaySum = 0;
+    double received = 0;
+    double sent = 0;
+    double delayed = 0;    // received in windows with a finite delay
+    while (std::getline(file, line))
+    {
+        std::vector<std::string> fields = SplitCsvLine(line);
+        if (fields.size() < header.size())
+        {
+            continue;
+        }
+        double time = std::strtod(fields[timeColumn].c_str(), nullptr);
+        double windowReceived = std::strtod(fields[receivedColumn].c_str(), nullptr);
+        double windowDelay = std::strtod(fields[delayColumn].c_str(), nullptr);
+        double windowPdr = std::strtod(fields[pdrColumn].c_str(), nullptr);
+        // the ratio of the totals, as in the sweep results; the window ratios are nan or inf where nothing
+        // was sent, and would weigh a quiet window as much as a busy one
+        sent += std::strtod(fields[sentColumn].c_str(), nullptr);
+        received += windowReceived;
+        if (windowReceived > 0 && std::isfinite(windowDelay))
+        {
+            delaySum += windowDelay * windowReceived;
+            delayed += windowReceived;
+        }
+        replication.windows[time] = {windowPdr, windowReceived > 0 ? windowDelay : NAN};
+    }
+    replication.pdr = sent > 0 ? received / sent : NAN;
+    replication.delay = delayed > 0 ? delaySum / delayed : NAN;
+    return std::isfinite(replication.pdr) && std::isfinite(replication.delay);
+}
+
+static pid_t
+Launch(const std::string& program, const std::vector<std::string>& args, const std::string& logFile)
+{
+    pid_t pid = fork();
+    if (pid != 0)
+    {
+        return pid;
+    }
+    int log = ::open(logFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (log >= 0)
+    {
+        dup2(log, STDOUT_FILENO);
+        dup2(log, STDERR_FILENO);
+        ::close(log);
+    }
+    std::vector<char*> argv;
+    argv.push_back(const_cast<char*>(program.c_str()));
+    for (const std::string& arg: args)
+    {
+        argv.push_back(const_cast<char*>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+    execv(program.c_str(), argv.data());
+    std::cerr << "could not run " << program << ": " << std::strerror(errno) << "\n";
+    _exit(127);
+}
+
+int
+main(int argc, char* argv[])
+{
+    std::string program;
+    std::string extraArgs;
+    std::string outputDir{"replications"};
+    uint32_t jobs = std::max(1u, std::thread::hardware_concurrency());
+    uint32_t minRuns = 5;
+    uint32_t maxRuns = 50;
+    uint32_t firstRun = 1;
+    double confidence = 0.95;
+    double pdrHalfWidth = 0.01;
+    double delayHalfWidth = 0.005;
+
+    CommandLine cmd(__FILE__);
+    cmd.AddValue("program", "Scenario binary to replicate (final_sanet or final_vanet)", program);
+    cmd.AddValue("args", "Space separated arguments passed to every replication", extraArgs);
+    cmd.AddValue("outputDir", "Directory for the files of every replication and the summaries", outputDir);
+    cmd.AddValue("jobs", "Replications run at once", jobs);
+    cmd.AddValue("minRuns", "Replications before the stopping rule is checked", minRuns);
+    cmd.AddValue("maxRuns", "Replications at most", maxRuns);
+    cmd.AddValue("firstRun", "RngRun of the first replication", firstRun);
+    cmd.AddValue("confidence", "Confidence level of the intervals", confidence);
+    cmd.AddValue("pdrHalfWidth", "Target half width of the delivery ratio interval", pdrHalfWidth);
+    cmd.AddValue("delayHalfWidth", "Target half width (s) of the end to end delay interval", delayHalfWidth);
+    cmd.Parse(argc, argv);
+
+    NS_ABORT_MSG_IF(program.empty(), "give the scenario binary with --program");
+    NS_ABORT_MSG_IF(minRuns < 2 || maxRuns < minRuns, "need 2 <= minRuns <= maxRuns");
+    if (mkdir(outputDir.c_str(), 0755) != 0 && errno != EEXIST)
+    {
+        NS_FATAL_ERROR("could not create " << outputDir);
+    }
+    std::vector<std::string> sharedArgs;
+    std::istringstream extra(extraArgs);
+    for (std::string arg; extra >> arg;)
+    {
+        sharedArgs.push_back(arg);
+    }
+
+    std::vector<Replication> replications(maxRuns);
+    std::map<pid_t, uint32_t> running;
+    uint32_t launched = 0;
+    uint32_t counted = 0;    // replications 0 .. counted-1 are done and in the accumulators
+    OnlineAccumulator pdr;
+    OnlineAccumulator delay;
+    bool precise = false;
+
+    std::cout << "run,pdr,delay,n,pdr_mean,pdr_halfwidth,delay_mean,delay_halfwidth\n";
+    while (launched < maxRuns || !running.empty())
+    {
+        while (!precise && launched < maxRuns && running.size() < jobs)
+        {
+            std::string base = outputDir + "/run-" + std::to_string(firstRun + launched);
+            std::vector<std::string> args = sharedArgs;
+            args.push_back("--RngRun=" + std::to_string(firstRun + launched));
+            args.push_back("--CSVfileName=" + base + ".csv");
+            args.push_back("--packetTrace=");
+            pid_t pid = Launch(program, args, base + ".log");
+            NS_ABORT_MSG_IF(pid < 0, "fork failed");
+            running[pid] = launched++;
+        }
+        if (running.empty())
+        {
+            break;
+        }
+
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0 || !running.count(pid))
+        {
+            continue;
+        }
+        uint32_t k = running[pid];
+        running.erase(pid);
+        Replication& replication = replications[k];
+        replication.done = true;
+        std::string base = outputDir + "/run-" + std::to_string(firstRun + k);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            std::cerr << "replication " << firstRun + k << " failed, see " << base << ".log\n";
+        }
+        else if (!ReadReplication(base + ".csv", replication))
+        {
+            std::cerr << "replication " << firstRun + k << " produced no usable " << base << ".csv\n";
+        }
+        else
+        {
+            replication.ok = true;
+        }
+
+        // count finished replications in order only
+        while (counted < launched && replications[counted].done)
+        {
+            const Replication& next = replications[counted++];
+            if (!next.ok)
+            {
+                continue;
+            }
+            pdr.Add(next.pdr);
+            delay.Add(next.delay);
+            double pdrHw = ConfidenceHalfWidth(pdr, confidence);
+            double delayHw = ConfidenceHalfWidth(delay, confidence);
+            std::cout << firstRun + counted - 1 << "," << next.pdr << "," << next.delay << "," << pdr.GetCount()
+                      << "," << pdr.GetMean() << "," << pdrHw << "," << delay.GetMean() << "," << delayHw
+                      << std::endl;
+            if (!precise && pdr.GetCount() >= minRuns && pdrHw <= pdrHalfWidth && delayHw <= delayHalfWidth)
+            {
+                // replications already running still finish and count
+                precise = true;
+            }
+        }
+    }
+
+    std::ofstream summary(outputDir + "/replications.csv");
+    summary << "RngRun,PacketDeliveryRatio,EndToEndDelay\n";
+    std::map<double, std::pair<OnlineAccumulator, OnlineAccumulator>> windows;
+    for (uint32_t k = 0; k < counted; k++)
+    {
+        if (!replications[k].ok)
+        {
+            continue;
+        }
+        summary << firstRun + k << "," << replications[k].pdr << "," << replications[k].delay << "\n";
+        for (const auto& [time, values]: replications[k].windows)
+        {
+            if (std::isfinite(values.first))
+            {
+                windows[time].first.Add(values.first);
+            }
+            if (std::isfinite(values.second))
+            {
+                windows[time].second.Add(values.second);
+            }
+        }
+    }
+    std::ofstream windowSummary(outputDir + "/windows.csv");
+    windowSummary << "SimulationSecond,PdrRuns,PdrMean,PdrHalfWidth,DelayRuns,DelayMean,DelayHalfWidth\n";
+    for (const auto& [time, accumulators]: windows)
+    {
+        const OnlineAccumulator& windowPdr = accumulators.first;
+        const OnlineAccumulator& windowDelay = accumulators.second;
+        windowSummary << time << "," << windowPdr.GetCount() << "," << windowPdr.GetMean() << ","
+                      << ConfidenceHalfWidth(windowPdr, confidence) << "," << windowDelay.GetCount() << ","
+                      << windowDelay.GetMean() << "," << ConfidenceHalfWidth(windowDelay, confidence) << "\n";
+    }
+
+    std::cout << "# " << pdr.GetCount() << " replications" << (precise ? "" : ", targets not reached") << ": pdr "
+              << pdr.GetMean() << " +- " << ConfidenceHalfWidth(pdr, confidence) << ", delay " << delay.GetMean()
+              << " +- " << ConfidenceHalfWidth(delay, confidence) << " s (" << confidence * 100 << "%)\n";
+    return precise ? 0 : 1;
+}
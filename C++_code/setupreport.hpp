@@ -0,0 +1,104 @@
+#ifndef SETUPREPORT_HPP
+#define SETUPREPORT_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <iomanip>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+// Wall time and resident memory of each phase of a scenario's setup, per node, so that the phase
+// that stops scaling shows up on a small run before a big one is tried. A phase runs from the
+// previous Mark (or the constructor) to the Mark naming it.
+class SetupReport{
+  public:
+    explicit SetupReport(uint32_t nNodes);
+
+    void Mark(const std::string& phase);
+    void Print(std::ostream& os) const;
+
+    // resident set size of this process, 0 where /proc is missing
+    static uint64_t GetResidentBytes();
+
+  private:
+    struct Phase
+    {
+      std::string name;
+      double seconds;
+      int64_t residentBytes;
+    };
+
+    uint32_t m_nNodes;
+    std::vector<Phase> m_phases;
+    std::chrono::steady_clock::time_point m_last;
+    uint64_t m_lastResident;
+};
+
+// ===================================================================== //
+
+SetupReport::SetupReport(uint32_t nNodes)
+    : m_nNodes(nNodes),
+      m_last(std::chrono::steady_clock::now()),
+      m_lastResident(GetResidentBytes())
+{
+}
+
+uint64_t
+SetupReport::GetResidentBytes()
+{
+    std::FILE* statm = std::fopen("/proc/self/statm", "r");
+    if (!statm)
+    {
+        return 0;
+    }
+    unsigned long long pages = 0;
+    unsigned long long resident = 0;
+    int n = std::fscanf(statm, "%llu %llu", &pages, &resident);
+    std::fclose(statm);
+    return n == 2 ? resident * sysconf(_SC_PAGESIZE) : 0;
+}
+
+void
+SetupReport::Mark(const std::string& phase)
+{
+    auto now = std::chrono::steady_clock::now();
+    uint64_t resident = GetResidentBytes();
+    m_phases.push_back({phase,
+                        std::chrono::duration<double>(now - m_last).count(),
+                        static_cast<int64_t>(resident) - static_cast<int64_t>(m_lastResident)});
+    m_last = now;
+    m_lastResident = resident;
+}
+
+void
+SetupReport::Print(std::ostream& os) const
+{
+    std::ios_base::fmtflags flags = os.flags();
+    std::streamsize precision = os.precision();
+    double seconds = 0;
+    int64_t residentBytes = 0;
+    auto row = [&os, this](const std::string& name, double s, int64_t bytes) {
+        os << "  " << std::left << std::setw(16) << name << std::right << std::fixed << std::setprecision(3)
+           << std::setw(10) << s << std::setw(12) << bytes / 1048576.0 << std::setw(12)
+           << bytes / 1024.0 / std::max(m_nNodes, 1u) << "\n";
+    };
+    os << "setup of " << m_nNodes << " nodes:\n"
+       << "  " << std::left << std::setw(16) << "phase" << std::right << std::setw(10) << "seconds" << std::setw(12)
+       << "MiB" << std::setw(12) << "KiB/node" << "\n";
+    for (const Phase& phase: m_phases)
+    {
+        row(phase.name, phase.seconds, phase.residentBytes);
+        seconds += phase.seconds;
+        residentBytes += phase.residentBytes;
+    }
+    row("total", seconds, residentBytes);
+    os.flags(flags);
+    os.precision(precision);
+}
+
+#endif
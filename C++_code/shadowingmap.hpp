@@ -0,0 +1,290 @@
+#ifndef SHADOWINGMAP_HPP
+#define SHADOWINGMAP_HPP
+
+#include "ns3/abort.h"
+#include "ns3/double.h"
+#include "ns3/hybrid-buildings-propagation-loss-model.h"
+#include "ns3/mobility-building-info.h"
+#include "ns3/mobility-model.h"
+#include "ns3/object.h"
+#include "ns3/pointer.h"
+#include "ns3/random-variable-stream.h"
+#include "ns3/vector.h"
+
+#include "profiler.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+using namespace ns3;
+
+// Spatially correlated shadow fading: a unit normal field over the plane whose correlation between two
+// points falls as exp(-(|dx| + |dy|) / DecorrelationDistance), the separable form of Gudmundson's model.
+//
+// The field is drawn once, at the first lookup, on a square tile of Size x Size m sampled every
+// Resolution m (a 2D AR(1) recursion, so neighbouring samples have the right correlation), and the tile
+// repeats over the plane. A lookup is a bilinear interpolation, rescaled so the value stays unit normal
+// between the samples. Memory is that of the tile, whatever the number of nodes or links.
+class ShadowingMap: public Object{
+  public:
+    static TypeId GetTypeId(void);
+    ShadowingMap();
+
+    // the field at p
+    double GetValue(const Vector& p) const;
+    // unit normal shadowing of the link between a and b, the same both ways: the sum of the field at
+    // both ends, so it stays correlated while either end moves less than the decorrelation distance
+    double GetLinkValue(const Vector& a, const Vector& b) const;
+    int64_t AssignStreams(int64_t stream);
+
+    uint64_t GetNSamples() const;
+
+  private:
+    void Generate() const;
+
+    double m_size;
+    double m_resolution;
+    double m_decorrelation;
+    Ptr<NormalRandomVariable> m_normal;
+
+    mutable uint32_t m_n{0};
+    mutable double m_rho{0};          // correlation of neighbouring samples
+    mutable std::vector<float> m_samples;
+};
+
+// The hybrid buildings model with its shadowing taken from a ShadowingMap instead of a value drawn and
+// kept for every pair of nodes that ever exchanged a frame, which grows as n^2 over a trace where
+// vehicles come and go. The sigmas are those of the hybrid model (ShadowSigmaOutdoor, ShadowSigmaExtWalls,
+// ShadowSigmaIndoor) chosen by the same indoor/outdoor rule; only the draw changes.
+class CorrelatedHybridBuildingsPropagationLossModel: public HybridBuildingsPropagationLossModel{
+  public:
+    static TypeId GetTypeId(void);
+    CorrelatedHybridBuildingsPropagationLossModel() = default;
+
+  protected:
+    void DoDispose() override;
+    double DoCalcRxPower(double txPowerDbm,
+                         Ptr<MobilityModel> a,
+                         Ptr<MobilityModel> b) const override;
+    int64_t DoAssignStreams(int64_t stream) override;
+
+  private:
+    double GetSigma(Ptr<MobilityModel> a, Ptr<MobilityModel> b) const;
+
+    mutable Ptr<ShadowingMap> m_map;
+    // the sigmas of the hybrid model, read at the first frame
+    mutable bool m_sigmasRead{false};
+    mutable double m_sigmaOutdoor{0};
+    mutable double m_sigmaExtWalls{0};
+    mutable double m_sigmaIndoor{0};
+};
+
+// ===================================================================== //
+
+NS_OBJECT_ENSURE_REGISTERED(ShadowingMap);
+
+TypeId
+ShadowingMap::GetTypeId(void)
+{
+    static TypeId tid =
+        TypeId("ns3::ShadowingMap")
+            .SetParent<Object>()
+            .SetGroupName("Buildings")
+            .AddConstructor<ShadowingMap>()
+            .AddAttribute("Size",
+                          "Side (m) of the square tile of the field, which repeats past it.",
+                          DoubleValue(2000.0),
+                          MakeDoubleAccessor(&ShadowingMap::m_size),
+                          MakeDoubleChecker<double>(1.0))
+            .AddAttribute("Resolution",
+                          "Distance (m) between two samples of the field.",
+                          DoubleValue(5.0),
+                          MakeDoubleAccessor(&ShadowingMap::m_resolution),
+                          MakeDoubleChecker<double>(0.1))
+            .AddAttribute("DecorrelationDistance",
+                          "Distance (m) over which the correlation falls to 1/e.",
+                          DoubleValue(20.0),
+                          MakeDoubleAccessor(&ShadowingMap::m_decorrelation),
+                          MakeDoubleChecker<double>(0.1));
+    return tid;
+}
+
+ShadowingMap::ShadowingMap()
+{
+    m_normal = CreateObject<NormalRandomVariable>();
+    m_normal->SetAttribute("Mean", DoubleValue(0.0));
+    m_normal->SetAttribute("Variance", DoubleValue(1.0));
+}
+
+int64_t
+ShadowingMap::AssignStreams(int64_t stream)
+{
+    m_normal->SetStream(stream);
+    return 1;
+}
+
+uint64_t
+ShadowingMap::GetNSamples() const
+{
+    return m_samples.size();
+}
+
+void
+ShadowingMap::Generate() const
+{
+    PROFILE_SCOPE("ShadowingMap::Generate");
+    m_n = std::max(2u, static_cast<uint32_t>(std::ceil(m_size / m_resolution)));
+    m_rho = std::exp(-m_resolution / m_decorrelation);
+    double edge = std::sqrt(1 - m_rho * m_rho);
+    double inner = 1 - m_rho * m_rho;
+    m_samples.assign(static_cast<std::size_t>(m_n) * m_n, 0.0f);
+    std::vector<double> previous(m_n);
+    std::vector<double> current(m_n);
+    for (uint32_t j = 0; j < m_n; j++)
+    {
+        for (uint32_t i = 0; i < m_n; i++)
+        {
+            double w = m_normal->GetValue();
+            if (i == 0 && j == 0)
+            {
+                current[i] = w;
+            }
+            else if (j == 0)
+            {
+                current[i] = m_rho * current[i - 1] + edge * w;
+            }
+            else if (i == 0)
+            {
+                current[i] = m_rho * previous[i] + edge * w;
+            }
+            else
+            {
+                current[i] = m_rho * (current[i - 1] + previous[i]) - m_rho * m_rho * previous[i - 1] + inner * w;
+            }
+            m_samples[static_cast<std::size_t>(j) * m_n + i] = current[i];
+        }
+        std::swap(previous, current);
+    }
+}
+
+double
+ShadowingMap::GetValue(const Vector& p) const
+{
+    if (m_samples.empty())
+    {
+        Generate();
+    }
+    double u = p.x / m_resolution;
+    double v = p.y / m_resolution;
+    double fu = std::floor(u);
+    double fv = std::floor(v);
+    double tx = u - fu;
+    double ty = v - fv;
+    int64_t n = m_n;
+    uint32_t i0 = ((static_cast<int64_t>(fu) % n) + n) % n;
+    uint32_t j0 = ((static_cast<int64_t>(fv) % n) + n) % n;
+    uint32_t i1 = i0 + 1 == m_n ? 0 : i0 + 1;
+    uint32_t j1 = j0 + 1 == m_n ? 0 : j0 + 1;
+    const float* row0 = m_samples.data() + static_cast<std::size_t>(j0) * m_n;
+    const float* row1 = m_samples.data() + static_cast<std::size_t>(j1) * m_n;
+    double value = (1 - ty) * ((1 - tx) * row0[i0] + tx * row0[i1]) + ty * ((1 - tx) * row1[i0] + tx * row1[i1]);
+    // variance of the interpolation of correlated unit samples, per axis
+    double vx = (1 - tx) * (1 - tx) + tx * tx + 2 * tx * (1 - tx) * m_rho;
+    double vy = (1 - ty) * (1 - ty) + ty * ty + 2 * ty * (1 - ty) * m_rho;
+    return value / std::sqrt(vx * vy);
+}
+
+double
+ShadowingMap::GetLinkValue(const Vector& a, const Vector& b) const
+{
+    // the two ends are correlated as much as the field between them
+    double rho = std::exp(-(std::abs(a.x - b.x) + std::abs(a.y - b.y)) / m_decorrelation);
+    return (GetValue(a) + GetValue(b)) / std::sqrt(2 * (1 + rho));
+}
+
+// ===================================================================== //
+
+NS_OBJECT_ENSURE_REGISTERED(CorrelatedHybridBuildingsPropagationLossModel);
+
+TypeId
+CorrelatedHybridBuildingsPropagationLossModel::GetTypeId(void)
+{
+    static TypeId tid =
+        TypeId("ns3::CorrelatedHybridBuildingsPropagationLossModel")
+            .SetParent<HybridBuildingsPropagationLossModel>()
+            .SetGroupName("Buildings")
+            .AddConstructor<CorrelatedHybridBuildingsPropagationLossModel>()
+            .AddAttribute("ShadowingMap",
+                          "The field the shadowing is read from; a default one is made at the first frame if "
+                          "none is set.",
+                          PointerValue(),
+                          MakePointerAccessor(&CorrelatedHybridBuildingsPropagationLossModel::m_map),
+                          MakePointerChecker<ShadowingMap>());
+    return tid;
+}
+
+void
+CorrelatedHybridBuildingsPropagationLossModel::DoDispose()
+{
+    m_map = nullptr;
+    HybridBuildingsPropagationLossModel::DoDispose();
+}
+
+double
+CorrelatedHybridBuildingsPropagationLossModel::GetSigma(Ptr<MobilityModel> a, Ptr<MobilityModel> b) const
+{
+    if (!m_sigmasRead)
+    {
+        DoubleValue sigma;
+        GetAttribute("ShadowSigmaOutdoor", sigma);
+        m_sigmaOutdoor = sigma.Get();
+        GetAttribute("ShadowSigmaExtWalls", sigma);
+        m_sigmaExtWalls = sigma.Get();
+        GetAttribute("ShadowSigmaIndoor", sigma);
+        m_sigmaIndoor = sigma.Get();
+        m_sigmasRead = true;
+    }
+    // GetLoss has just brought both up to date with their positions
+    Ptr<MobilityBuildingInfo> aInfo = a->GetObject<MobilityBuildingInfo>();
+    Ptr<MobilityBuildingInfo> bInfo = b->GetObject<MobilityBuildingInfo>();
+    NS_ABORT_MSG_IF(!aInfo || !bInfo, "install the buildings helper on every node");
+    bool aIndoor = aInfo->IsIndoor();
+    bool bIndoor = bInfo->IsIndoor();
+    if (!aIndoor && !bIndoor)
+    {
+        return m_sigmaOutdoor;
+    }
+    if (aIndoor && bIndoor)
+    {
+        return m_sigmaIndoor;
+    }
+    return std::sqrt(m_sigmaOutdoor * m_sigmaOutdoor + m_sigmaExtWalls * m_sigmaExtWalls);
+}
+
+double
+CorrelatedHybridBuildingsPropagationLossModel::DoCalcRxPower(double txPowerDbm,
+                                                             Ptr<MobilityModel> a,
+                                                             Ptr<MobilityModel> b) const
+{
+    PROFILE_SCOPE("CorrelatedHybridBuildingsPropagationLossModel::DoCalcRxPower");
+    if (!m_map)
+    {
+        m_map = CreateObject<ShadowingMap>();
+    }
+    double loss = GetLoss(a, b);
+    return txPowerDbm - loss - GetSigma(a, b) * m_map->GetLinkValue(a->GetPosition(), b->GetPosition());
+}
+
+int64_t
+CorrelatedHybridBuildingsPropagationLossModel::DoAssignStreams(int64_t stream)
+{
+    if (!m_map)
+    {
+        m_map = CreateObject<ShadowingMap>();
+    }
+    int64_t streams = HybridBuildingsPropagationLossModel::DoAssignStreams(stream);
+    return streams + m_map->AssignStreams(stream + streams);
+}
+
+#endif
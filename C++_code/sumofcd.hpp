@@ -0,0 +1,549 @@
+#ifndef SUMOFCD_HPP
+#define SUMOFCD_HPP
+
+#include "ns3/abort.h"
+#include "ns3/boolean.h"
+#include "ns3/callback.h"
+#include "ns3/constant-velocity-mobility-model.h"
+#include "ns3/double.h"
+#include "ns3/node-container.h"
+#include "ns3/node.h"
+#include "ns3/nstime.h"
+#include "ns3/object.h"
+#include "ns3/simulator.h"
+#include "ns3/trace-source-accessor.h"
+#include "ns3/traced-callback.h"
+#include "ns3/type-id.h"
+#include "ns3/vector.h"
+
+#include "profiler.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace ns3;
+
+// Pull tokenizer over an xml file: hands out the text between '<' and '>' one tag at a time. Only a
+// fixed read buffer and the current tag are ever held, so the file size does not matter. Files ending
+// in .gz, as sumo writes its nets and polygons, are read through a gzip child process. Open fails when
+// such a file is missing, is not gzip or gzip fails before its first bytes; a gzip failure further on
+// aborts at the end of the stream rather than passing for a shorter file.
+class FcdTokenizer{
+  public:
+    FcdTokenizer() = default;
+    ~FcdTokenizer();
+
+    FcdTokenizer(const FcdTokenizer& src) = delete;
+    FcdTokenizer& operator=(const FcdTokenizer& src) = delete;
+
+    bool Open(const std::string& filename);
+    bool NextTag(std::string& tag);
+
+    // the value of attribute name in tag, running on to the end of the tag, or nullptr
+    static const char* FindAttribute(const std::string& tag, const char* name);
+
+  private:
+    int Get();
+    bool OpenGzip(const std::string& filename);
+    // waits for the gzip child, true when it exited with status 0
+    bool Reap();
+    void Close();
+
+    std::string m_filename;
+    std::FILE* m_file{nullptr};
+    pid_t m_child{-1};
+    std::vector<char> m_buffer = std::vector<char>(1 << 16);
+    std::size_t m_pos{0};
+    std::size_t m_len{0};
+};
+
+// Streams the fcd output of sumo ("sumo -c osm.sumocfg --fcd-output sumoTrace.xml") into the
+// simulation, one timestep at a time, instead of converting it to an ns-2 trace first.
+//
+// Vehicles get a node the first time their id shows up: the next unused node of the pool set with
+// SetNodePool, or a freshly created one handed to the node creation callback so the scenario can
+// install its devices on it. Running out of pool without a creation callback is fatal, as the node
+// would have no devices and never take part. Nodes waiting for a vehicle sit at ParkingPosition, so set the
+// attributes before the pool. At each timestep the vehicle is snapped to its fcd position and given
+// its fcd velocity, so it keeps moving smoothly until the next step. A vehicle missing from a
+// timestep has left the network: it is stopped and moved to ParkingPosition, and with RecycleNodes
+// its node is handed to the next new vehicle.
+class SumoFcdReader: public Object{
+  public:
+    static TypeId GetTypeId(void);
+    SumoFcdReader() = default;
+
+    bool Open(const std::string& filename);
+    void SetNodePool(NodeContainer pool);
+    void SetNodeCreationCallback(Callback<void, Ptr<Node>> callback);
+    // schedules the first timestep, call before Simulator::Run
+    void Start();
+
+    uint32_t GetNActiveVehicles() const;
+
+    // distinct vehicle ids in a whole fcd file, the pool that never needs a node created on the fly
+    static uint32_t CountVehicles(const std::string& filename);
+
+    typedef void (*VehicleCallback)(std::string id, Ptr<Node> node);
+
+  protected:
+    void DoDispose() override;
+
+  private:
+    struct Vehicle{
+      Ptr<Node> node;
+      Ptr<ConstantVelocityMobilityModel> mobility;
+      uint64_t lastStep;
+    };
+
+    void Step();
+    void ScheduleNextStep();
+    void ApplyVehicle(const std::string& tag);
+    void Depart(const std::string& id, Vehicle& vehicle);
+    Ptr<Node> AcquireNode();
+    Ptr<ConstantVelocityMobilityModel> PrepareNode(Ptr<Node> node);
+
+    FcdTokenizer m_tokenizer;
+    std::string m_tag;
+    std::string m_id;
+    bool m_nextStepEmpty{false};
+    uint64_t m_step{0};
+
+    NodeContainer m_pool;
+    uint32_t m_poolNext{0};
+    std::vector<Ptr<Node>> m_freeNodes;
+    Callback<void, Ptr<Node>> m_nodeCreation;
+    std::unordered_map<std::string, Vehicle> m_vehicles;
+
+    double m_height;
+    Vector m_parkingPosition;
+    bool m_recycleNodes;
+
+    TracedCallback<std::string, Ptr<Node>> m_arrivalTrace;
+    TracedCallback<std::string, Ptr<Node>> m_departureTrace;
+};
+
+// ===================================================================== //
+
+FcdTokenizer::~FcdTokenizer()
+{
+    Close();
+}
+
+bool
+FcdTokenizer::Open(const std::string& filename)
+{
+    Close();
+    m_filename = filename;
+    m_pos = 0;
+    m_len = 0;
+    if (filename.size() > 3 && filename.compare(filename.size() - 3, 3, ".gz") == 0)
+    {
+        return OpenGzip(filename);
+    }
+    m_file = std::fopen(filename.c_str(), "rb");
+    return m_file != nullptr;
+}
+
+bool
+FcdTokenizer::OpenGzip(const std::string& filename)
+{
+    // gzip gets the file as its stdin, so the name never goes through a shell or a command line
+    int compressed = open(filename.c_str(), O_RDONLY);
+    if (compressed < 0)
+    {
+        return false;
+    }
+    unsigned char magic[2];
+    int fds[2];
+    if (read(compressed, magic, 2) != 2 || magic[0] != 0x1f || magic[1] != 0x8b ||
+        lseek(compressed, 0, SEEK_SET) != 0 || pipe(fds) != 0)
+    {
+        close(compressed);
+        return false;
+    }
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        dup2(compressed, STDIN_FILENO);
+        dup2(fds[1], STDOUT_FILENO);
+        // the read end must not stay open in gzip, or it never sees the reader go away
+        close(fds[0]);
+        close(fds[1]);
+        close(compressed);
+        int devNull = open("/dev/null", O_WRONLY);
+        if (devNull >= 0)
+        {
+            dup2(devNull, STDERR_FILENO);
+        }
+        execlp("gzip", "gzip", "-dc", static_cast<char*>(nullptr));
+        _exit(127);
+    }
+    close(compressed);
+    close(fds[1]);
+    if (pid < 0)
+    {
+        close(fds[0]);
+        return false;
+    }
+    m_child = pid;
+    m_file = fdopen(fds[0], "rb");
+    if (!m_file)
+    {
+        close(fds[0]);
+        Close();
+        return false;
+    }
+    // a corrupt header, or no gzip at all, shows as an empty stream and a failed exit
+    m_len = std::fread(m_buffer.data(), 1, m_buffer.size(), m_file);
+    if (m_len == 0 && !Reap())
+    {
+        Close();
+        return false;
+    }
+    return true;
+}
+
+bool
+FcdTokenizer::Reap()
+{
+    int status;
+    pid_t pid = waitpid(m_child, &status, 0);
+    m_child = -1;
+    return pid > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+void
+FcdTokenizer::Close()
+{
+    if (m_file)
+    {
+        std::fclose(m_file);
+        m_file = nullptr;
+    }
+    // with the pipe closed a gzip that is not done yet exits on SIGPIPE
+    if (m_child > 0)
+    {
+        Reap();
+    }
+}
+
+int
+FcdTokenizer::Get()
+{
+    if (m_pos == m_len)
+    {
+        m_len = m_file ? std::fread(m_buffer.data(), 1, m_buffer.size(), m_file) : 0;
+        m_pos = 0;
+        if (m_len == 0)
+        {
+            NS_ABORT_MSG_IF(m_child > 0 && !Reap(), "gzip could not decompress all of " << m_filename);
+            return EOF;
+        }
+    }
+    return static_cast<unsigned char>(m_buffer[m_pos++]);
+}
+
+bool
+FcdTokenizer::NextTag(std::string& tag)
+{
+    int c;
+    while ((c = Get()) != '<')
+    {
+        if (c == EOF)
+        {
+            return false;
+        }
+    }
+    tag.clear();
+    while (true)
+    {
+        while ((c = Get()) != '>')
+        {
+            if (c == EOF)
+            {
+                return false;
+            }
+            tag.push_back(static_cast<char>(c));
+        }
+        // the header comment of sumo output holds tags of its own, skip to the real end of it
+        bool openComment = tag.compare(0, 3, "!--") == 0 &&
+                           (tag.size() < 5 || tag.compare(tag.size() - 2, 2, "--") != 0);
+        if (!openComment)
+        {
+            return true;
+        }
+        tag.push_back('>');
+    }
+}
+
+const char*
+FcdTokenizer::FindAttribute(const std::string& tag, const char* name)
+{
+    std::size_t nameLength = std::strlen(name);
+    std::size_t pos = 0;
+    while ((pos = tag.find(name, pos)) != std::string::npos)
+    {
+        // whole attribute names only, " x=" must not match " pos="
+        if (pos > 0 && tag[pos - 1] == ' ' && tag.compare(pos + nameLength, 2, "=\"") == 0)
+        {
+            return tag.c_str() + pos + nameLength + 2;
+        }
+        pos += nameLength;
+    }
+    return nullptr;
+}
+
+// ===================================================================== //
+
+NS_OBJECT_ENSURE_REGISTERED(SumoFcdReader);
+
+TypeId
+SumoFcdReader::GetTypeId(void)
+{
+    static TypeId tid =
+        TypeId("ns3::SumoFcdReader")
+            .SetParent<Object>()
+            .SetGroupName("Mobility")
+            .AddConstructor<SumoFcdReader>()
+            .AddAttribute("Height",
+                          "The z coordinate given to vehicles, fcd output is two dimensional.",
+                          DoubleValue(1.0),
+                          MakeDoubleAccessor(&SumoFcdReader::m_height),
+                          MakeDoubleChecker<double>())
+            .AddAttribute("ParkingPosition",
+                          "Where the node of a vehicle that left the network is moved to.",
+                          VectorValue(Vector(-100000.0, -100000.0, 0.0)),
+                          MakeVectorAccessor(&SumoFcdReader::m_parkingPosition),
+                          MakeVectorChecker())
+            .AddAttribute("RecycleNodes",
+                          "Hand the node of a departed vehicle to the next new vehicle.",
+                          BooleanValue(false),
+                          MakeBooleanAccessor(&SumoFcdReader::m_recycleNodes),
+                          MakeBooleanChecker())
+            .AddTraceSource("Arrival",
+                            "A vehicle id appeared in the trace and was given a node.",
+                            MakeTraceSourceAccessor(&SumoFcdReader::m_arrivalTrace),
+                            "ns3::SumoFcdReader::VehicleCallback")
+            .AddTraceSource("Departure",
+                            "A vehicle id disappeared from the trace.",
+                            MakeTraceSourceAccessor(&SumoFcdReader::m_departureTrace),
+                            "ns3::SumoFcdReader::VehicleCallback");
+    return tid;
+}
+
+bool
+SumoFcdReader::Open(const std::string& filename)
+{
+    return m_tokenizer.Open(filename);
+}
+
+void
+SumoFcdReader::SetNodePool(NodeContainer pool)
+{
+    m_pool = pool;
+    m_poolNext = 0;
+    // park the whole pool up front, the devices and buildings helpers need a mobility model on
+    // every node long before its vehicle shows up
+    for (uint32_t i = 0; i < pool.GetN(); i++)
+    {
+        PrepareNode(pool.Get(i));
+    }
+}
+
+void
+SumoFcdReader::SetNodeCreationCallback(Callback<void, Ptr<Node>> callback)
+{
+    m_nodeCreation = callback;
+}
+
+void
+SumoFcdReader::Start()
+{
+    ScheduleNextStep();
+}
+
+void
+SumoFcdReader::DoDispose()
+{
+    m_vehicles.clear();
+    m_freeNodes.clear();
+    m_pool = NodeContainer();
+    m_nodeCreation = MakeNullCallback<void, Ptr<Node>>();
+    Object::DoDispose();
+}
+
+uint32_t
+SumoFcdReader::GetNActiveVehicles() const
+{
+    return m_vehicles.size();
+}
+
+uint32_t
+SumoFcdReader::CountVehicles(const std::string& filename)
+{
+    FcdTokenizer tokenizer;
+    if (!tokenizer.Open(filename))
+    {
+        return 0;
+    }
+    std::unordered_set<std::string> ids;
+    std::string tag;
+    while (tokenizer.NextTag(tag))
+    {
+        const char* id = tag.compare(0, 8, "vehicle ") == 0 ? FcdTokenizer::FindAttribute(tag, "id") : nullptr;
+        const char* idEnd = id ? std::strchr(id, '"') : nullptr;
+        if (idEnd)
+        {
+            ids.emplace(id, idEnd);
+        }
+    }
+    return ids.size();
+}
+
+void
+SumoFcdReader::ScheduleNextStep()
+{
+    while (m_tokenizer.NextTag(m_tag))
+    {
+        if (m_tag.compare(0, 9, "timestep ") != 0)
+        {
+            continue;
+        }
+        const char* time = FcdTokenizer::FindAttribute(m_tag, "time");
+        NS_ABORT_MSG_IF(!time, "fcd timestep without a time");
+        m_nextStepEmpty = m_tag.back() == '/';
+        Time at = Seconds(std::strtod(time, nullptr));
+        Simulator::Schedule(Max(at - Simulator::Now(), Seconds(0)), &SumoFcdReader::Step, Ptr<SumoFcdReader>(this));
+        return;
+    }
+}
+
+void
+SumoFcdReader::Step()
+{
+    PROFILE_SCOPE("SumoFcdReader::Step");
+    m_step++;
+    if (!m_nextStepEmpty)
+    {
+        while (m_tokenizer.NextTag(m_tag))
+        {
+            if (m_tag.compare(0, 8, "vehicle ") == 0)
+            {
+                ApplyVehicle(m_tag);
+            }
+            else if (m_tag.compare(0, 9, "/timestep") == 0)
+            {
+                break;
+            }
+        }
+    }
+    for (auto it = m_vehicles.begin(); it != m_vehicles.end();)
+    {
+        if (it->second.lastStep != m_step)
+        {
+            Depart(it->first, it->second);
+            it = m_vehicles.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+    ScheduleNextStep();
+}
+
+void
+SumoFcdReader::ApplyVehicle(const std::string& tag)
+{
+    const char* id = FcdTokenizer::FindAttribute(tag, "id");
+    const char* x = FcdTokenizer::FindAttribute(tag, "x");
+    const char* y = FcdTokenizer::FindAttribute(tag, "y");
+    const char* idEnd = id ? std::strchr(id, '"') : nullptr;
+    if (!idEnd || !x || !y)
+    {
+        return;
+    }
+    m_id.assign(id, idEnd);
+    const char* z = FcdTokenizer::FindAttribute(tag, "z");
+    const char* angle = FcdTokenizer::FindAttribute(tag, "angle");
+    const char* speed = FcdTokenizer::FindAttribute(tag, "speed");
+
+    auto it = m_vehicles.find(m_id);
+    if (it == m_vehicles.end())
+    {
+        Ptr<Node> node = AcquireNode();
+        it = m_vehicles.emplace(m_id, Vehicle{node, PrepareNode(node), m_step}).first;
+        m_arrivalTrace(m_id, node);
+    }
+    Vehicle& vehicle = it->second;
+    vehicle.lastStep = m_step;
+
+    // sumo angles are in degrees, clockwise from north
+    double heading = angle ? std::strtod(angle, nullptr) * M_PI / 180.0 : 0.0;
+    double v = speed ? std::strtod(speed, nullptr) : 0.0;
+    vehicle.mobility->SetPosition(
+        Vector(std::strtod(x, nullptr), std::strtod(y, nullptr), z ? std::strtod(z, nullptr) : m_height));
+    vehicle.mobility->SetVelocity(Vector(v * std::sin(heading), v * std::cos(heading), 0.0));
+}
+
+void
+SumoFcdReader::Depart(const std::string& id, Vehicle& vehicle)
+{
+    vehicle.mobility->SetVelocity(Vector(0.0, 0.0, 0.0));
+    vehicle.mobility->SetPosition(m_parkingPosition);
+    m_departureTrace(id, vehicle.node);
+    if (m_recycleNodes)
+    {
+        m_freeNodes.push_back(vehicle.node);
+    }
+}
+
+Ptr<ConstantVelocityMobilityModel>
+SumoFcdReader::PrepareNode(Ptr<Node> node)
+{
+    Ptr<ConstantVelocityMobilityModel> mobility = node->GetObject<ConstantVelocityMobilityModel>();
+    if (!mobility)
+    {
+        NS_ABORT_MSG_IF(node->GetObject<MobilityModel>(),
+                        "node " << node->GetId() << " has a mobility model other than ConstantVelocity");
+        mobility = CreateObject<ConstantVelocityMobilityModel>();
+        mobility->SetPosition(m_parkingPosition);
+        node->AggregateObject(mobility);
+    }
+    return mobility;
+}
+
+Ptr<Node>
+SumoFcdReader::AcquireNode()
+{
+    if (!m_freeNodes.empty())
+    {
+        Ptr<Node> node = m_freeNodes.back();
+        m_freeNodes.pop_back();
+        return node;
+    }
+    if (m_poolNext < m_pool.GetN())
+    {
+        return m_pool.Get(m_poolNext++);
+    }
+    NS_ABORT_MSG_IF(m_nodeCreation.IsNull(),
+                    "vehicle " << m_id << " found the pool of " << m_pool.GetN()
+                               << " nodes used up and no node creation callback is set");
+    Ptr<Node> node = CreateObject<Node>();
+    PrepareNode(node);
+    m_nodeCreation(node);
+    return node;
+}
+
+#endif
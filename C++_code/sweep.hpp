@@ -0,0 +1,354 @@
+#ifndef SWEEP_HPP
+#define SWEEP_HPP
+
+#include "ns3/abort.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <new>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace ns3;
+
+// One point of a parameter grid: the value of every parameter, in the order of the config file.
+using SweepPoint = std::vector<std::pair<std::string, std::string>>;
+
+// Parameter grid read from a text file, one parameter per line:
+//
+//   protocol = AODV, OLSR, DSDV, DSR
+//   txp      = 5, 7.5, 10
+//   RngRun   = 1..5
+//
+// a..b expands to every integer from a to b. # starts a comment. The grid is every combination.
+class SweepConfig{
+  public:
+    bool Load(const std::string& filename);
+    // the last parameter varies fastest
+    std::vector<SweepPoint> Expand() const;
+
+  private:
+    std::vector<std::pair<std::string, std::vector<std::string>>> m_parameters;
+};
+
+// Runs every point of a grid in worker processes and gathers one row of results per point.
+//
+// Whatever the caller loaded before Run (traces, buildings, weather) is shared by all the workers
+// copy on write, so it is loaded once per sweep instead of once per run. Each worker takes the next
+// point from a counter in shared memory, so a worker that drew short runs simply takes more of them,
+// and runs it in a child process of its own: ns-3 keeps global state (the simulator, the node list,
+// the random stream counter) that must start fresh for every run to be reproducible. The child writes
+// its results straight into a shared table.
+//
+// Fork is the other way in, for points that all continue from a state the caller has already reached,
+// such as a simulation warmed up to the time where the points start to differ.
+class SweepRunner{
+  public:
+    static const std::size_t MAX_RESULTS = 16;
+    static const std::size_t NO_POINT = static_cast<std::size_t>(-1);
+    using RunFunction = std::function<void(const SweepPoint& point, double* results)>;
+
+    SweepRunner(std::vector<SweepPoint> points, std::vector<std::string> resultColumns);
+    ~SweepRunner();
+
+    SweepRunner(const SweepRunner& src) = delete;
+    SweepRunner& operator=(const SweepRunner& src) = delete;
+
+    // returns once every point has run; false if any run failed
+    bool Run(uint32_t jobs, RunFunction run);
+    // forks a child per point, at most jobs at once, and returns the index of its point in each child.
+    // In the caller, returns NO_POINT once every child has exited.
+    std::size_t Fork(uint32_t jobs);
+    const SweepPoint& GetPoint(std::size_t point) const;
+    // from the child of a Fork
+    void SetResults(std::size_t point, const double* results);
+    bool AllSucceeded() const;
+    // one row per point: the parameters, then the results (empty for failed runs)
+    bool WriteResults(const std::string& filename) const;
+
+    // "name-value_name-value..." for file names
+    static std::string GetKey(const SweepPoint& point);
+
+  private:
+    struct Result
+    {
+        uint32_t ok;
+        double values[MAX_RESULTS];
+    };
+    struct Shared
+    {
+        std::atomic<uint64_t> next;
+        Result results[1];
+    };
+
+    void Work(const RunFunction& run);
+
+    std::vector<SweepPoint> m_points;
+    std::vector<std::string> m_resultColumns;
+    Shared* m_shared{nullptr};
+    std::size_t m_sharedSize{0};
+};
+
+// ===================================================================== //
+
+static std::string
+TrimSweepField(const std::string& field)
+{
+    std::size_t first = field.find_first_not_of(" \t\r");
+    if (first == std::string::npos)
+    {
+        return "";
+    }
+    return field.substr(first, field.find_last_not_of(" \t\r") - first + 1);
+}
+
+bool
+SweepConfig::Load(const std::string& filename)
+{
+    std::ifstream file(filename);
+    if (!file)
+    {
+        return false;
+    }
+    m_parameters.clear();
+    std::string line;
+    while (std::getline(file, line))
+    {
+        line = TrimSweepField(line.substr(0, line.find('#')));
+        if (line.empty())
+        {
+            continue;
+        }
+        std::size_t equals = line.find('=');
+        if (equals == std::string::npos)
+        {
+            return false;
+        }
+        std::string name = TrimSweepField(line.substr(0, equals));
+        std::vector<std::string> values;
+        std::istringstream list(line.substr(equals + 1));
+        std::string value;
+        while (std::getline(list, value, ','))
+        {
+            value = TrimSweepField(value);
+            std::size_t dots = value.find("..");
+            if (dots != std::string::npos)
+            {
+                long first = std::stol(value.substr(0, dots));
+                long last = std::stol(value.substr(dots + 2));
+                for (long i = first; i <= last; i++)
+                {
+                    values.push_back(std::to_string(i));
+                }
+            }
+            else if (!value.empty())
+            {
+                values.push_back(value);
+            }
+        }
+        if (name.empty() || values.empty())
+        {
+            return false;
+        }
+        m_parameters.emplace_back(name, values);
+    }
+    return true;
+}
+
+std::vector<SweepPoint>
+SweepConfig::Expand() const
+{
+    std::vector<SweepPoint> points(1);
+    for (const auto& [name, values]: m_parameters)
+    {
+        std::vector<SweepPoint> expanded;
+        expanded.reserve(points.size() * values.size());
+        for (const SweepPoint& point: points)
+        {
+            for (const std::string& value: values)
+            {
+                expanded.push_back(point);
+                expanded.back().emplace_back(name, value);
+            }
+        }
+        points.swap(expanded);
+    }
+    return points;
+}
+
+// ===================================================================== //
+
+SweepRunner::SweepRunner(std::vector<SweepPoint> points, std::vector<std::string> resultColumns)
+    : m_points(std::move(points)),
+      m_resultColumns(std::move(resultColumns))
+{
+    NS_ABORT_MSG_IF(m_resultColumns.size() > MAX_RESULTS, "too many sweep result columns");
+    m_sharedSize = sizeof(Shared) + sizeof(Result) * m_points.size();
+    void* shared = mmap(nullptr, m_sharedSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    NS_ABORT_MSG_IF(shared == MAP_FAILED, "could not map the sweep result table");
+    // anonymous mappings start zeroed: no point taken and no result yet
+    m_shared = new (shared) Shared;
+    m_shared->next = 0;
+}
+
+SweepRunner::~SweepRunner()
+{
+    munmap(m_shared, m_sharedSize);
+}
+
+std::string
+SweepRunner::GetKey(const SweepPoint& point)
+{
+    std::string key;
+    for (const auto& [name, value]: point)
+    {
+        key += (key.empty() ? "" : "_") + name + "-" + value;
+    }
+    return key;
+}
+
+bool
+SweepRunner::Run(uint32_t jobs, RunFunction run)
+{
+    std::vector<pid_t> workers;
+    for (uint32_t i = 0; i < std::max(jobs, 1u); i++)
+    {
+        pid_t pid = fork();
+        NS_ABORT_MSG_IF(pid < 0, "fork failed");
+        if (pid == 0)
+        {
+            Work(run);
+            _exit(0);
+        }
+        workers.push_back(pid);
+    }
+    for (pid_t pid: workers)
+    {
+        int status;
+        waitpid(pid, &status, 0);
+    }
+    return AllSucceeded();
+}
+
+std::size_t
+SweepRunner::Fork(uint32_t jobs)
+{
+    uint32_t running = 0;
+    for (std::size_t i = 0; i < m_points.size(); i++)
+    {
+        if (running == std::max(jobs, 1u))
+        {
+            int status;
+            wait(&status);
+            running--;
+        }
+        pid_t pid = fork();
+        NS_ABORT_MSG_IF(pid < 0, "fork failed");
+        if (pid == 0)
+        {
+            return i;
+        }
+        running++;
+    }
+    for (; running > 0; running--)
+    {
+        int status;
+        wait(&status);
+    }
+    return NO_POINT;
+}
+
+const SweepPoint&
+SweepRunner::GetPoint(std::size_t point) const
+{
+    return m_points[point];
+}
+
+void
+SweepRunner::SetResults(std::size_t point, const double* results)
+{
+    Result& result = m_shared->results[point];
+    std::copy(results, results + m_resultColumns.size(), result.values);
+    result.ok = 1;
+}
+
+bool
+SweepRunner::AllSucceeded() const
+{
+    return std::all_of(m_shared->results, m_shared->results + m_points.size(), [](const Result& r) { return r.ok; });
+}
+
+void
+SweepRunner::Work(const RunFunction& run)
+{
+    while (true)
+    {
+        uint64_t i = m_shared->next.fetch_add(1);
+        if (i >= m_points.size())
+        {
+            return;
+        }
+        // the worker itself never simulates, so every child starts from the state loaded before Run
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            Result& result = m_shared->results[i];
+            run(m_points[i], result.values);
+            result.ok = 1;
+            _exit(0);
+        }
+        int status;
+        if (pid > 0)
+        {
+            waitpid(pid, &status, 0);
+        }
+    }
+}
+
+bool
+SweepRunner::WriteResults(const std::string& filename) const
+{
+    std::ofstream file(filename);
+    if (!file || m_points.empty())
+    {
+        return static_cast<bool>(file);
+    }
+    for (const auto& parameter: m_points[0])
+    {
+        file << parameter.first << ",";
+    }
+    for (std::size_t i = 0; i < m_resultColumns.size(); i++)
+    {
+        file << (i ? "," : "") << m_resultColumns[i];
+    }
+    file << "\n";
+    for (std::size_t p = 0; p < m_points.size(); p++)
+    {
+        for (const auto& parameter: m_points[p])
+        {
+            file << parameter.second << ",";
+        }
+        const Result& result = m_shared->results[p];
+        for (std::size_t i = 0; i < m_resultColumns.size(); i++)
+        {
+            file << (i ? "," : "");
+            if (result.ok)
+            {
+                file << result.values[i];
+            }
+        }
+        file << "\n";
+    }
+    return static_cast<bool>(file);
+}
+
+#endif
@@ -0,0 +1,288 @@
+#ifndef WEATHERFIELD_HPP
+#define WEATHERFIELD_HPP
+
+#include "ns3/abort.h"
+#include "ns3/double.h"
+#include "ns3/mobility-model.h"
+#include "ns3/nstime.h"
+#include "ns3/object.h"
+#include "ns3/pointer.h"
+#include "ns3/propagation-loss-model.h"
+#include "ns3/simulator.h"
+#include "ns3/vector.h"
+
+#include "profiler.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace ns3;
+
+// Rain and snow cells over the map: each cell attenuates every link whose midpoint lies within its
+// radius while its time window is open. Where cells overlap the strongest one applies.
+//
+// Time is cut into epochs of EpochLength; a cell counts for a whole epoch when its window covers the
+// start of the epoch. At the first lookup of each epoch the active cells are rasterised into a grid
+// of Resolution x Resolution squares spanning all the cells, so every lookup after that is a grid
+// read.
+class WeatherField: public Object{
+  public:
+    static TypeId GetTypeId(void);
+    WeatherField() = default;
+
+    struct Cell
+    {
+        double x;
+        double y;
+        double radius;
+        Time start;
+        Time end;
+        double attenuationDb;
+    };
+
+    void AddCell(double x, double y, double radius, Time start, Time end, double attenuationDb);
+    // one cell per line: x y radius start(s) end(s) attenuation(dB), # starts a comment
+    bool Load(const std::string& filename);
+    const std::vector<Cell>& GetCells() const;
+
+    // extra loss of the link between a and b at the current simulation time
+    double GetAttenuation(const Vector& a, const Vector& b) const;
+
+  private:
+    void Rebuild(int64_t epoch) const;
+
+    std::vector<Cell> m_cells;
+    double m_resolution{25};
+    Time m_epochLength{Seconds(1)};
+
+    // grid of the current epoch, covering the bounding box of every cell
+    mutable double m_minX{0};
+    mutable double m_minY{0};
+    mutable uint32_t m_nX{0};
+    mutable uint32_t m_nY{0};
+    mutable std::vector<float> m_grid;
+    mutable int64_t m_epoch{-1};
+    mutable bool m_active{false};    // any cell in the current epoch
+};
+
+// Adds the attenuation of a WeatherField to a loss model chain, for channels whose loss model has no
+// weather of its own (final_vanet's buildings model).
+class WeatherFieldPropagationLossModel: public PropagationLossModel{
+  public:
+    static TypeId GetTypeId(void);
+    WeatherFieldPropagationLossModel() = default;
+
+  protected:
+    void DoDispose() override;
+    double DoCalcRxPower(double txPowerDbm,
+                         Ptr<MobilityModel> a,
+                         Ptr<MobilityModel> b) const override;
+    int64_t DoAssignStreams(int64_t stream) override;
+
+  private:
+    Ptr<WeatherField> m_field;
+};
+
+// ===================================================================== //
+
+NS_OBJECT_ENSURE_REGISTERED(WeatherField);
+
+TypeId
+WeatherField::GetTypeId(void)
+{
+    static TypeId tid =
+        TypeId("ns3::WeatherField")
+            .SetParent<Object>()
+            .SetGroupName("Propagation")
+            .AddConstructor<WeatherField>()
+            .AddAttribute("Resolution",
+                          "Side (m) of the squares the cells are rasterised into.",
+                          DoubleValue(25.0),
+                          MakeDoubleAccessor(&WeatherField::m_resolution),
+                          MakeDoubleChecker<double>(0.1))
+            .AddAttribute("EpochLength",
+                          "Time between two rebuilds of the grid; cell windows are rounded to it.",
+                          TimeValue(Seconds(1.0)),
+                          MakeTimeAccessor(&WeatherField::m_epochLength),
+                          MakeTimeChecker(NanoSeconds(1)));
+    return tid;
+}
+
+void
+WeatherField::AddCell(double x, double y, double radius, Time start, Time end, double attenuationDb)
+{
+    NS_ABORT_MSG_IF(radius <= 0 || attenuationDb < 0, "weather cells need a radius and a non negative attenuation");
+    m_cells.push_back({x, y, radius, start, end, attenuationDb});
+    // resized to the new bounding box at the next lookup
+    m_grid.clear();
+    m_epoch = -1;
+}
+
+bool
+WeatherField::Load(const std::string& filename)
+{
+    std::ifstream file(filename);
+    if (!file)
+    {
+        return false;
+    }
+    std::string line;
+    while (std::getline(file, line))
+    {
+        line = line.substr(0, line.find('#'));
+        if (line.find_first_not_of(" \t\r") == std::string::npos)
+        {
+            continue;
+        }
+        std::istringstream fields(line);
+        double x;
+        double y;
+        double radius;
+        double start;
+        double end;
+        double attenuationDb;
+        if (!(fields >> x >> y >> radius >> start >> end >> attenuationDb))
+        {
+            return false;
+        }
+        AddCell(x, y, radius, Seconds(start), Seconds(end), attenuationDb);
+    }
+    return true;
+}
+
+const std::vector<WeatherField::Cell>&
+WeatherField::GetCells() const
+{
+    return m_cells;
+}
+
+void
+WeatherField::Rebuild(int64_t epoch) const
+{
+    PROFILE_SCOPE("WeatherField::Rebuild");
+    if (m_grid.empty())
+    {
+        double maxX = m_cells[0].x + m_cells[0].radius;
+        double maxY = m_cells[0].y + m_cells[0].radius;
+        m_minX = m_cells[0].x - m_cells[0].radius;
+        m_minY = m_cells[0].y - m_cells[0].radius;
+        for (const Cell& cell: m_cells)
+        {
+            m_minX = std::min(m_minX, cell.x - cell.radius);
+            m_minY = std::min(m_minY, cell.y - cell.radius);
+            maxX = std::max(maxX, cell.x + cell.radius);
+            maxY = std::max(maxY, cell.y + cell.radius);
+        }
+        m_nX = static_cast<uint32_t>(std::ceil((maxX - m_minX) / m_resolution)) + 1;
+        m_nY = static_cast<uint32_t>(std::ceil((maxY - m_minY) / m_resolution)) + 1;
+        m_grid.resize(static_cast<std::size_t>(m_nX) * m_nY);
+    }
+    std::fill(m_grid.begin(), m_grid.end(), 0.0f);
+    m_active = false;
+    int64_t epochStart = m_epochLength.GetTimeStep() * epoch;
+    for (const Cell& cell: m_cells)
+    {
+        if (epochStart < cell.start.GetTimeStep() || epochStart >= cell.end.GetTimeStep())
+        {
+            continue;
+        }
+        m_active = true;
+        // squares whose centre is inside the circle
+        uint32_t x0 = static_cast<uint32_t>(std::max(0.0, std::floor((cell.x - cell.radius - m_minX) / m_resolution)));
+        uint32_t y0 = static_cast<uint32_t>(std::max(0.0, std::floor((cell.y - cell.radius - m_minY) / m_resolution)));
+        uint32_t x1 = std::min(m_nX - 1, static_cast<uint32_t>((cell.x + cell.radius - m_minX) / m_resolution));
+        uint32_t y1 = std::min(m_nY - 1, static_cast<uint32_t>((cell.y + cell.radius - m_minY) / m_resolution));
+        for (uint32_t j = y0; j <= y1; j++)
+        {
+            double dy = m_minY + (j + 0.5) * m_resolution - cell.y;
+            for (uint32_t i = x0; i <= x1; i++)
+            {
+                double dx = m_minX + (i + 0.5) * m_resolution - cell.x;
+                if (dx * dx + dy * dy <= cell.radius * cell.radius)
+                {
+                    float& square = m_grid[static_cast<std::size_t>(j) * m_nX + i];
+                    square = std::max(square, static_cast<float>(cell.attenuationDb));
+                }
+            }
+        }
+    }
+    m_epoch = epoch;
+}
+
+double
+WeatherField::GetAttenuation(const Vector& a, const Vector& b) const
+{
+    if (m_cells.empty())
+    {
+        return 0;
+    }
+    int64_t epoch = Simulator::Now().GetTimeStep() / m_epochLength.GetTimeStep();
+    if (epoch != m_epoch)
+    {
+        Rebuild(epoch);
+    }
+    if (!m_active)
+    {
+        return 0;
+    }
+    double i = std::floor(((a.x + b.x) / 2 - m_minX) / m_resolution);
+    double j = std::floor(((a.y + b.y) / 2 - m_minY) / m_resolution);
+    if (i < 0 || j < 0 || i >= m_nX || j >= m_nY)
+    {
+        return 0;
+    }
+    return m_grid[static_cast<std::size_t>(j) * m_nX + static_cast<std::size_t>(i)];
+}
+
+// ===================================================================== //
+
+NS_OBJECT_ENSURE_REGISTERED(WeatherFieldPropagationLossModel);
+
+TypeId
+WeatherFieldPropagationLossModel::GetTypeId(void)
+{
+    static TypeId tid =
+        TypeId("ns3::WeatherFieldPropagationLossModel")
+            .SetParent<PropagationLossModel>()
+            .SetGroupName("Propagation")
+            .AddConstructor<WeatherFieldPropagationLossModel>()
+            .AddAttribute("Field",
+                          "The weather field whose attenuation is added.",
+                          PointerValue(),
+                          MakePointerAccessor(&WeatherFieldPropagationLossModel::m_field),
+                          MakePointerChecker<WeatherField>());
+    return tid;
+}
+
+void
+WeatherFieldPropagationLossModel::DoDispose()
+{
+    m_field = nullptr;
+    PropagationLossModel::DoDispose();
+}
+
+double
+WeatherFieldPropagationLossModel::DoCalcRxPower(double txPowerDbm,
+                                                 Ptr<MobilityModel> a,
+                                                 Ptr<MobilityModel> b) const
+{
+    PROFILE_SCOPE("WeatherFieldPropagationLossModel::DoCalcRxPower");
+    if (!m_field)
+    {
+        return txPowerDbm;
+    }
+    return txPowerDbm - m_field->GetAttenuation(a->GetPosition(), b->GetPosition());
+}
+
+int64_t
+WeatherFieldPropagationLossModel::DoAssignStreams(int64_t stream)
+{
+    return 0;
+}
+
+#endif
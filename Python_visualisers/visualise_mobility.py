@@ -1,13 +1,41 @@
+import struct
+
 import seaborn as sns
 import matplotlib.pyplot as plt
+import numpy as np
 import pandas as pd
 
 # note this needs to be changed to the correct parent folder
 parent_path = "./../../ns-allinone-3.39/ns-3.39/"
-file = "output.txt"
+file = "mobility.pos"
 name = "Spatial Distribution"
 path = parent_path + file
-data = pd.read_csv(path, index_col="node", names = ["node", "x", "y"])
+
+# reads the position snapshots written by final_mobility, see positionsampler.hpp for the layout
+def read_positions(path):
+    frames = []
+    with open(path, "rb") as f:
+        magic, version, node_count, interval = struct.unpack("<8sIId", f.read(24))
+        if magic != b"KAKAPOS1" or version != 1:
+            raise ValueError(path + " is not a position snapshot file")
+        nodes = np.frombuffer(f.read(4 * node_count), dtype="<u4")
+        while True:
+            block = f.read(8)
+            if len(block) < 8:
+                break
+            count, _ = struct.unpack("<II", block)
+            time = np.frombuffer(f.read(8 * count), dtype="<f8")
+            x, y, z = (np.frombuffer(f.read(4 * count * node_count), dtype="<f4") for _ in range(3))
+            frames.append(pd.DataFrame({
+                "time": np.repeat(time, node_count),
+                "node": np.tile(nodes, count),
+                "x": x,
+                "y": y,
+                "z": z,
+                }))
+    return pd.concat(frames).set_index("node")
+
+data = read_positions(path)
 
 def read_data():
     print(data)
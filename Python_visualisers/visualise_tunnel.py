@@ -7,17 +7,19 @@ import numpy as np
 parent_path = "./../../ns-allinone-3.39/ns-3.39/"
 file = "rssi_building"
 name = "Plot of RSSI changes Dependent on Time"
+# written by the LinkProbe of final_tunnel, one line per received frame
+columns = ["node", "distance", "rssi", "time", "noise", "sender"]
 
 def read_dataset_wood() -> pd.DataFrame:
-    data = pd.read_csv(parent_path + file + "_wood.txt", names = ["node", "distance", "rssi"], header=None)
+    data = pd.read_csv(parent_path + file + "_wood.txt", names = columns, header=None)
     return data
 
 def read_dataset_concrete() -> pd.DataFrame:
-    data = pd.read_csv(parent_path+file+"_concrete.txt", names = ["node", "distance", "rssi"], header=None)
+    data = pd.read_csv(parent_path+file+"_concrete.txt", names = columns, header=None)
     return data
 
 def read_dataset_stone() -> pd.DataFrame:
-    data = pd.read_csv(parent_path+file+"_stone.txt", names = ["node", "distance", "rssi"], header=None)
+    data = pd.read_csv(parent_path+file+"_stone.txt", names = columns, header=None)
     return data
 
 ###############################################################################################